@@ -69,6 +69,18 @@ public:
 	bool rayIntersect(const Ray3f &ray, Intersection &its,
 		bool shadowRay = false) const;
 
+	/**
+	 * \brief Find all intersections of a ray with the registered meshes
+	 *
+	 * Unlike \ref rayIntersect(), the traversal doesn't stop at the
+	 * closest hit. The distance and the index of the mesh (see
+	 * \ref getMesh()) of every triangle that the ray crosses between
+	 * \c ray.mint and \c ray.maxt are appended to \c hits, in no
+	 * particular order.
+	 */
+	void rayIntersectAll(const Ray3f &ray,
+		std::vector<std::pair<float, n_UINT>> &hits) const;
+
 	/// Return the total number of meshes registered with the BVH
 	n_UINT getMeshCount() const { return (n_UINT)m_meshes.size(); }
 
@@ -24,9 +24,12 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
-#include <tbb/mutex.h>
+#include <tbb/spin_mutex.h>
+#include <memory>
+#include <atomic>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
+#define NORI_LOCK_BAND_HEIGHT 8 /* Number of rows protected by one lock */
 
 NORI_NAMESPACE_BEGIN
 
@@ -94,16 +97,49 @@ public:
     /**
      * \brief Merge another image block into this one
      *
-     * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * The destination block is protected by a set of locks, each of
+     * which covers a band of rows. The merge operation only holds
+     * one of them at a time, hence blocks that are merged concurrently
+     * merely wait for each other while updating the very same rows.
      */
     void put(ImageBlock &b);
 
-    /// Lock the image block (using an internal mutex)
-    inline void lock() const { m_mutex.lock(); }
+    /**
+     * \brief Add a contribution that was not generated by sampling the pixel
+     *
+     * Used for light tracing: \c value is added to the pixel that contains
+     * \c pos without adding any filter weight. It is scaled by the integral
+     * of the reconstruction filter, so that after normalization it counts as
+     * \c value divided by the number of samples per pixel. In contrast to
+     * the other \c put() functions, this one is thread-safe.
+     */
+    void splat(const Point2f &pos, const Color3f &value);
+
+    /**
+     * \brief Configure the number of rows protected by a single lock
+     *
+     * Smaller bands allow more merges to proceed concurrently. A band
+     * height that covers all rows reproduces a single global lock.
+     */
+    void setLockBandHeight(int rows);
+
+    /// Return the number of rows protected by a single lock
+    inline int getLockBandHeight() const { return m_bandHeight; }
+
+    /// Return the number of lock bands
+    inline int getLockBandCount() const { return m_bandCount; }
+
+    /// Lock the rows of a band (row indices include the border region)
+    inline void lockBand(int band) const { m_bands[band].mutex.lock(); }
+
+    /// Unlock the rows of a band
+    inline void unlockBand(int band) const { m_bands[band].mutex.unlock(); }
+
+    /// Lock the complete image block (acquires the locks of all bands)
+    void lock() const;
     
-    /// Unlock the image block
-    inline void unlock() const { m_mutex.unlock(); }
+    /// Unlock the complete image block
+    void unlock() const;
 
     /// Return a human-readable string summary
     std::string toString() const;
@@ -116,27 +152,47 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
+    float m_splatScale = 1;
+
+    /* Padded so that neighboring locks don't share a cache line */
+    struct BandLock {
+        tbb::spin_mutex mutex;
+        char padding[64 - sizeof(tbb::spin_mutex)];
+    };
+    std::unique_ptr<BandLock[]> m_bands;
+    int m_bandHeight = 0;
+    int m_bandCount = 0;
 };
 
 /**
- * \brief Spiraling block generator
+ * \brief Block generator
  *
  * This class can be used to chop up an image into many small
- * rectangular blocks suitable for parallel rendering. The blocks
- * are ordered in spiraling pattern so that the center is
- * rendered first.
+ * rectangular blocks suitable for parallel rendering. The order of
+ * the blocks is computed once when the generator is created: either
+ * a spiraling pattern so that the center is rendered first, or a
+ * Hilbert/Morton curve that keeps consecutive blocks close to each
+ * other for better cache locality. The blocks are then handed out
+ * using a single atomic counter.
+ *
+ * Blocks are identified by their index in scanline order, i.e.
+ * <tt>y * blocksX + x</tt>, which is independent of the chosen order.
  */
 class BlockGenerator {
 public:
+    /// Supported block orders
+    enum EOrder { ESpiral = 0, EHilbert, EMorton };
+
     /**
      * \brief Create a block generator with
      * \param size
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param order
+     *      Order in which the blocks are handed out
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize, EOrder order = ESpiral);
     
     /**
      * \brief Return the next block to be rendered
@@ -145,22 +201,52 @@ public:
      *
      * \return \c false if there were no more blocks
      */
-    bool next(ImageBlock &block);
+    bool next(ImageBlock &block) { int index; return next(block, index); }
+
+    /**
+     * \brief Return the next block to be rendered along with its index
+     *
+     * This function is thread-safe
+     *
+     * \return \c false if there were no more blocks
+     */
+    bool next(ImageBlock &block, int &index);
+
+    /**
+     * \brief Reorder the blocks so that expensive ones come first
+     *
+     * \param cost
+     *      Estimated cost of every block (in scanline order). Blocks
+     *      with the same cost retain their relative order.
+     */
+    void sortByCost(const std::vector<float> &cost);
+
+    /// Hand out all blocks again (e.g. for another pass). Not thread-safe.
+    void reset() { m_next = 0; }
 
     /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    int getBlockCount() const { return (int) m_order.size(); }
+
+    /// Return the number of blocks along each axis
+    const Vector2i &getBlockGridSize() const { return m_numBlocks; }
+
+    /// Return the offset and size of the block with the given index
+    void getBlock(int index, Point2i &offset, Vector2i &size) const;
+
+    /// Parse the name of a block order ("spiral", "hilbert" or "morton")
+    static EOrder parseOrder(const std::string &name);
 protected:
-    enum EDirection { ERight = 0, EDown, ELeft, EUp };
+    /// Compute the center-out spiral order
+    void generateSpiral();
+
+    /// Compute a space-filling curve order (Hilbert or Morton)
+    void generateCurve(EOrder order);
 
-    Point2i m_block;
     Vector2i m_numBlocks;
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    std::vector<int> m_order;
+    std::atomic<int> m_next;
 };
 
 NORI_NAMESPACE_END
@@ -105,6 +105,38 @@ public:
 
     virtual float pdf(const BSDFQueryRecord &bRec) const = 0;
 
+    /**
+     * \brief Sample the BSDF for a span of query records
+     *
+     * Equivalent to calling \ref sample() once per record, but costs a
+     * single virtual call. BSDFs that are used by the batched integrators
+     * override this with a tight loop over the records.
+     *
+     * \param bRecs    Array of \c count BSDF query records
+     * \param samples  Array of \c count uniformly distributed samples
+     * \param result   Receives the importance weights (see \ref sample())
+     * \param count    Number of records
+     */
+    virtual void sampleBatch(BSDFQueryRecord *bRecs, const Point2f *samples,
+            Color3f *result, size_t count) const {
+        for (size_t i = 0; i < count; ++i)
+            result[i] = sample(bRecs[i], samples[i]);
+    }
+
+    /// Evaluate the BSDF for a span of query records (see \ref eval())
+    virtual void evalBatch(const BSDFQueryRecord *bRecs, Color3f *result,
+            size_t count) const {
+        for (size_t i = 0; i < count; ++i)
+            result[i] = eval(bRecs[i]);
+    }
+
+    /// Compute the sampling density for a span of query records (see \ref pdf())
+    virtual void pdfBatch(const BSDFQueryRecord *bRecs, float *result,
+            size_t count) const {
+        for (size_t i = 0; i < count; ++i)
+            result[i] = pdf(bRecs[i]);
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
      * provided by this instance
@@ -118,6 +150,20 @@ public:
      */
     virtual bool isDiffuse() const { return false; }
 
+    /**
+     * \brief Return whether this BSDF is an ideal Lambertian reflector,
+     * i.e. its value doesn't depend on the directions. Unlike
+     * \ref isDiffuse(), this excludes rough microfacet models
+     */
+    virtual bool isLambertian() const { return false; }
+
+    /**
+     * \brief Return whether this BSDF is an invisible boundary (e.g. of
+     * a medium) that lets light through unchanged. Shadow rays don't
+     * stop at such surfaces, see Scene::transmittance()
+     */
+    virtual bool isNull() const { return false; }
+
     /*
     *  \brief Checks if the bsdf has a displacement map.
     * This displacement map is used for bump mapping
@@ -128,6 +174,13 @@ public:
     * \brief Computes the displacement from the displacement texture
     */
     virtual Normal3f displacement(const Point2f& uv) const { return 0; }
+
+    /**
+     * \brief Return how spread out the scattered light is at \c uv,
+     * from 0 (perfectly specular) to 1 (diffuse). Integrators use this
+     * to decide how many emitter samples a vertex deserves.
+     */
+    virtual float getRoughness(const Point2f& uv) const { return 1.0f; }
 };
 
 NORI_NAMESPACE_END
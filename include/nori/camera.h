@@ -57,6 +57,30 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Connect a point in the scene to the camera (light tracing)
+     *
+     * \param ref
+     *    The reference point in world space
+     * \param samplePosition
+     *    Film position of \c ref in fractional pixel coordinates
+     * \param wi
+     *    Direction from \c ref to the camera
+     * \param dist
+     *    Distance between \c ref and the camera
+     *
+     * \return
+     *    The importance arriving at \c ref, i.e. the camera response
+     *    times the cosine at the camera divided by the squared distance
+     *    (analogous to point lights). Zero if \c ref isn't visible on the
+     *    film or the camera doesn't support light tracing (the default).
+     */
+    virtual Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+        Vector3f &wi, float &dist) const { return Color3f(0.0f); }
+
+    /// Solid angle density of the ray directions generated by \ref sampleRay()
+    virtual float pdfDirection(const Vector3f &d) const { return 0.0f; }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
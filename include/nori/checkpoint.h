@@ -0,0 +1,109 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/block.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Snapshot of an in-progress progressive render
+ *
+ * A checkpoint stores everything that is needed to continue a render
+ * after it was interrupted: the accumulated \ref Color4f buffer (including
+ * the reconstruction filter weights), the optional buffer of odd passes
+ * used for noise estimation, the number of samples taken per pixel, the
+ * estimated cost of the image tiles (if cost-aware scheduling is used) and
+ * the state of the sampler.
+ *
+ * Checkpoints are only written between passes. Since samplers derive their
+ * random number streams from the pass index and the block position, a
+ * resumed render computes exactly the same passes as an uninterrupted one.
+ */
+class Checkpoint {
+public:
+    typedef Eigen::Array<uint32_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> SampleCounts;
+
+    /**
+     * \brief Create a checkpoint that refers to the state of a render
+     *
+     * \param result
+     *     Image that accumulates all passes
+     * \param oddPasses
+     *     Image that accumulates the odd passes (may be \c nullptr)
+     * \param sampleCounts
+     *     Number of samples taken per pixel
+     * \param sampler
+     *     The sampler of the scene
+     */
+    Checkpoint(ImageBlock &result, ImageBlock *oddPasses,
+        SampleCounts &sampleCounts, Sampler *sampler);
+
+    /**
+     * \brief Write the checkpoint to disk
+     *
+     * The data is first written to a temporary file, which then replaces
+     * the previous checkpoint. A render that is killed while writing thus
+     * never leaves a truncated checkpoint behind.
+     */
+    void save(const std::string &filename) const;
+
+    /**
+     * \brief Restore the render state from a checkpoint file
+     *
+     * Throws a \ref NoriException when the file is damaged or was written
+     * for an image with a different resolution or reconstruction filter.
+     */
+    void load(const std::string &filename);
+
+    /**
+     * \brief Include the estimated tile costs in the checkpoint
+     *
+     * The tile costs determine how tiles are split into sub-tiles, which
+     * in turn affects the random number streams of the sampler. They are
+     * thus restored as well to reproduce an uninterrupted render.
+     */
+    void setTileCosts(std::vector<float> *tileCosts) { m_tileCosts = tileCosts; }
+
+    /// Set the number of completed passes and samples per pixel
+    void setProgress(uint32_t passes, uint32_t samplesTaken, double elapsed) {
+        m_passes = passes; m_samplesTaken = samplesTaken; m_elapsed = elapsed;
+    }
+
+    /// Return the number of completed passes
+    uint32_t getPassCount() const { return m_passes; }
+
+    /// Return the number of samples per pixel taken in the completed passes
+    uint32_t getSamplesTaken() const { return m_samplesTaken; }
+
+    /// Return the rendering time (in seconds) of the completed passes
+    double getElapsed() const { return m_elapsed; }
+private:
+    ImageBlock &m_result;
+    ImageBlock *m_oddPasses;
+    SampleCounts &m_sampleCounts;
+    Sampler *m_sampler;
+    std::vector<float> *m_tileCosts = nullptr;
+    uint32_t m_passes = 0;
+    uint32_t m_samplesTaken = 0;
+    double m_elapsed = 0.0;
+};
+
+NORI_NAMESPACE_END
@@ -4,27 +4,42 @@
 
 #include <nori/common.h>
 #include <nori/object.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
-
+/**
+ * \brief Piecewise constant 1D distribution over [0, 1) (as in PBRT)
+ *
+ * Sampling inverts the CDF with a guide table: the first interval whose
+ * CDF reaches each of \c n equally spaced values is precomputed, so a
+ * sample only scans forward a few entries from there (O(1) expected
+ * instead of a binary search).
+ */
 struct Distribution1D{
 public:
 
     Distribution1D(const float* f, int n);
+    /// Sample a point in [0, 1) with density \c pdf; \c off is the interval it falls into
     float SampleContinuous(float u, float* pdf, int* off) const;
+    /// Probability of sampling the interval \c index
     float DiscretePdf(int index) const;
     int Count() const;
     std::vector<float> cdf, func;
     float funcInt;
+    /// First interval whose CDF reaches i / Count() (see SampleContinuous)
+    std::vector<int> guide;
 
 
 };
 
+/// Piecewise constant 2D distribution over [0, 1)^2: a marginal in v and conditionals in u
 struct Distribution2D{
 public:
+    /// \c func holds \c nv rows of \c nu values each
     Distribution2D(const float* func, int nu, int nv);
     Point2f SampleContinuous2(const Point2f& u, float* pdf) const;
+    /// Density of \ref SampleContinuous2() at the point \c p
     float DiscretePdf2(const Point2f& p) const;
 
 private:
@@ -32,4 +47,37 @@ private:
     std::unique_ptr<Distribution1D> pMarginal;
 };
 
+/**
+ * \brief Discrete distribution sampled in O(1) with Walker's alias method
+ *
+ * Every one of the \c n bins holds the probability \c q of keeping a
+ * sample that landed in it and the index of its alias, which takes the
+ * sample otherwise (Vose's construction). Sampling picks a bin uniformly
+ * and flips one biased coin, regardless of the shape of the distribution.
+ */
+struct AliasTable{
+public:
+    AliasTable() {}
+    AliasTable(const float* weights, int n);
+    /// Sample an index: \c u chooses the bin and \c v decides between the bin and its alias
+    int Sample(float u, float v, float* pmf = nullptr) const;
+    /**
+     * \brief Sample an index with a single number
+     *
+     * The fraction of \c u inside of its bin decides between the bin and
+     * its alias, and what is left of it is rescaled to [0, 1) and returned
+     * in \c uRemapped, so it can be used as a further (coarser) sample.
+     */
+    int Sample(float u, float* pmf, float* uRemapped) const;
+    /// Probability of sampling \c index
+    float PMF(int index) const;
+    int Count() const;
+
+    struct Bin {
+        float q, p;
+        int alias;
+    };
+    std::vector<Bin> bins;
+};
+
 NORI_NAMESPACE_END
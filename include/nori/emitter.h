@@ -33,6 +33,7 @@ enum class EmitterType
 	EMITTER_DISTANT_DISK,
 	EMITTER_AREA,
 	EMITTER_ENVIRONMENT,
+	EMITTER_VOLUME,
 	EMITTER_UNKNOWN
 };
 
@@ -127,6 +128,36 @@ public:
      */
     virtual Color3f eval(const EmitterQueryRecord &lRec) const = 0;
 
+    /**
+     * \brief Sample a photon leaving the emitter
+     *
+     * Used by light tracing integrators (e.g. photon mapping). Samples a
+     * position on the emitter and an outgoing direction.
+     *
+     * \param lRec            Receives the sampled position, normal and
+     *                        texture coordinates
+     * \param ray             The photon ray (origin on the emitter)
+     * \param positionSample  A uniformly distributed sample on \f$[0,1]^2\f$
+     * \param directionSample A uniformly distributed sample on \f$[0,1]^2\f$
+     *
+     * \return The power carried by the photon, i.e. the emitted radiance
+     *         times the cosine divided by the density of the position and
+     *         the direction. A zero value means that the emitter can't emit
+     *         photons (the default).
+     */
+    virtual Color3f samplePhoton(EmitterQueryRecord &lRec, Ray3f &ray,
+        const Point2f &positionSample, const Point2f &directionSample) const { return Color3f(0.f); }
+
+    /**
+     * \brief Densities of \ref samplePhoton() for a photon that leaves
+     * \c lRec.p (with normal \c lRec.n) in direction \c d
+     *
+     * \param pdfPosition   Area density of the position (1 for point lights)
+     * \param pdfDirection  Solid angle density of the direction
+     */
+    virtual void pdfPhoton(const EmitterQueryRecord &lRec, const Vector3f &d,
+        float &pdfPosition, float &pdfDirection) const { pdfPosition = pdfDirection = 0.f; }
+
     /**
      * \brief Virtual destructor
      * */
@@ -145,7 +176,14 @@ public:
 
 	EmitterType getEmitterType() const { return m_type; }
 
-	bool isDelta() const { return m_type == EmitterType::EMITTER_POINT; }
+	/**
+	 * \brief Can't the emitter be reached by BSDF or phase function sampling?
+	 *
+	 * True for point lights, and for the emission of media, which
+	 * integrators only gather with emitter sampling (see
+	 * Medium::evalEmission()). Their samples get no MIS weight.
+	 */
+	bool isDelta() const { return m_type == EmitterType::EMITTER_POINT || m_type == EmitterType::EMITTER_VOLUME; }
 
 protected:
     /// Pointer to the mesh if the emitter is attached to a mesh
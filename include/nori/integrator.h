@@ -53,11 +53,55 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Render all pixel samples of an image block
+     *
+     * The default implementation generates one camera ray after the other
+     * and evaluates \ref Li() for it. Integrators that process many paths
+     * at once (e.g. wavefront path tracing) override this function.
+     *
+     * \param scene
+     *    A pointer to the underlying scene
+     * \param sampler
+     *    A pointer to a sample generator
+     * \param block
+     *    The image block to be rendered (cleared beforehand)
+     * \param sampleCount
+     *    Number of samples per pixel
+     * \param stride
+     *    Only render every stride-th pixel along each axis (used by quick
+     *    cost estimates, 1 = all pixels)
+     */
+    virtual void renderBlock(const Scene *scene, Sampler *sampler,
+        ImageBlock &block, uint32_t sampleCount, int stride) const;
+
+    /**
+     * \brief Set the images that \ref splat() adds to
+     *
+     * Called by the renderer before every pass. \c secondary (if any)
+     * receives a copy of the contributions, e.g. for noise estimates.
+     */
+    void setSplatTargets(ImageBlock *image, ImageBlock *secondary = nullptr) {
+        m_splatImage = image;
+        m_splatSecondary = secondary;
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
      * */
     EClassType getClassType() const { return EIntegrator; }
+protected:
+    /**
+     * \brief Add a contribution to an arbitrary pixel of the output
+     *
+     * For estimators that don't start at the pixel (e.g. light tracing).
+     * Thread-safe; does nothing outside of the main rendering passes.
+     */
+    void splat(const Point2f &pos, const Color3f &value) const;
+
+    ImageBlock *m_splatImage = nullptr;
+    ImageBlock *m_splatSecondary = nullptr;
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,92 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/color.h>
+#include <tbb/spin_rw_mutex.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief World space irradiance cache (Ward et al. 1988)
+ *
+ * Stores sparse irradiance records with rotational and translational
+ * gradients (Ward and Heckbert 1992) in a loose octree and interpolates
+ * between them. A record is valid within \c errorThreshold times its
+ * radius; \ref lookup() fails where no record is valid, and the caller
+ * is expected to compute and \ref insert() a new one.
+ *
+ * Lookups and insertions may be issued concurrently from any number of
+ * threads, so the cache can be filled lazily while rendering.
+ */
+class IrradianceCache {
+public:
+    /// An irradiance sample
+    struct Record {
+        Point3f p;
+        Normal3f n;
+        Color3f E;
+        /// Harmonic mean distance to the surfaces seen from \c p
+        float R;
+        /// Gradients of the three color channels w.r.t. rotation and translation
+        Vector3f rotGrad[3];
+        Vector3f transGrad[3];
+    };
+
+    IrradianceCache();
+
+    /// Remove all records and cover the region \c bounds
+    void clear(const BoundingBox3f &bounds, float errorThreshold);
+
+    /// Interpolate the irradiance at \c p; returns \c false if no record is valid there
+    bool lookup(const Point3f &p, const Normal3f &n, Color3f &E) const;
+
+    /// Add a record
+    void insert(const Record &record);
+
+    /// Return the number of records
+    size_t size() const;
+
+    /// Return the error threshold
+    float getErrorThreshold() const { return m_errorThreshold; }
+
+private:
+    /**
+     * Octree nodes are cubes. A record is stored in the deepest node that
+     * contains its position and whose half size is at least its radius of
+     * validity, so it never reaches beyond the node enlarged by half its
+     * size on every side.
+     */
+    struct Node {
+        /// Index of the first of 8 consecutive children (0 = leaf)
+        uint32_t children = 0;
+        std::vector<uint32_t> records;
+    };
+
+    std::vector<Record> m_records;
+    std::vector<Node> m_nodes;
+    Point3f m_center;
+    float m_halfSize;
+    float m_errorThreshold;
+    mutable tbb::spin_rw_mutex m_mutex;
+};
+
+NORI_NAMESPACE_END
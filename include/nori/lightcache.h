@@ -0,0 +1,71 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/color.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Precomputed transmittance towards every emitter inside a medium
+ *
+ * A coarse grid over the bounds of the scene's media stores, for every
+ * emitter, the transmittance (including visibility) towards it, averaged
+ * over a few points on the emitter. Integrators can look it up instead of
+ * tracing a shadow ray and evaluating the medium for every scattering
+ * vertex. This is an approximation (shadows from area lights and thin
+ * occluders are blurred), meant for previews.
+ */
+class VolumeLightCache {
+public:
+    /**
+     * \brief Bake the cache (in parallel)
+     *
+     * \param resolution
+     *     Number of grid vertices along the longest side of the media bounds
+     * \param samplesPerLight
+     *     Points sampled on every emitter per grid vertex
+     */
+    void build(const Scene *scene, int resolution, int samplesPerLight);
+
+    /// Has the cache been built (i.e. does the scene have media)?
+    bool isBuilt() const { return !m_data.empty(); }
+
+    /**
+     * \brief Trilinearly interpolated transmittance from \c p towards \c emitter
+     *
+     * Returns \c false if \c p lies outside of the grid or the emitter is
+     * not cached (e.g. environment emitters); the caller then evaluates the
+     * transmittance exactly.
+     */
+    bool lookup(const Point3f &p, const Emitter *emitter, Color3f &T) const;
+
+private:
+    BoundingBox3f m_bounds;
+    Vector3i m_res;
+    Vector3f m_cellSize;
+    /// Cached emitters (in the order of the grids in m_data)
+    std::vector<const Emitter *> m_lights;
+    /// One grid per emitter, x varies fastest
+    std::vector<Color3f> m_data;
+};
+
+NORI_NAMESPACE_END
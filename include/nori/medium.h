@@ -7,6 +7,7 @@
 #include <nori/frame.h>
 #include <nori/bbox.h>
 #include <nori/dpdf.h>
+#include <nori/color.h>
 
 #ifndef n_UINT
 #define n_UINT uint32_t
@@ -35,6 +36,7 @@ struct MediumIntersection {
     /// Position for the point in the middle of the Medium (for inscattering)
     Point3f xt;
     // Probability. If distT<distZ it's the pdf of a point xt sampled, if not it's 1-cdf(xz)
+    // (for chromatic media, the average over the color channels, see Medium::sampleBetween)
     float prob;
     // Distance from x to xt:
     float distT;
@@ -44,7 +46,7 @@ struct MediumIntersection {
     /// Local Frame
     Frame shFrame;
 
-    /// Pointer to the associated mesh
+    /// Medium that the ray passes through between x and xz
     const Medium* medium;
 
     /// Create an uninitialized intersection record
@@ -88,8 +90,36 @@ public:
 
     const PhaseFunction *getPhaseFunction() const{ return m_pf; }
 
+    /**
+     * \brief Sample a free-flight distance along the segment from medIts.x to medIts.xz
+     *
+     * Chromatic media sample the distance with the extinction of one
+     * color channel that is chosen uniformly at random (hero channel). The
+     * reported density is the average of the densities of all channels,
+     * i.e. the single-sample balance heuristic over the channels (spectral
+     * MIS, Wilkie et al. 2014), so Transmittance() / prob is a color
+     * weight that stays bounded for all channels.
+     */
     virtual void sampleBetween(float rnd, MediumIntersection &medIts) const;
 
+    /// Density of \ref sampleBetween() scattering at distance \c t from medIts.x (t < medIts.distZ)
+    virtual float pdfBetween(const MediumIntersection &medIts, float t) const;
+
+    /**
+     * \brief Equiangular sampling of a scattering point (Kulla and Fajardo 2012)
+     *
+     * Samples a distance on the segment from medIts.x to medIts.xz with a
+     * density proportional to the inverse squared distance to \c center
+     * (e.g. a point on an emitter), which is far better than transmittance
+     * sampling for light sources inside of the medium. Sets xt, distT,
+     * distZ and prob like \ref sampleBetween(), but always samples a
+     * point inside the segment. The frame is left unchanged.
+     */
+    static void sampleEquiangular(float rnd, const Point3f &center, MediumIntersection &medIts);
+
+    /// Density of \ref sampleEquiangular() sampling the distance \c t
+    static float pdfEquiangular(const Point3f &center, const MediumIntersection &medIts, float t);
+
     /// Register a child object (e.g. a BSDF) with the mesh
     virtual void addChild(NoriObject *child, const std::string& name = "none");
 
@@ -100,10 +130,70 @@ public:
     std::string toString() const;
 
     /// For homogeneus and heterogeneus media to define correctly
-    virtual float Transmittance(Point3f x, Point3f xz) const { return 0.0f; }
+    virtual Color3f Transmittance(Point3f x, Point3f xz) const { return Color3f(0.0f); }
+
+    /**
+     * \brief Transmittance between two points inside of the medium for shadow rays
+     *
+     * Media without a closed form (e.g. grids) return an unbiased
+     * stochastic estimate drawn with \c sampler, and have to fall back
+     * to a deterministic one if it is \c nullptr. Defaults to the
+     * analytic \ref Transmittance().
+     */
+    virtual Color3f evalTransmittance(const Point3f& x, const Point3f& xz, Sampler* sampler) const {
+        return Transmittance(x, xz);
+    }
+
+    /// Scattering coefficient at the point \c p inside of the medium
+    virtual Color3f getScatteringCoeficient(const Point3f& p) const { return Color3f(0.0f); }
+
+    /**
+     * \brief Number of scattering events after which random walks in this
+     * medium may be ended (0 if they must be simulated exactly)
+     *
+     * At the last event, integrators add the direct light scattered there
+     * times \ref getMultipleScatteringGain() as an estimate of all the
+     * higher orders that are not traced.
+     */
+    int getApproximationDepth() const { return m_approximateAfter; }
+
+    /// Ratio between the light of all the untraced scattering orders and the direct light of the last event
+    virtual Color3f getMultipleScatteringGain() const { return Color3f(0.0f); }
+
+    /// Does the medium emit light (see \ref getEmission())?
+    virtual bool isEmissive() const { return false; }
+
+    /// Radiance emitted per unit length at the point \c p
+    virtual Color3f getEmission(const Point3f& p) const { return Color3f(0.0f); }
+
+    /**
+     * \brief Emission along the segment from \c x to \c xz, as seen from \c x
+     *
+     * The integral of \ref getEmission() times the transmittance back to
+     * \c x. Integrators add it for rays that next event estimation didn't
+     * account for (camera rays and discrete bounces); otherwise sampling
+     * the emitter of the medium takes care of it.
+     */
+    virtual Color3f evalEmission(const Point3f& x, const Point3f& xz) const { return Color3f(0.0f); }
+
+    /**
+     * \brief Sample a point \c p inside of the medium proportionally to the emitted power
+     *
+     * \return The density of \c p per unit volume (zero if sampling failed)
+     */
+    virtual float sampleEmission(const Point2f& sample, Point3f& p) const { return 0.f; }
+
+    /// Density of \ref sampleEmission() choosing \c p
+    virtual float pdfEmission(const Point3f& p) const { return 0.f; }
+
+    /// Is the medium a light source (i.e. does it have an emitter)?
+    bool isEmitter() const { return m_emitter != nullptr; }
+
+    /// Return a pointer to the emitter of the medium
+    Emitter* getEmitter() { return m_emitter; }
 
-    // Check that this isn't a problem:
-    virtual float getScatteringCoeficient() const { return 0.0f; }
+    /// Return a pointer to the emitter of the medium (const version)
+    const Emitter* getEmitter() const { return m_emitter; }
 
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
@@ -120,6 +210,8 @@ protected:
     BoundingBox3f m_bbox;                ///< Bounding box of the mesh
     PhaseFunction* m_pf = nullptr;
     Mesh* m_mesh = nullptr;
+    Emitter* m_emitter = nullptr;        ///< Samples the emission (see sampleEmission())
+    int m_approximateAfter = 0;          ///< See getApproximationDepth()
 };
 
 
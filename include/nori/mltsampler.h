@@ -0,0 +1,122 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/sampler.h>
+#include <pcg32.h>
+#include <vector>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Markov chain sample generator for primary sample space Metropolis
+ *
+ * Instead of independent points, this sampler produces a sequence of
+ * correlated points of the random number hypercube (Kelemen et al. 2002).
+ * Every iteration of the chain either replaces all components by fresh
+ * uniform numbers (large step) or perturbs them by a small Gaussian offset
+ * (small step). Components are created and mutated lazily as the
+ * integrator requests them, so that paths of any length are supported.
+ *
+ * The rendering algorithm calls \ref startIteration() before evaluating a
+ * proposal and \ref accept() or \ref reject() afterwards; the latter
+ * restores the previous state of all components touched by the proposal.
+ *
+ * This class is not registered with the object factory; it is created
+ * internally by the <tt>pssmlt</tt> integrator.
+ */
+class MLTSampler : public Sampler {
+public:
+    /**
+     * \param seed
+     *    Index of the random number stream used by this chain
+     * \param sigma
+     *    Standard deviation of the small step mutations
+     * \param largeStepProbability
+     *    Probability of a large step
+     */
+    MLTSampler(uint64_t seed, float sigma, float largeStepProbability);
+
+    std::unique_ptr<Sampler> clone() const;
+
+    /* A chain isn't tied to image blocks or pixels */
+    void prepare(const ImageBlock &) { }
+    void generate() { }
+    void advance() { }
+
+    float next1D();
+    Point2f next2D();
+
+    /// Begin a new proposal (large or small step)
+    void startIteration();
+
+    /// Make the current proposal the new state of the chain
+    void accept();
+
+    /// Discard the current proposal and restore the previous state
+    void reject();
+
+    /**
+     * \brief Switch to another random number stream
+     *
+     * Used after a chain was started by replaying the stream of a
+     * bootstrap sample, so that two chains starting from the same sample
+     * don't produce identical mutations.
+     */
+    void seed(uint64_t seed);
+
+    /// Is the current proposal a large step?
+    bool isLargeStep() const { return m_largeStep; }
+
+    std::string toString() const;
+private:
+    struct PrimarySample {
+        float value = 0.f;
+        /// Iteration that last changed \c value
+        int64_t lastModificationIteration = 0;
+        /// State before the current proposal
+        float valueBackup = 0.f;
+        int64_t modifyBackup = 0;
+
+        void backup() {
+            valueBackup = value;
+            modifyBackup = lastModificationIteration;
+        }
+
+        void restore() {
+            value = valueBackup;
+            lastModificationIteration = modifyBackup;
+        }
+    };
+
+    /// Bring a component up to date with the current iteration
+    void ensureReady(size_t index);
+
+    pcg32 m_random;
+    float m_sigma;
+    float m_largeStepProbability;
+    std::vector<PrimarySample> m_X;
+    int64_t m_currentIteration = 0;
+    int64_t m_lastLargeStepIteration = 0;
+    bool m_largeStep = true;
+    size_t m_sampleIndex = 0;
+};
+
+NORI_NAMESPACE_END
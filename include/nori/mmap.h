@@ -0,0 +1,77 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Read-only memory mapping of a file
+ *
+ * Opening is O(1): nothing is read until the data is touched, and the
+ * operating system then pages in only the parts that are accessed. The
+ * access hint tells it whether to read ahead of the accessed pages.
+ */
+class MemoryMappedFile {
+public:
+    enum EAccessHint {
+        /// Default read-ahead of the operating system
+        ENormal = 0,
+        /// Aggressive read-ahead (e.g. for a single pass over the file)
+        ESequential,
+        /// No read-ahead, only the touched pages are loaded (e.g. volume lookups along rays)
+        ERandom
+    };
+
+    /// Map \c filename into memory (throws a \ref NoriException on failure)
+    MemoryMappedFile(const std::string &filename, EAccessHint hint = ERandom);
+
+    /// Unmap the file
+    ~MemoryMappedFile();
+
+    /// Return a pointer to the file contents
+    const uint8_t *getData() const { return (const uint8_t *) m_data; }
+
+    /// Return the size of the file in bytes
+    size_t getSize() const { return m_size; }
+
+    /// Return the name of the mapped file
+    const std::string &getFilename() const { return m_filename; }
+
+    /**
+     * \brief Ask the operating system to page in a byte range in the
+     * background, before it is accessed (no-op where unsupported)
+     */
+    void prefetch(size_t offset, size_t size) const;
+
+private:
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+    std::string m_filename;
+    void *m_data = nullptr;
+    size_t m_size = 0;
+#if defined(PLATFORM_WINDOWS)
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#endif
+};
+
+NORI_NAMESPACE_END
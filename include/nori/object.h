@@ -43,6 +43,7 @@ public:
         ESampler,
         ETest,
         EReconstructionFilter,
+        EVolume,
         EClassTypeCount
     };
 
@@ -101,6 +102,7 @@ public:
             case EIntegrator: return "integrator";
             case ESampler:    return "sampler";
             case ETest:       return "test";
+            case EVolume:     return "volume";
             default:          return "<unknown>";
         }
     }
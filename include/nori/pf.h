@@ -75,6 +75,9 @@ public:
 
     virtual float pdf(const PFQueryRecord &bRec) const = 0;
 
+    /// Mean cosine of the scattering angle (anisotropy parameter g, 0 for isotropic)
+    virtual float getMeanCosine() const { return 0.f; }
+
     /**
      * \brief Return the type of object (i.e. Medium/PhaseFunction/etc.)
      * provided by this instance
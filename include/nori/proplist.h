@@ -71,7 +71,11 @@ public:
     /// Set a color property
     void setColor(const std::string &name, const Color3f &value);
 
-    /// Get a color property, and throw an exception if it does not exist
+    /**
+     * \brief Get a color property, and throw an exception if it does not exist
+     *
+     * A float property is also accepted and turned into a gray color.
+     */
     Color3f getColor(const std::string &name) const;
 
     /// Get a color property, and use a default value if it does not exist
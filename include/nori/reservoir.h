@@ -0,0 +1,155 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Emitter sample that can be evaluated from any shading point
+ *
+ * Stores the random numbers of the sample instead of its result. All
+ * emitters place their samples independently of the reference point, so
+ * the same emitter point (or direction) is reproduced elsewhere, which is
+ * what spatial reuse needs.
+ */
+struct LightCandidate {
+    const Emitter *emitter = nullptr;
+    /// Probability of having chosen \c emitter
+    float pdfSelect = 0.f;
+    Point2f sample;
+};
+
+/// A \ref LightCandidate evaluated at a shading point
+struct LightSample {
+    EmitterQueryRecord lRec;
+    /// Unshadowed contribution (emitted radiance times f*cos)
+    Color3f value;
+    /// Density of emitter sampling (selection times solid angle density)
+    float p_em = 0.f;
+    /// Density of sampling the direction with the BSDF/phase function
+    float p_mat = 0.f;
+    /// Target function of the resampling (luminance of \c value)
+    float target = 0.f;
+};
+
+/**
+ * \brief Evaluate \c candidate at \c p
+ *
+ * \c scatter returns f*cos (or the phase function times the scattering
+ * coefficient) for a world space direction and reports the density of
+ * sampling that direction, i.e. the same functor as for next event
+ * estimation. Returns \c false if the candidate can't contribute.
+ */
+template <typename Scatter>
+bool evalLightCandidate(const LightCandidate &candidate, const Point3f &p,
+        const Scatter &scatter, LightSample &s) {
+    s.lRec = EmitterQueryRecord(p);
+    s.target = 0.f;
+    Color3f Le = candidate.emitter->sample(s.lRec, candidate.sample, 0.f);
+    float pdf_light = candidate.emitter->pdf(s.lRec);
+    if (!(pdf_light > 0) || !(Le.maxCoeff() > 0))
+        return false;
+
+    s.p_em = candidate.pdfSelect * pdf_light;
+    s.value = Le * scatter(s.lRec.wi, s.p_mat);
+    s.target = std::max(0.f, s.value.getLuminance());
+    return s.target > 0;
+}
+
+/**
+ * \brief Weighted reservoir of light samples
+ *
+ * Streams through candidates and keeps one of them with probability
+ * proportional to its resampling weight (resampled importance sampling,
+ * Talbot 2005; reservoirs as in ReSTIR, Bitterli et al. 2020). With the
+ * contribution weight \ref weight(), f(y) * W is an unbiased estimate of
+ * the integral of any f that is zero wherever the target function is.
+ */
+struct Reservoir {
+    LightCandidate candidate;
+    LightSample sample;
+    float weightSum = 0.f;
+    /// Number of candidates seen (possibly through merged reservoirs)
+    float M = 0.f;
+
+    /// Offer a candidate with resampling weight \c w (\c u is uniform on [0, 1))
+    bool update(const LightCandidate &c, const LightSample &s, float w, float u, float count = 1.f) {
+        weightSum += w;
+        M += count;
+        if (!(w > 0) || u * weightSum >= w)
+            return false;
+        candidate = c;
+        sample = s;
+        return true;
+    }
+
+    /// Does the reservoir hold a sample?
+    bool valid() const { return sample.target > 0 && weightSum > 0; }
+
+    /// Contribution weight W of the selected sample
+    float weight() const {
+        return valid() ? weightSum / (M * sample.target) : 0.f;
+    }
+};
+
+/**
+ * \brief Resample one emitter sample at \c p from \c candidates candidates
+ *
+ * The candidates are chosen with \ref Scene::sampleEmitter() and cost no
+ * ray tracing; the caller traces the single shadow ray of the result.
+ */
+template <typename Scatter>
+void sampleLightReservoir(const Scene *scene, Sampler *sampler, const Point3f &p,
+        int candidates, const Scatter &scatter, Reservoir &r) {
+    r = Reservoir();
+    for (int i = 0; i < candidates; ++i) {
+        LightCandidate c;
+        c.emitter = scene->sampleEmitter(sampler->next1D(), c.pdfSelect);
+        c.sample = sampler->next2D();
+        LightSample s;
+        float w = evalLightCandidate(c, p, scatter, s) ? s.target / s.p_em : 0.f;
+        r.update(c, s, w, sampler->next1D());
+    }
+}
+
+/**
+ * \brief Merge the reservoir of another shading point into \c r
+ *
+ * The sample of \c other is re-evaluated at \c p (with \c scatter of
+ * \c p). Its contribution weight refers to the solid angle measure at the
+ * other point; the ratio of the two emitter sampling densities converts
+ * it. Visibility may differ between the points, so the merged result is
+ * biased.
+ */
+template <typename Scatter>
+void mergeReservoir(Reservoir &r, const Reservoir &other, const Point3f &p,
+        const Scatter &scatter, float u) {
+    LightSample s;
+    float w = 0.f;
+    if (other.valid() && evalLightCandidate(other.candidate, p, scatter, s))
+        w = s.target * other.weight() * other.M * (other.sample.p_em / s.p_em);
+    r.update(other.candidate, s, w, u, other.M);
+}
+
+NORI_NAMESPACE_END
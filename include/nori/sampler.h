@@ -77,6 +77,36 @@ public:
      */
     virtual void prepare(const ImageBlock &block) = 0;
 
+    /**
+     * \brief Configure the index of the current rendering pass
+     *
+     * In progressive mode, every image block is rendered once per pass,
+     * i.e. \ref prepare() is called several times for the same block.
+     * Implementations should take the pass index into account so that
+     * different passes produce decorrelated (but still deterministic)
+     * random number streams.
+     */
+    void setPass(uint32_t pass) { m_pass = pass; }
+
+    /// Return the index of the current rendering pass
+    uint32_t getPass() const { return m_pass; }
+
+    /**
+     * \brief Serialize the state of the sampler
+     *
+     * This is used to write checkpoints of progressive renders.
+     * Implementations holding additional state should extend this
+     * function and \ref unserialize() accordingly.
+     */
+    virtual void serialize(std::ostream &os) const {
+        os.write((const char *) &m_pass, sizeof(m_pass));
+    }
+
+    /// Restore the sampler state written by \ref serialize()
+    virtual void unserialize(std::istream &is) {
+        is.read((char *) &m_pass, sizeof(m_pass));
+    }
+
     /**
      * \brief Prepare to generate new samples
      * 
@@ -104,6 +134,7 @@ public:
     EClassType getClassType() const { return ESampler; }
 protected:
     size_t m_sampleCount;
+    uint32_t m_pass = 0;
 };
 
 NORI_NAMESPACE_END
@@ -78,8 +78,15 @@ public:
 		return m_enviromentalEmitter;
 	}
 
-    /// Return a pointer to the scene's integrator
-    const Medium* getMedium() const { return m_medium; }
+    /// Return a reference to an array containing all participating media
+    const std::vector<Medium *> &getMedia() const { return m_media; }
+
+    /// Part of a ray that is inside of a medium (see \ref rayIntersectMedia())
+    struct MediumInterval {
+        const Medium *medium;
+        /// Ray distances where the ray enters and leaves the medium
+        float mint, maxt;
+    };
 
     /**
      * \brief Intersect a ray against all triangles stored in the scene
@@ -99,13 +106,47 @@ public:
         return m_accel->rayIntersect(ray, its, false);
     }
 
-    /*
-    * \brief Return true if there's a medium in the direction of the ray
-    * If there is one add it in the .medium
-    * We also will add the start and end of the medium. If there's no start of the medium the .ox will be the .o, 
-    * and if there's no end, we will have .p as the .xz
-    */
-    bool rayIntersectMedium(const Ray3f& ray, MediumIntersection& medIts) const;
+    /**
+     * \brief Find the parts of a ray that are inside of participating media
+     *
+     * The bounding meshes of all media share one BVH, so a single
+     * traversal finds every interval between \c ray.mint and \c ray.maxt
+     * (clip \c ray.maxt to the closest surface first). The intervals are
+     * ordered by the distance where they start; media without a bounding
+     * mesh fill the whole ray. Overlapping media produce overlapping
+     * intervals, which the integrators don't handle exactly, so scenes
+     * should keep their media apart.
+     *
+     * \return \c true if the ray passes through any medium
+     */
+    bool rayIntersectMedia(const Ray3f& ray, std::vector<MediumInterval>& intervals) const;
+
+    /**
+     * \brief Like the above, but returns one record per interval
+     *
+     * Sets \c o to the origin of the ray, \c p to its end, and \c x and
+     * \c xz to the points where it enters and leaves the medium. Ends at
+     * an infinite distance are stored as \c FLT_MAX.
+     */
+    bool rayIntersectMedia(const Ray3f& ray, std::vector<MediumIntersection>& media) const;
+
+    /**
+     * \brief Fraction of the light that travels from \c p to \c q
+     *
+     * Walks the segment once: returns zero if an opaque surface is in
+     * the way, passes through surfaces with a null BSDF, and accumulates
+     * the transmittance of the media over the parts of the segment that
+     * are inside of media. Use this instead of a shadow ray followed by
+     * \ref rayIntersectMedia().
+     *
+     * \param sampler
+     *    Random numbers for media with a stochastic transmittance
+     *    estimate (may be \c nullptr, see Medium::evalTransmittance())
+     */
+    Color3f transmittance(const Point3f& p, const Point3f& q, Sampler* sampler) const;
+
+    /// Like the above, between \c ray.mint and \c ray.maxt (which may be infinite)
+    Color3f transmittance(const Ray3f& ray, Sampler* sampler) const;
 
 
 
@@ -158,8 +199,10 @@ private:
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
     Accel *m_accel = nullptr;
-    Accel* m_accel_medium = nullptr;
-    Medium *m_medium = nullptr;
+    Accel* m_accel_medium = nullptr;       ///< Bounding meshes of m_boundedMedia (same order)
+    std::vector<Medium *> m_media;
+    std::vector<const Medium *> m_boundedMedia;
+    std::vector<const Medium *> m_unboundedMedia;
 };
 
 NORI_NAMESPACE_END
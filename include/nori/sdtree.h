@@ -0,0 +1,178 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Directional quadtree of an \ref SDTree
+ *
+ * Directions are mapped to the unit square with the area-preserving
+ * cylindrical mapping (cos theta, phi), and the square is subdivided
+ * adaptively. Every node stores the flux that was recorded in each of its
+ * four quadrants. Quadrants are addressed by a "slot" (node * 4 + quadrant)
+ * so that flux can be recorded into flat, thread-local buffers.
+ */
+class DTree {
+public:
+    /// Create a tree with a single node (i.e. four uniform quadrants)
+    DTree();
+
+    /// Map a world space direction to the unit square
+    static Point2f dirToCanonical(const Vector3f &d);
+
+    /// Map a point on the unit square to a world space direction
+    static Vector3f canonicalToDir(const Point2f &p);
+
+    /// Return the total recorded flux
+    float getFlux() const { return m_nodes[0].sum[0] + m_nodes[0].sum[1] + m_nodes[0].sum[2] + m_nodes[0].sum[3]; }
+
+    /// Return the number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the number of quadrant slots
+    size_t getSlotCount() const { return m_nodes.size() * 4; }
+
+    /// Sample a direction proportionally to the recorded flux
+    Vector3f sample(Point2f sample) const;
+
+    /// Solid angle density of \ref sample()
+    float pdf(const Vector3f &d) const;
+
+    /// Return the slot of the leaf quadrant that contains the direction \c d
+    uint32_t getSlot(const Vector3f &d) const;
+
+    /// Add flux to a slot (interior sums are updated by \ref build())
+    void addFlux(uint32_t slot, float flux) { m_nodes[slot / 4].sum[slot % 4] += flux; }
+
+    /// Recompute the flux of all interior quadrants from the leaves
+    void build();
+
+    /**
+     * \brief Create an empty tree for the next training iteration
+     *
+     * Quadrants that received more than \c threshold of the total flux are
+     * subdivided (up to \c maxDepth levels), all other ones become leaves.
+     */
+    DTree refined(float threshold, int maxDepth) const;
+
+private:
+    struct Node {
+        float sum[4];
+        /// Index of the child node of each quadrant (0 = leaf quadrant)
+        uint32_t child[4];
+
+        Node() {
+            for (int i = 0; i < 4; ++i) {
+                sum[i] = 0.f;
+                child[i] = 0;
+            }
+        }
+    };
+
+    void refineNode(const DTree &source, uint32_t sourceNode, const float *flux,
+        float total, float threshold, int depth, int maxDepth, uint32_t node);
+
+    std::vector<Node> m_nodes;
+};
+
+/**
+ * \brief Spatial-directional tree for path guiding
+ *
+ * Implements the data structure of Mueller et al., "Practical Path
+ * Guiding for Efficient Light-Transport Simulation" (2017): a binary tree
+ * over the scene bounding box whose leaves each hold two directional
+ * quadtrees. The sampling tree guides rendering, while the building tree
+ * collects radiance for the next training iteration.
+ *
+ * Radiance is recorded into a \ref Recorder per thread. Recorders are
+ * merged with \ref accumulate() once the rendering threads are done, so
+ * that recording needs no synchronization.
+ */
+class SDTree {
+public:
+    /// Thread-local buffer of recorded flux and sample counts
+    struct Recorder {
+        std::vector<float> flux;
+        std::vector<uint32_t> samples;
+    };
+
+    /// Create a tree that covers \c bbox with a single spatial leaf
+    SDTree(const BoundingBox3f &bbox = BoundingBox3f(Point3f(0.f), Point3f(1.f)));
+
+    /// Return the index of the spatial leaf that contains \c p
+    uint32_t getLeaf(const Point3f &p) const;
+
+    /// Return the number of spatial leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Return the total number of directional nodes (of the sampling trees)
+    size_t getDirectionalNodeCount() const;
+
+    /// Return the sampling distribution of a spatial leaf
+    const DTree &getSamplingTree(uint32_t leaf) const { return m_leaves[leaf].sampling; }
+
+    /// Size and clear a recorder for the current tree structure
+    void resetRecorder(Recorder &recorder) const;
+
+    /// Record incident flux arriving at spatial leaf \c leaf from direction \c d
+    void record(Recorder &recorder, uint32_t leaf, const Vector3f &d, float flux) const;
+
+    /// Merge the contents of a recorder into the building trees
+    void accumulate(const Recorder &recorder);
+
+    /**
+     * \brief Finish a training iteration
+     *
+     * The building trees become the new sampling distributions. Spatial
+     * leaves that received more than \c spatialThreshold samples are split,
+     * and new building trees are refined from the collected flux.
+     */
+    void refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth);
+
+private:
+    struct Leaf {
+        DTree sampling, building;
+        uint32_t samples = 0;
+    };
+
+    struct Node {
+        /// Axis along which the node is (or would be) split
+        int axis = 0;
+        /// Index of the children (0 = this is a leaf)
+        uint32_t child[2] = { 0, 0 };
+        /// Index into m_leaves (leaves only)
+        uint32_t leaf = 0;
+    };
+
+    void split(uint32_t node, uint32_t threshold);
+    void updateOffsets();
+
+    BoundingBox3f m_bbox;
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+    /// First recorder slot of every leaf
+    std::vector<size_t> m_offsets;
+    size_t m_slotCount = 0;
+};
+
+NORI_NAMESPACE_END
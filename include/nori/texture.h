@@ -38,6 +38,17 @@ public:
      */
     virtual Color3f eval(const Point2f& uv) const = 0;
 
+    /**
+     * \brief Evaluate the texture for a span of 2D positions
+     *
+     * Equivalent to calling \ref eval() for every position, but costs a
+     * single virtual call.
+     */
+    virtual void evalBatch(const Point2f* uv, Color3f* result, size_t count) const {
+        for (size_t i = 0; i < count; ++i)
+            result[i] = eval(uv[i]);
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
     * provided by this instance
@@ -58,6 +69,10 @@ public:
 
     Color3f eval(const Point2f& uv) const { return m_color; }
 
+    void evalBatch(const Point2f* uv, Color3f* result, size_t count) const {
+        std::fill(result, result + count, m_color);
+    }
+
     virtual std::string toString() const {
         return tfm::format("%s", m_color.toString());
     }
@@ -65,5 +80,25 @@ private:
     Color3f m_color;
 };
 
+/// Number of records that the batched shading routines gather on the stack
+#define NORI_SHADING_CHUNK 64
+
+/**
+ * \brief Evaluate a texture at the uv coordinates of a span of query records
+ *
+ * The coordinates are gathered in chunks of \ref NORI_SHADING_CHUNK entries,
+ * so that the whole span costs a handful of virtual calls instead of one
+ * per record.
+ */
+template <typename Record>
+void evalTexture(const Texture* texture, const Record* records, Color3f* result, size_t count) {
+    Point2f uv[NORI_SHADING_CHUNK];
+    for (size_t begin = 0; begin < count; begin += NORI_SHADING_CHUNK) {
+        size_t n = std::min(count - begin, (size_t) NORI_SHADING_CHUNK);
+        for (size_t i = 0; i < n; ++i)
+            uv[i] = Point2f(records[begin + i].uv);
+        texture->evalBatch(uv, result + begin, n);
+    }
+}
 
 NORI_NAMESPACE_END
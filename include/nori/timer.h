@@ -24,7 +24,7 @@
 NORI_NAMESPACE_BEGIN
 
 /**
- * \brief Simple timer with millisecond precision
+ * \brief Simple timer that reports (fractional) milliseconds
  *
  * This class is convenient for collecting performance data
  */
@@ -39,8 +39,8 @@ public:
     /// Return the number of milliseconds elapsed since the timer was last reset
     double elapsed() const {
         auto now = std::chrono::system_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
-        return (double) duration.count();
+        std::chrono::duration<double, std::milli> duration = now - start;
+        return duration.count();
     }
 
     /// Like \ref elapsed(), but return a human-readable string
@@ -51,9 +51,9 @@ public:
     /// Return the number of milliseconds elapsed since the timer was last reset and then reset it
     double lap() {
         auto now = std::chrono::system_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
+        std::chrono::duration<double, std::milli> duration = now - start;
         start = now;
-        return (double) duration.count();
+        return duration.count();
     }
 
     /// Like \ref lap(), but return a human-readable string
@@ -1,80 +1,110 @@
-/*
-    CHANGE THIS TOD
-*/
-
-//#pragma once
-//#if !defined(__MITSUBA_RENDER_VOLUME_H_)
-//#define __MITSUBA_RENDER_VOLUME_H_
-
-//#include <mitsuba/core/cobject.h>
-//#include <mitsuba/core/aabb.h>
-
-#include <nori/object.h>
-
-
-//MTS_NAMESPACE_BEGIN
-NORI_NAMESPACE_BEGIN
-
-
-/**
- * \brief Generalized source of volumetric information
- * \ingroup librender
- */
-class VolumeDataSource : public NoriObject {
-public:
-    /// Serialize to a binary data stream.
-    //virtual void serialize(Stream *stream, InstanceManager *manager) const;
-
-    /// Return the bounding box
-    //inline const AABB &getAABB() const {
-    //    return m_aabb;
-    //}
-
-    /// Are float-valued lookups permitted?
-    virtual bool supportsFloatLookups() const;
-
-    /// Look up a floating point value by position
-    virtual float lookupFloat(const Point3f &p) const;
-
-    /// Are spectrum-valued lookups permitted?
-    virtual bool supportsSpectrumLookups() const;
-
-    /// Look up a spectrum value by position
-    //virtual Spectrum lookupSpectrum(const Point &p) const;
-
-    /// Are vector-valued lookups permitted?
-    virtual bool supportsVectorLookups() const;
-
-    /// Look up a vector value by position
-    virtual Vector3f lookupVector(const Point3f &p) const;
-
-    /**
-     * \brief Return the recommended step size for numerical
-     * integration or inifinity if this is not known/applicable
-     */
-    virtual float getStepSize() const = 0;
-
-    /**
-     * \brief Return the maximum floating point value that
-     * could be returned by \ref lookupFloat.
-     *
-     * This is useful when implementing Woodcock-Tracking.
-     */
-    virtual float getMaximumFloatValue() const = 0;
-    //MTS_DECLARE_CLASS()
-protected:
-    /// Virtual destructor
-    virtual ~VolumeDataSource();
-
-    /// Protected constructor
-    VolumeDataSource(const PropertyList &props);
-
-    /// Unserialize from a binary data stream
-    //VolumeDataSource(Stream *stream, InstanceManager *manager);
-//protected:
-    //AABB m_aabb;
-};
-
-//MTS_NAMESPACE_END
-NORI_NAMESPACE_END
-//#endif /* __MITSUBA_RENDER_VOLUME_H_ */
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/object.h>
+#include <nori/bbox.h>
+#include <nori/color.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Values at the corners of the last grid cell a ray looked up
+ *
+ * Lookups at nearby points along a ray mostly fall into the same cell;
+ * passing the same cache to all of them avoids fetching the eight
+ * corners again. A default constructed cache is empty.
+ */
+struct VolumeCellCache {
+    /// Grid cell (lowest corner) the values belong to
+    Vector3i cell = Vector3i(-1, -1, -1);
+    /// Corners of the cell, z-major, then y, then x (x changes fastest)
+    float corner[8];
+};
+
+/**
+ * \brief Generalized source of volumetric information (e.g. the density
+ * of a heterogeneous medium), looked up by world space position
+ */
+class VolumeDataSource : public NoriObject {
+public:
+    /// Return the world space bounding box of the data
+    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    /// Are float-valued lookups permitted?
+    virtual bool supportsFloatLookups() const { return false; }
+
+    /// Look up a floating point value by position (zero outside of the data)
+    virtual float lookupFloat(const Point3f &p) const {
+        throw NoriException("VolumeDataSource: float lookups are not supported!");
+    }
+
+    /// Like \ref lookupFloat(), reusing the corners of \c cache if \c p is in the same cell
+    virtual float lookupFloat(const Point3f &p, VolumeCellCache &cache) const {
+        return lookupFloat(p);
+    }
+
+    /**
+     * \brief Look up \c count float values along a ray, at distances
+     * t0, t0 + dt, ... from \c o in the direction \c d
+     *
+     * Equivalent to calling \ref lookupFloat() for every position, but
+     * costs a single virtual call and lets grids share work between
+     * neighbouring samples (e.g. for ray marching).
+     */
+    virtual void lookupFloatRay(const Point3f &o, const Vector3f &d, float t0, float dt,
+            float *result, int count) const {
+        VolumeCellCache cache;
+        for (int i = 0; i < count; ++i)
+            result[i] = lookupFloat(o + (t0 + i * dt) * d, cache);
+    }
+
+    /// Are color-valued lookups permitted?
+    virtual bool supportsColorLookups() const { return false; }
+
+    /// Look up a color value by position (zero outside of the data)
+    virtual Color3f lookupColor(const Point3f &p) const {
+        throw NoriException("VolumeDataSource: color lookups are not supported!");
+    }
+
+    /**
+     * \brief Return the recommended step size for numerical
+     * integration or infinity if this is not known/applicable
+     */
+    virtual float getStepSize() const = 0;
+
+    /**
+     * \brief Return the maximum floating point value that
+     * could be returned by \ref lookupFloat.
+     *
+     * This is useful when implementing Woodcock or ratio tracking.
+     */
+    virtual float getMaximumFloatValue() const = 0;
+
+    /**
+     * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
+     * provided by this instance
+     * */
+    EClassType getClassType() const { return EVolume; }
+
+protected:
+    BoundingBox3f m_bbox;
+};
+
+NORI_NAMESPACE_END
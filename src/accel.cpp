@@ -551,4 +551,46 @@ bool Accel::rayIntersect(const Ray3f& _ray, Intersection& its, bool shadowRay) c
 	return foundIntersection;
 }
 
+void Accel::rayIntersectAll(const Ray3f& _ray, std::vector<std::pair<float, n_UINT>>& hits) const {
+	n_UINT node_idx = 0, stack_idx = 0, stack[64];
+
+	/* Use an adaptive ray epsilon */
+	Ray3f ray(_ray);
+	if (ray.mint == Epsilon)
+		ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+	if (m_nodes.empty() || ray.maxt < ray.mint)
+		return;
+
+	while (true) {
+		const BVHNode& node = m_nodes[node_idx];
+
+		if (!node.bbox.rayIntersect(ray)) {
+			if (stack_idx == 0)
+				break;
+			node_idx = stack[--stack_idx];
+			continue;
+		}
+
+		if (node.isInner()) {
+			stack[stack_idx++] = node.inner.rightChild;
+			node_idx++;
+			assert(stack_idx < 64);
+		}
+		else {
+			for (n_UINT i = node.start(), end = node.end(); i < end; ++i) {
+				n_UINT idx = m_indices[i];
+				n_UINT meshIdx = findMesh(idx);
+
+				float u, v, t;
+				if (m_meshes[meshIdx]->rayIntersect(idx, ray, u, v, t))
+					hits.push_back(std::make_pair(t, meshIdx));
+			}
+			if (stack_idx == 0)
+				break;
+			node_idx = stack[--stack_idx];
+		}
+	}
+}
+
 NORI_NAMESPACE_END
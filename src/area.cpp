@@ -69,6 +69,28 @@ public:
 		return eval(lRec);
 	}
 
+	// Photons leave the front side of the mesh with a cosine-weighted direction
+	virtual Color3f samplePhoton(EmitterQueryRecord & lRec, Ray3f & ray, const Point2f & positionSample, const Point2f & directionSample) const {
+		if (!m_mesh)
+			throw NoriException("There is no shape attached to this Area light!");
+		lRec.emitter = this;
+		m_mesh->samplePosition(positionSample, lRec.p, lRec.n, lRec.uv);
+		float pdf_pos = m_mesh->pdf(lRec.p);
+		if (!(pdf_pos > 0))
+			return Color3f(0.f);
+
+		ray = Ray3f(lRec.p, Frame(lRec.n).toWorld(Warp::squareToCosineHemisphere(directionSample)));
+		// Le * cos / (pdf_pos * cos / pi)
+		return m_radiance->eval(lRec.uv) * M_PI / pdf_pos;
+	}
+
+	virtual void pdfPhoton(const EmitterQueryRecord & lRec, const Vector3f & d, float & pdfPosition, float & pdfDirection) const {
+		if (!m_mesh)
+			throw NoriException("There is no shape attached to this Area light!");
+		pdfPosition = m_mesh->pdf(lRec.p);
+		pdfDirection = std::max(0.f, lRec.n.dot(d)) * INV_PI;
+	}
+
 	// Returns probability with respect to solid angle given by all the information inside the emitterqueryrecord.
 	// Assumes all information about the intersection point is already provided inside.
 	// WARNING: Use with care. Malformed EmitterQueryRecords can result in undefined behavior. 
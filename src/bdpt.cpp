@@ -0,0 +1,500 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <tbb/enumerable_thread_specific.h>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Bidirectional path tracer (Veach 1997)
+ *
+ * Every camera sample traces a camera subpath and a light subpath (started
+ * with \ref Emitter::samplePhoton()) and connects all pairs of their
+ * vertices. The strategies are combined with the balance heuristic (or the
+ * power heuristic, see below), following the formulation of pbrt-v3.
+ * Connections to the camera (light tracing, t = 1) land on arbitrary pixels
+ * and are splatted into the output with \ref Integrator::splat().
+ *
+ * As in the other path tracers, paths end at emitters. Environment
+ * emitters can't start light subpaths and are only found by camera
+ * subpaths that leave the scene.
+ *
+ * The vertices of both subpaths live in a per-thread arena that is
+ * allocated once, so no memory is allocated per sample.
+ *
+ * Parameters:
+ *  - \c maxDepth: maximum number of bounces (default 16)
+ *  - \c powerHeuristic: use the power heuristic instead of the balance
+ *    heuristic (default false)
+ */
+class BDPTIntegrator : public Integrator
+{
+public:
+    BDPTIntegrator(const PropertyList& props)
+    {
+        m_maxDepth = props.getInteger("maxDepth", 16);
+        m_powerHeuristic = props.getBoolean("powerHeuristic", false);
+        if (m_maxDepth < 1)
+            throw NoriException("BDPTIntegrator: maxDepth must be at least 1!");
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        std::vector<PathVertex>& arena = m_arena.local();
+        if (arena.empty())
+            arena.resize(2 * m_maxDepth + 3);
+        PathVertex* camera = arena.data();
+        PathVertex* light = camera + m_maxDepth + 2;
+
+        Color3f Lo(0.);
+        int cameraVertices = generateCameraSubpath(scene, sampler, ray, camera, Lo);
+        int lightVertices = generateLightSubpath(scene, sampler, light);
+
+        /* Next event estimation (s = 1) doesn't depend on the light subpath */
+        int maxS = std::max(lightVertices, 1);
+        for (int t = 1; t <= cameraVertices; ++t) {
+            for (int s = 0; s <= maxS; ++s) {
+                int depth = s + t - 2;
+                if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+                    continue;
+
+                Point2f pixel;
+                Color3f L = connect(scene, sampler, light, camera, s, t, pixel);
+                if (!(L.maxCoeff() > 0))
+                    continue;
+                if (t == 1)
+                    splat(pixel, L);
+                else
+                    Lo += L;
+            }
+        }
+        return Lo;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "BDPTIntegrator[\n"
+            "  maxDepth = %i,\n"
+            "  powerHeuristic = %s\n"
+            "]",
+            m_maxDepth,
+            m_powerHeuristic ? "true" : "false");
+    }
+
+protected:
+    /// Vertex of a camera or light subpath
+    struct PathVertex {
+        enum EType { ECamera, ELight, ESurface };
+
+        EType type;
+        Point3f p;
+        /// Shading normal (surfaces) or emitter normal (lights)
+        Normal3f n;
+        /// Geometric normal, used to convert densities
+        Normal3f ng;
+        Frame frame;
+        Point2f uv;
+        /// Local direction towards the predecessor on the subpath
+        Vector3f wi;
+        const BSDF* bsdf;
+        /// Emitter of light vertices and of surfaces that belong to an emitter
+        const Emitter* emitter;
+        /// Throughput of the subpath up to this vertex
+        Color3f beta;
+        /// Scattered by a discrete BSDF
+        bool delta;
+        /// Area lights and surfaces (point lights and the camera aren't)
+        bool onSurface;
+        /// Part of a light subpath (the BSDF transports importance)
+        bool adjoint;
+        /// Area density of sampling this vertex from its predecessor and successor
+        float pdfFwd, pdfRev;
+    };
+
+    int generateCameraSubpath(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+        PathVertex* path, Color3f& Lescaped) const
+    {
+        PathVertex& v = path[0];
+        v.type = PathVertex::ECamera;
+        v.p = ray.o;
+        v.emitter = nullptr;
+        v.beta = Color3f(1.f);
+        v.delta = false;
+        v.onSurface = false;
+        v.adjoint = false;
+        v.pdfFwd = 1.f;
+        v.pdfRev = 0.f;
+
+        float pdfDirection = scene->getCamera()->pdfDirection(ray.d);
+        return randomWalk(scene, sampler, ray, v.beta, pdfDirection, m_maxDepth + 1, false, path, &Lescaped) + 1;
+    }
+
+    int generateLightSubpath(const Scene* scene, Sampler* sampler, PathVertex* path) const
+    {
+        float pdfSelect;
+        const Emitter* emitter = scene->sampleEmitter(sampler->next1D(), pdfSelect);
+        Point2f positionSample = sampler->next2D();
+        Point2f directionSample = sampler->next2D();
+        if (!emitter || emitter == scene->getEnvironmentalEmitter() || !(pdfSelect > 0))
+            return 0;
+
+        EmitterQueryRecord lRec;
+        Ray3f ray;
+        Color3f power = emitter->samplePhoton(lRec, ray, positionSample, directionSample);
+        float pdfPosition, pdfDirection;
+        emitter->pdfPhoton(lRec, ray.d, pdfPosition, pdfDirection);
+        if (!(power.maxCoeff() > 0) || !(pdfPosition > 0) || !(pdfDirection > 0))
+            return 0;
+
+        PathVertex& v = path[0];
+        v.type = PathVertex::ELight;
+        v.p = lRec.p;
+        v.n = v.ng = lRec.n;
+        v.emitter = emitter;
+        v.beta = power / pdfSelect;
+        v.delta = false;
+        v.onSurface = !emitter->isDelta();
+        v.adjoint = true;
+        v.pdfFwd = pdfPosition * pdfSelect;
+        v.pdfRev = 0.f;
+
+        return randomWalk(scene, sampler, ray, v.beta, pdfDirection, m_maxDepth, true, path, nullptr) + 1;
+    }
+
+    /**
+     * \brief Extend the subpath that starts with \c path[0]
+     *
+     * \param pdf       Solid angle density of the direction of \c ray
+     * \param Lescaped  Receives the background seen by camera subpaths
+     * \return The number of vertices that were added
+     */
+    int randomWalk(const Scene* scene, Sampler* sampler, Ray3f ray, Color3f beta, float pdf,
+        int maxVertices, bool adjoint, PathVertex* path, Color3f* Lescaped) const
+    {
+        int vertices = 0;
+        float pdfFwd = pdf;
+
+        while (vertices < maxVertices) {
+            PathVertex& prev = path[vertices];
+
+            Intersection its;
+            if (!scene->rayIntersect(ray, its)) {
+                if (Lescaped)
+                    *Lescaped += beta * scene->getBackground(ray);
+                break;
+            }
+
+            const BSDF* bsdf = its.mesh->getBSDF();
+            //Modify the normal shading if the bsdf has a normal map
+            if (bsdf->hasDisplacementMap()) {
+                its.shading.n = its.shFrame.n + bsdf->displacement(its.uv);
+                its.shFrame = Frame(its.shading.n);
+            }
+
+            PathVertex& v = path[vertices + 1];
+            v.type = PathVertex::ESurface;
+            v.p = its.p;
+            v.n = its.shFrame.n;
+            v.ng = its.geoFrame.n;
+            v.frame = its.shFrame;
+            v.uv = its.uv;
+            v.wi = its.toLocal(-ray.d);
+            v.bsdf = bsdf;
+            v.emitter = its.mesh->isEmitter() ? its.mesh->getEmitter() : nullptr;
+            v.beta = beta;
+            v.delta = false;
+            v.onSurface = true;
+            v.adjoint = adjoint;
+            v.pdfFwd = convertDensity(pdfFwd, prev, v);
+            v.pdfRev = 0.f;
+
+            // Paths end at emitters; light subpaths can't use them at all
+            if (v.emitter) {
+                if (!adjoint)
+                    ++vertices;
+                break;
+            }
+            if (++vertices >= maxVertices)
+                break;
+
+            BSDFQueryRecord bRec(v.wi, v.uv);
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+            if (!(weight.maxCoeff() > 0))
+                break;
+            Vector3f wo = v.frame.toWorld(bRec.wo);
+
+            float pdfRev;
+            if (bRec.measure == EDiscrete) {
+                v.delta = true;
+                pdfFwd = pdfRev = 0.f;
+            } else {
+                pdfFwd = bsdf->pdf(bRec);
+                pdfRev = bsdf->pdf(BSDFQueryRecord(bRec.wo, bRec.wi, v.uv, ESolidAngle));
+            }
+            if (adjoint)
+                weight *= correctShadingNormal(v, -ray.d, wo);
+            beta *= weight;
+            prev.pdfRev = convertDensity(pdfRev, v, prev);
+
+            if (vertices >= 3) {
+                float rr_limit = std::min(0.9f, beta.maxCoeff());
+                if (sampler->next1D() >= rr_limit)
+                    break;
+                beta /= rr_limit;
+            }
+            ray = Ray3f(v.p, wo);
+        }
+        return vertices;
+    }
+
+    /**
+     * \brief Contribution of the strategy with \c s light and \c t camera vertices
+     *
+     * \param pixel  Film position of light tracing contributions (t = 1)
+     */
+    Color3f connect(const Scene* scene, Sampler* sampler, PathVertex* light, PathVertex* camera,
+        int s, int t, Point2f& pixel) const
+    {
+        PathVertex sampled;
+        Color3f L(0.f);
+
+        if (s == 0) {
+            // The camera subpath found an emitter
+            const PathVertex& pt = camera[t - 1];
+            if (!pt.emitter)
+                return Color3f(0.f);
+            L = pt.beta * pt.emitter->eval(EmitterQueryRecord(pt.emitter, camera[t - 2].p, pt.p, pt.n, pt.uv));
+        } else if (t == 1) {
+            // Connect the light subpath to the camera
+            const PathVertex& qs = light[s - 1];
+            if (!isConnectible(qs))
+                return Color3f(0.f);
+
+            Vector3f wi;
+            float dist;
+            Color3f Wi = scene->getCamera()->sampleImportance(qs.p, pixel, wi, dist);
+            if (!(Wi.maxCoeff() > 0))
+                return Color3f(0.f);
+
+            sampled.type = PathVertex::ECamera;
+            sampled.p = qs.p + wi * dist;
+            sampled.emitter = nullptr;
+            sampled.beta = Wi;
+            sampled.delta = false;
+            sampled.onSurface = false;
+            sampled.adjoint = false;
+            sampled.pdfFwd = sampled.pdfRev = 0.f;
+
+            L = qs.beta * f(qs, sampled.p) * std::abs(qs.n.dot(wi)) * Wi;
+            if (L.maxCoeff() > 0 && scene->rayIntersect(Ray3f(qs.p, wi, Epsilon, dist * (1 - Epsilon))))
+                return Color3f(0.f);
+        } else if (s == 1) {
+            // Next event estimation
+            const PathVertex& pt = camera[t - 1];
+            if (!isConnectible(pt))
+                return Color3f(0.f);
+
+            float pdfSelect;
+            const Emitter* emitter = scene->sampleEmitter(sampler->next1D(), pdfSelect);
+            EmitterQueryRecord lRec(pt.p);
+            Point2f sample = sampler->next2D();
+            if (!emitter || emitter == scene->getEnvironmentalEmitter())
+                return Color3f(0.f);
+            Color3f Le = emitter->sample(lRec, sample, 0.);
+            float pdf = emitter->pdf(lRec);
+            if (!(pdf > 0) || !(pdfSelect > 0) || !(Le.maxCoeff() > 0))
+                return Color3f(0.f);
+
+            sampled.type = PathVertex::ELight;
+            sampled.p = lRec.p;
+            sampled.n = sampled.ng = lRec.n;
+            sampled.emitter = emitter;
+            sampled.beta = Le / (pdf * pdfSelect);
+            sampled.delta = false;
+            sampled.onSurface = !emitter->isDelta();
+            sampled.adjoint = true;
+            sampled.pdfFwd = pdfLightOrigin(scene, sampled);
+            sampled.pdfRev = 0.f;
+
+            L = pt.beta * f(pt, sampled.p) * std::abs(pt.n.dot(lRec.wi)) * sampled.beta;
+            if (L.maxCoeff() > 0 && scene->rayIntersect(Ray3f(pt.p, lRec.wi, Epsilon, lRec.dist - Epsilon)))
+                return Color3f(0.f);
+        } else {
+            // Connect two inner vertices
+            const PathVertex& qs = light[s - 1];
+            const PathVertex& pt = camera[t - 1];
+            if (!isConnectible(qs) || !isConnectible(pt))
+                return Color3f(0.f);
+
+            Vector3f d = pt.p - qs.p;
+            float dist2 = d.squaredNorm();
+            if (!(dist2 > 0))
+                return Color3f(0.f);
+            float dist = std::sqrt(dist2);
+            d /= dist;
+
+            float G = std::abs(qs.n.dot(d)) * std::abs(pt.n.dot(d)) / dist2;
+            L = qs.beta * f(qs, pt.p) * f(pt, qs.p) * pt.beta * G;
+            if (L.maxCoeff() > 0 && scene->rayIntersect(Ray3f(qs.p, d, Epsilon, dist * (1 - Epsilon))))
+                return Color3f(0.f);
+        }
+
+        if (!(L.maxCoeff() > 0))
+            return Color3f(0.f);
+        return L * misWeight(scene, light, camera, sampled, s, t);
+    }
+
+    /**
+     * \brief MIS weight of the strategy (s, t) for the path it generated
+     *
+     * Computes the densities of all other strategies relative to this one
+     * (pbrt-v3, 16.3.4). The connection vertices are modified temporarily.
+     */
+    float misWeight(const Scene* scene, PathVertex* light, PathVertex* camera,
+        const PathVertex& sampled, int s, int t) const
+    {
+        if (s + t == 2)
+            return 1.f;
+
+        PathVertex* qs = s > 0 ? &light[s - 1] : nullptr;
+        PathVertex* pt = t > 0 ? &camera[t - 1] : nullptr;
+        PathVertex* qsMinus = s > 1 ? &light[s - 2] : nullptr;
+        PathVertex* ptMinus = t > 1 ? &camera[t - 2] : nullptr;
+
+        PathVertex* modified[4] = { qs, pt, qsMinus, ptMinus };
+        PathVertex saved[4];
+        for (int i = 0; i < 4; ++i)
+            if (modified[i])
+                saved[i] = *modified[i];
+
+        if (s == 1)
+            *qs = sampled;
+        else if (t == 1)
+            *pt = sampled;
+
+        if (pt)
+            pt->delta = false;
+        if (qs)
+            qs->delta = false;
+        if (pt)
+            pt->pdfRev = s > 0 ? pdf(scene, qsMinus, *qs, *pt) : pdfLightOrigin(scene, *pt);
+        if (ptMinus)
+            ptMinus->pdfRev = s > 0 ? pdf(scene, qs, *pt, *ptMinus) : pdfLight(*pt, *ptMinus);
+        if (qs)
+            qs->pdfRev = pdf(scene, ptMinus, *pt, *qs);
+        if (qsMinus)
+            qsMinus->pdfRev = pdf(scene, pt, *qs, *qsMinus);
+
+        // Delta vertices have zero densities, which cancel in the ratios
+        auto remap0 = [](float f) { return f != 0 ? f : 1.f; };
+
+        float sumRi = 0.f, ri = 1.f;
+        for (int i = t - 1; i > 0; --i) {
+            ri *= remap0(camera[i].pdfRev) / remap0(camera[i].pdfFwd);
+            if (!camera[i].delta && !camera[i - 1].delta)
+                sumRi += m_powerHeuristic ? ri * ri : ri;
+        }
+
+        ri = 1.f;
+        for (int i = s - 1; i >= 0; --i) {
+            ri *= remap0(light[i].pdfRev) / remap0(light[i].pdfFwd);
+            bool deltaLight = i > 0 ? light[i - 1].delta : light[0].emitter->isDelta();
+            if (!light[i].delta && !deltaLight)
+                sumRi += m_powerHeuristic ? ri * ri : ri;
+        }
+
+        for (int i = 0; i < 4; ++i)
+            if (modified[i])
+                *modified[i] = saved[i];
+
+        return 1.f / (1.f + sumRi);
+    }
+
+    /// Camera and light vertices, and surfaces that can scatter
+    static bool isConnectible(const PathVertex& v)
+    {
+        return v.type != PathVertex::ESurface || (!v.delta && !v.emitter);
+    }
+
+    /// BSDF (without cosine) for scattering from the predecessor of \c v towards \c p
+    static Color3f f(const PathVertex& v, const Point3f& p)
+    {
+        Vector3f wo = (p - v.p).normalized();
+        BSDFQueryRecord bRec(v.wi, v.frame.toLocal(wo), v.uv, ESolidAngle);
+        Color3f value = v.bsdf->eval(bRec);
+        if (v.adjoint)
+            value *= correctShadingNormal(v, v.frame.toWorld(v.wi), wo);
+        return value;
+    }
+
+    /// Keep light transport with shading normals symmetric (Veach 1997, 5.3)
+    static float correctShadingNormal(const PathVertex& v, const Vector3f& wi, const Vector3f& wo)
+    {
+        float denom = std::abs(wi.dot(v.ng)) * std::abs(wo.dot(v.n));
+        if (denom == 0)
+            return 0.f;
+        return std::abs(wi.dot(v.n)) * std::abs(wo.dot(v.ng)) / denom;
+    }
+
+    /// Convert a solid angle density at \c from into an area density at \c to
+    static float convertDensity(float pdf, const PathVertex& from, const PathVertex& to)
+    {
+        Vector3f w = to.p - from.p;
+        float dist2 = w.squaredNorm();
+        if (dist2 == 0)
+            return 0.f;
+        if (to.onSurface)
+            pdf *= std::abs(to.ng.dot(w)) / std::sqrt(dist2);
+        return pdf / dist2;
+    }
+
+    /// Area density at \c next of sampling it from \c v, which was reached from \c prev
+    float pdf(const Scene* scene, const PathVertex* prev, const PathVertex& v, const PathVertex& next) const
+    {
+        if (v.type == PathVertex::ELight)
+            return pdfLight(v, next);
+
+        Vector3f wo = (next.p - v.p).normalized();
+        float pdf;
+        if (v.type == PathVertex::ECamera) {
+            pdf = scene->getCamera()->pdfDirection(wo);
+        } else {
+            Vector3f wi = (prev->p - v.p).normalized();
+            pdf = v.bsdf->pdf(BSDFQueryRecord(v.frame.toLocal(wi), v.frame.toLocal(wo), v.uv, ESolidAngle));
+        }
+        return convertDensity(pdf, v, next);
+    }
+
+    /// Area density at \c to of a light subpath that starts at the emitter point \c v
+    static float pdfLight(const PathVertex& v, const PathVertex& to)
+    {
+        EmitterQueryRecord lRec;
+        lRec.p = v.p;
+        lRec.n = v.n;
+        float pdfPosition, pdfDirection;
+        v.emitter->pdfPhoton(lRec, (to.p - v.p).normalized(), pdfPosition, pdfDirection);
+        return convertDensity(pdfDirection, v, to);
+    }
+
+    /// Area density of starting a light subpath at the emitter point \c v
+    static float pdfLightOrigin(const Scene* scene, const PathVertex& v)
+    {
+        EmitterQueryRecord lRec;
+        lRec.p = v.p;
+        lRec.n = v.n;
+        float pdfPosition, pdfDirection;
+        v.emitter->pdfPhoton(lRec, Vector3f(v.n), pdfPosition, pdfDirection);
+        return pdfPosition * scene->pdfEmitter(v.emitter);
+    }
+
+    int m_maxDepth;
+    bool m_powerHeuristic;
+    mutable tbb::enumerable_thread_specific<std::vector<PathVertex>> m_arena;
+};
+
+NORI_REGISTER_CLASS(BDPTIntegrator, "bdpt");
+NORI_NAMESPACE_END
@@ -37,6 +37,13 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
         }
         m_filter[NORI_FILTER_RESOLUTION] = 0.0f;
         m_lookupFactor = NORI_FILTER_RESOLUTION / m_filterRadius;
+
+        /* Expected filter weight that one sample adds to the image */
+        float integral = 0.0f;
+        for (int i=0; i<NORI_FILTER_RESOLUTION; ++i)
+            integral += m_filter[i];
+        integral *= 2.0f * m_filterRadius / NORI_FILTER_RESOLUTION;
+        m_splatScale = integral * integral;
         int weightSize = (int) std::ceil(2*m_filterRadius) + 1;
         m_weightsX = new float[weightSize];
         m_weightsY = new float[weightSize];
@@ -46,6 +53,8 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2*m_borderSize, size.x() + 2*m_borderSize);
+
+    setLockBandHeight(NORI_LOCK_BAND_HEIGHT);
 }
 
 ImageBlock::~ImageBlock() {
@@ -102,15 +111,54 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
             coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
 }
     
+void ImageBlock::splat(const Point2f &pos, const Color3f &value) {
+    if (!value.isValid()) {
+        cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
+        return;
+    }
+
+    int x = (int) std::floor(pos.x()) - m_offset.x() + m_borderSize;
+    int y = (int) std::floor(pos.y()) - m_offset.y() + m_borderSize;
+    if (x < 0 || y < 0 || x >= cols() || y >= rows())
+        return;
+
+    Color3f scaled = value * m_splatScale;
+    tbb::spin_mutex::scoped_lock lock(m_bands[y / m_bandHeight].mutex);
+    coeffRef(y, x) += Color4f(scaled.r(), scaled.g(), scaled.b(), 0.0f);
+}
+
 void ImageBlock::put(ImageBlock &b) {
     Vector2i offset = b.getOffset() - m_offset +
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
+    /* Merge one band of rows at a time */
+    int lastRow = offset.y() + size.y();
+    for (int band = offset.y() / m_bandHeight; band * m_bandHeight < lastRow; ++band) {
+        int start = std::max(offset.y(), band * m_bandHeight);
+        int end = std::min(lastRow, (band + 1) * m_bandHeight);
+
+        tbb::spin_mutex::scoped_lock lock(m_bands[band].mutex);
+
+        block(start, offset.x(), end - start, size.x())
+            += b.block(start - offset.y(), 0, end - start, size.x());
+    }
+}
+
+void ImageBlock::setLockBandHeight(int rows) {
+    m_bandHeight = std::max(1, std::min(rows, (int) this->rows()));
+    m_bandCount = ((int) this->rows() + m_bandHeight - 1) / m_bandHeight;
+    m_bands.reset(new BandLock[std::max(m_bandCount, 1)]);
+}
 
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+void ImageBlock::lock() const {
+    for (int band = 0; band < m_bandCount; ++band)
+        m_bands[band].mutex.lock();
+}
+
+void ImageBlock::unlock() const {
+    for (int band = m_bandCount - 1; band >= 0; --band)
+        m_bands[band].mutex.unlock();
 }
 
 std::string ImageBlock::toString() const {
@@ -118,49 +166,124 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, EOrder order)
+        : m_size(size), m_blockSize(blockSize), m_next(0) {
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    m_order.reserve(m_numBlocks.x() * m_numBlocks.y());
+
+    if (order == ESpiral)
+        generateSpiral();
+    else
+        generateCurve(order);
 }
 
-bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
+void BlockGenerator::generateSpiral() {
+    enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
-    if (m_blocksLeft == 0)
-        return false;
+    int blockCount = m_numBlocks.x() * m_numBlocks.y();
+    Point2i block(m_numBlocks / 2);
+    int direction = ERight, numSteps = 1, stepsLeft = 1;
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+    while (true) {
+        m_order.push_back(block.y() * m_numBlocks.x() + block.x());
+        if ((int) m_order.size() == blockCount)
+            break;
 
-    if (--m_blocksLeft == 0)
-        return true;
+        /* Walk along the spiral until the next block inside the image */
+        do {
+            switch (direction) {
+                case ERight: ++block.x(); break;
+                case EDown:  ++block.y(); break;
+                case ELeft:  --block.x(); break;
+                case EUp:    --block.y(); break;
+            }
 
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
-        }
+            if (--stepsLeft == 0) {
+                direction = (direction + 1) % 4;
+                if (direction == ELeft || direction == ERight) 
+                    ++numSteps;
+                stepsLeft = numSteps;
+            }
+        } while ((block.array() < 0).any() ||
+                 (block.array() >= m_numBlocks.array()).any());
+    }
+}
+
+void BlockGenerator::generateCurve(EOrder order) {
+    /* Both curves cover a square with a power-of-two resolution */
+    int n = 1;
+    while (n < m_numBlocks.maxCoeff())
+        n *= 2;
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
+    for (int d = 0; d < n * n; ++d) {
+        int x = 0, y = 0;
+        if (order == EMorton) {
+            /* De-interleave the bits of the curve position */
+            for (int bit = 0; (1 << bit) < n; ++bit) {
+                x |= ((d >> (2 * bit)) & 1) << bit;
+                y |= ((d >> (2 * bit + 1)) & 1) << bit;
+            }
+        } else {
+            /* Convert the Hilbert curve position into coordinates */
+            for (int s = 1, t = d; s < n; s *= 2, t /= 4) {
+                int rx = 1 & (t / 2), ry = 1 & (t ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = s - 1 - x;
+                        y = s - 1 - y;
+                    }
+                    std::swap(x, y);
+                }
+                x += s * rx;
+                y += s * ry;
+            }
         }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+
+        if (x < m_numBlocks.x() && y < m_numBlocks.y())
+            m_order.push_back(y * m_numBlocks.x() + x);
+    }
+}
+
+bool BlockGenerator::next(ImageBlock &block, int &index) {
+    int pos = m_next.fetch_add(1);
+    if (pos >= (int) m_order.size())
+        return false;
+
+    index = m_order[pos];
+
+    Point2i offset;
+    Vector2i size;
+    getBlock(index, offset, size);
+    block.setOffset(offset);
+    block.setSize(size);
 
     return true;
 }
 
+void BlockGenerator::getBlock(int index, Point2i &offset, Vector2i &size) const {
+    offset = Point2i(index % m_numBlocks.x(), index / m_numBlocks.x()) * m_blockSize;
+    size = (m_size - offset).cwiseMin(Vector2i::Constant(m_blockSize));
+}
+
+void BlockGenerator::sortByCost(const std::vector<float> &cost) {
+    if (cost.size() != m_order.size())
+        throw NoriException("BlockGenerator::sortByCost(): expected %i values, got %i!",
+            m_order.size(), cost.size());
+
+    std::stable_sort(m_order.begin(), m_order.end(),
+        [&](int a, int b) { return cost[a] > cost[b]; });
+}
+
+BlockGenerator::EOrder BlockGenerator::parseOrder(const std::string &name) {
+    if (name == "spiral")
+        return ESpiral;
+    else if (name == "hilbert")
+        return EHilbert;
+    else if (name == "morton")
+        return EMorton;
+    throw NoriException("Unknown block order \"%s\" (expected spiral, hilbert or morton)!", name);
+}
+
 NORI_NAMESPACE_END
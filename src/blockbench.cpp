@@ -0,0 +1,129 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/block.h>
+#include <nori/rfilter.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_scheduler_init.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Scaling benchmark for merging rendered blocks into the output image
+ *
+ * Repeatedly merges small image blocks into a full-resolution image using
+ * an increasing number of threads (1, 2, 4, .., maxThreads). Each thread
+ * count is measured twice: once with a single lock that covers the whole
+ * image (how \ref ImageBlock::put() used to work) and once with the default
+ * row-band locks. The merge throughput of both variants is printed as a table.
+ */
+class BlockMergeBenchmark : public NoriObject {
+public:
+    BlockMergeBenchmark(const PropertyList &propList) {
+        /* Resolution of the output image. Default: 1080p */
+        m_size.x() = propList.getInteger("width", 1920);
+        m_size.y() = propList.getInteger("height", 1080);
+
+        /* Size of the merged blocks (small blocks stress the locks the most) */
+        m_blockSize = propList.getInteger("blockSize", 16);
+
+        /* Number of times every block of the image is merged per measurement */
+        m_passes = propList.getInteger("passes", 50);
+
+        /* Largest thread count that will be measured */
+        m_maxThreads = propList.getInteger("maxThreads", 128);
+    }
+
+    /// Run the benchmark
+    void activate() {
+        std::unique_ptr<ReconstructionFilter> filter(static_cast<ReconstructionFilter *>(
+            NoriObjectFactory::createInstance("gaussian", PropertyList())));
+
+        ImageBlock result(m_size, filter.get());
+        result.clear();
+
+        /* Enumerate the block positions once */
+        std::vector<Point2i> offsets;
+        for (int y = 0; y < m_size.y(); y += m_blockSize)
+            for (int x = 0; x < m_size.x(); x += m_blockSize)
+                offsets.push_back(Point2i(x, y));
+        int mergeCount = (int) offsets.size() * m_passes;
+
+        cout << "Merging " << mergeCount << " blocks of " << m_blockSize << "x"
+             << m_blockSize << " pixels into a " << m_size.x() << "x" << m_size.y()
+             << " image" << endl;
+        cout << tfm::format("%8s  %18s  %18s  %8s", "threads",
+            "single lock [1/s]", "row bands [1/s]", "speedup") << endl;
+
+        for (int threads = 1; threads <= m_maxThreads; threads *= 2) {
+            tbb::task_scheduler_init init(threads);
+
+            double throughput[2];
+            for (int variant = 0; variant < 2; ++variant) {
+                result.setLockBandHeight(variant == 0 ? (int) result.rows() : NORI_LOCK_BAND_HEIGHT);
+
+                Timer timer;
+                tbb::parallel_for(tbb::blocked_range<int>(0, mergeCount),
+                    [&](const tbb::blocked_range<int> &range) {
+                        ImageBlock block(Vector2i(m_blockSize), filter.get());
+                        block.setConstant(Color4f(1.0f, 1.0f, 1.0f, 1.0f));
+
+                        for (int i = range.begin(); i < range.end(); ++i) {
+                            const Point2i &offset = offsets[i % offsets.size()];
+                            block.setOffset(offset);
+                            block.setSize((m_size - offset).cwiseMin(Vector2i::Constant(m_blockSize)));
+                            result.put(block);
+                        }
+                    }
+                );
+                throughput[variant] = mergeCount / std::max(timer.elapsed() / 1000.0, 1e-3);
+            }
+
+            cout << tfm::format("%8i  %18.0f  %18.0f  %7.2fx", threads,
+                throughput[0], throughput[1], throughput[1] / throughput[0]) << endl;
+        }
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "BlockMergeBenchmark[\n"
+            "  size = %s,\n"
+            "  blockSize = %i,\n"
+            "  passes = %i,\n"
+            "  maxThreads = %i\n"
+            "]",
+            m_size.toString(),
+            m_blockSize,
+            m_passes,
+            m_maxThreads
+        );
+    }
+
+    EClassType getClassType() const { return ETest; }
+private:
+    Vector2i m_size;
+    int m_blockSize;
+    int m_passes;
+    int m_maxThreads;
+};
+
+NORI_REGISTER_CLASS(BlockMergeBenchmark, "blockbench");
+NORI_NAMESPACE_END
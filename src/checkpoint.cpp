@@ -0,0 +1,149 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/checkpoint.h>
+#include <nori/sampler.h>
+#include <fstream>
+#include <cstdio>
+
+NORI_NAMESPACE_BEGIN
+
+static const char checkpointMagic[8] = { 'N', 'O', 'R', 'I', 'C', 'K', 'P', 'T' };
+static const uint32_t checkpointVersion = 2;
+
+template <typename T> static void write(std::ostream &os, const T &value) {
+    os.write((const char *) &value, sizeof(T));
+}
+
+template <typename T> static void read(std::istream &is, T &value) {
+    is.read((char *) &value, sizeof(T));
+}
+
+Checkpoint::Checkpoint(ImageBlock &result, ImageBlock *oddPasses,
+        SampleCounts &sampleCounts, Sampler *sampler)
+    : m_result(result), m_oddPasses(oddPasses),
+      m_sampleCounts(sampleCounts), m_sampler(sampler) { }
+
+void Checkpoint::save(const std::string &filename) const {
+    std::string tmpName = filename + ".tmp";
+    std::ofstream os(tmpName, std::ios::binary);
+    if (!os)
+        throw NoriException("Unable to write the checkpoint \"%s\"!", tmpName);
+
+    os.write(checkpointMagic, sizeof(checkpointMagic));
+    write(os, checkpointVersion);
+    write(os, (int32_t) m_result.getSize().x());
+    write(os, (int32_t) m_result.getSize().y());
+    write(os, (int32_t) m_result.getBorderSize());
+    write(os, m_passes);
+    write(os, m_samplesTaken);
+    write(os, m_elapsed);
+    write(os, (uint8_t) (m_oddPasses ? 1 : 0));
+
+    m_sampler->serialize(os);
+
+    /* The image blocks are only modified by the render loop, which is
+       not running while a checkpoint is written. The lock keeps the
+       preview window from reading a half-written block, though. */
+    m_result.lock();
+    os.write((const char *) m_result.data(), sizeof(Color4f) * m_result.size());
+    m_result.unlock();
+    if (m_oddPasses)
+        os.write((const char *) m_oddPasses->data(), sizeof(Color4f) * m_oddPasses->size());
+    os.write((const char *) m_sampleCounts.data(), sizeof(uint32_t) * m_sampleCounts.size());
+
+    uint32_t tileCount = m_tileCosts ? (uint32_t) m_tileCosts->size() : 0;
+    write(os, tileCount);
+    if (tileCount > 0)
+        os.write((const char *) m_tileCosts->data(), sizeof(float) * tileCount);
+
+    os.close();
+    if (!os)
+        throw NoriException("Error while writing the checkpoint \"%s\"!", tmpName);
+
+    /* Replace the previous checkpoint (rename() does not overwrite on Windows) */
+    if (std::rename(tmpName.c_str(), filename.c_str()) != 0) {
+        std::remove(filename.c_str());
+        if (std::rename(tmpName.c_str(), filename.c_str()) != 0)
+            throw NoriException("Unable to replace the checkpoint \"%s\"!", filename);
+    }
+}
+
+void Checkpoint::load(const std::string &filename) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is)
+        throw NoriException("Unable to open the checkpoint \"%s\"!", filename);
+
+    char magic[sizeof(checkpointMagic)];
+    uint32_t version;
+    is.read(magic, sizeof(magic));
+    read(is, version);
+    if (!is || memcmp(magic, checkpointMagic, sizeof(magic)) != 0)
+        throw NoriException("\"%s\" is not a checkpoint file!", filename);
+    if (version != checkpointVersion)
+        throw NoriException("Checkpoint \"%s\" has an unsupported version (%i)!", filename, version);
+
+    int32_t width, height, border;
+    uint8_t hasOddPasses;
+    read(is, width);
+    read(is, height);
+    read(is, border);
+    read(is, m_passes);
+    read(is, m_samplesTaken);
+    read(is, m_elapsed);
+    read(is, hasOddPasses);
+
+    if (width != m_result.getSize().x() || height != m_result.getSize().y() ||
+        border != m_result.getBorderSize())
+        throw NoriException("Checkpoint \"%s\" was written for a different image "
+            "(%ix%i, border %i)!", filename, width, height, border);
+
+    m_sampler->unserialize(is);
+
+    is.read((char *) m_result.data(), sizeof(Color4f) * m_result.size());
+
+    if (hasOddPasses) {
+        if (m_oddPasses)
+            is.read((char *) m_oddPasses->data(), sizeof(Color4f) * m_oddPasses->size());
+        else
+            is.seekg(sizeof(Color4f) * m_result.size(), std::ios::cur);
+    } else if (m_oddPasses) {
+        /* Without the odd passes, the noise estimate would be meaningless */
+        throw NoriException("Checkpoint \"%s\" does not contain the data needed "
+            "for noise estimation!", filename);
+    }
+
+    is.read((char *) m_sampleCounts.data(), sizeof(uint32_t) * m_sampleCounts.size());
+
+    uint32_t tileCount = 0;
+    read(is, tileCount);
+    if (tileCount > 0) {
+        std::vector<float> tileCosts(tileCount);
+        is.read((char *) tileCosts.data(), sizeof(float) * tileCount);
+        if (m_tileCosts)
+            *m_tileCosts = tileCosts;
+    } else if (m_tileCosts) {
+        m_tileCosts->clear();
+    }
+
+    if (!is)
+        throw NoriException("Checkpoint \"%s\" is truncated!", filename);
+}
+
+NORI_NAMESPACE_END
@@ -17,11 +17,13 @@
 */
 
 #include <nori/bsdf.h>
+#include <nori/pf.h>
 #include <nori/warp.h>
 #include <pcg32.h>
 #include <hypothesis.h>
 #include <fstream>
 #include <memory>
+#include <functional>
 
 /*
  * =======================================================================
@@ -36,8 +38,8 @@ NORI_NAMESPACE_BEGIN
 
 /**
  * \brief Statistical test for validating that an importance sampling routine
- * (e.g. from a BSDF) produces a distribution that agrees with what the
- * implementation claims via its associated density function.
+ * (e.g. from a BSDF or a phase function) produces a distribution that agrees
+ * with what the implementation claims via its associated density function.
  */
 class ChiSquareTest : public NoriObject {
 public:
@@ -61,8 +63,8 @@ public:
         /* Number of samples that should be taken (-1: automatic) */
         m_sampleCount = propList.getInteger("sampleCount", -1);
 
-        /* Each provided BSDF will be tested for a few different
-           incident directions. The value specified here determines
+        /* Each provided BSDF or phase function will be tested for a few
+           different incident directions. The value specified here determines
            how many tests will be executed per BSDF */
         m_testCount = propList.getInteger("testCount", 5);
 
@@ -75,14 +77,20 @@ public:
     virtual ~ChiSquareTest() {
         for (auto bsdf : m_bsdfs)
             delete bsdf;
+        for (auto pf : m_pfs)
+            delete pf;
     }
 
-    void addChild(NoriObject *obj) {
+    void addChild(NoriObject *obj, const std::string& name = "none") {
         switch (obj->getClassType()) {
             case EBSDF:
                 m_bsdfs.push_back(static_cast<BSDF *>(obj));
                 break;
 
+            case EPhaseFunction:
+                m_pfs.push_back(static_cast<PhaseFunction *>(obj));
+                break;
+
             default:
                 throw NoriException("ChiSquareTest::addChild(<%s>) is not supported!",
                     classTypeName(obj->getClassType()));
@@ -98,18 +106,53 @@ public:
         std::unique_ptr<double[]> expFrequencies(new double[res]);
 
 
-        /* Test each registered BSDF */
+        /* Sampling routine and density of everything that is tested. Phase
+           functions scatter into the whole sphere from any direction */
+        struct Subject {
+            std::string name;
+            bool sphere;
+            std::function<Color3f(const Vector3f &, const Point2f &, Vector3f &)> sample;
+            std::function<float(const Vector3f &, const Vector3f &)> pdf;
+        };
+        std::vector<Subject> subjects;
         for (auto bsdf : m_bsdfs) {
+            subjects.push_back({ bsdf->toString(), false,
+                [bsdf](const Vector3f &wi, const Point2f &sample, Vector3f &wo) {
+                    BSDFQueryRecord bRec(wi);
+                    Color3f result = bsdf->sample(bRec, sample);
+                    wo = bRec.wo;
+                    return result;
+                },
+                [bsdf](const Vector3f &wi, const Vector3f &wo) {
+                    BSDFQueryRecord bRec(wi, wo, Vector2f(), ESolidAngle);
+                    return bsdf->pdf(bRec);
+                } });
+        }
+        for (auto pf : m_pfs) {
+            subjects.push_back({ pf->toString(), true,
+                [pf](const Vector3f &wi, const Point2f &sample, Vector3f &wo) {
+                    PFQueryRecord pRec(wi);
+                    Color3f result = pf->sample(pRec, sample);
+                    wo = pRec.wo;
+                    return result;
+                },
+                [pf](const Vector3f &wi, const Vector3f &wo) {
+                    return pf->pdf(PFQueryRecord(wi, wo));
+                } });
+        }
+
+        /* Test each registered BSDF and phase function */
+        for (const Subject &subject : subjects) {
             /* Run several tests per BSDF to be on the safe side */
             for (int l = 0; l<m_testCount; ++l) {
                 memset(obsFrequencies.get(), 0, res*sizeof(double));
                 memset(expFrequencies.get(), 0, res*sizeof(double));
 
                 cout << "------------------------------------------------------" << endl;
-                cout << "Testing: " << bsdf->toString() << endl;
+                cout << "Testing: " << subject.name << endl;
                 ++total;
 
-                float cosTheta = random.nextFloat();
+                float cosTheta = subject.sphere ? 2 * random.nextFloat() - 1 : random.nextFloat();
                 float sinTheta = std::sqrt(std::max((float) 0, 1-cosTheta*cosTheta));
                 float sinPhi, cosPhi;
                 sincosf(2.0f * M_PI * random.nextFloat(), &sinPhi, &cosPhi);
@@ -121,18 +164,18 @@ public:
 
                 /* Generate many samples from the BSDF and create
                    a histogram / contingency table */
-                BSDFQueryRecord bRec(wi);
                 for (int i=0; i<m_sampleCount; ++i) {
                     Point2f sample(random.nextFloat(), random.nextFloat());
-                    Color3f result = bsdf->sample(bRec, sample);
+                    Vector3f wo;
+                    Color3f result = subject.sample(wi, sample, wo);
 
                     if ((result.array() == 0).all())
                         continue;
 
-                    int cosThetaBin = std::min(std::max(0, (int) std::floor((bRec.wo.z()*0.5f+0.5f)
+                    int cosThetaBin = std::min(std::max(0, (int) std::floor((wo.z()*0.5f+0.5f)
                             * m_cosThetaResolution)), m_cosThetaResolution-1);
 
-                    float scaledPhi = std::atan2(bRec.wo.y(), bRec.wo.x()) * INV_TWOPI;
+                    float scaledPhi = std::atan2(wo.y(), wo.x()) * INV_TWOPI;
                     if (scaledPhi < 0)
                         scaledPhi += 1;
 
@@ -162,8 +205,7 @@ public:
                                         (float) (sinTheta * sinPhi),
                                         (float) cosTheta);
 
-                            BSDFQueryRecord bRec(wi, wo, Vector2f(), ESolidAngle);
-                            return bsdf->pdf(bRec);
+                            return subject.pdf(wi, wo);
                         };
 
                         double integral = hypothesis::adaptiveSimpson2D(
@@ -182,7 +224,7 @@ public:
                 /* Perform the Chi^2 test */
                 std::pair<bool, std::string> result =
                     hypothesis::chi2_test(m_cosThetaResolution*m_phiResolution, obsFrequencies.get(), expFrequencies.get(),
-                        m_sampleCount, m_minExpFrequency, m_significanceLevel, m_testCount * (int) m_bsdfs.size());
+                        m_sampleCount, m_minExpFrequency, m_significanceLevel, m_testCount * (int) subjects.size());
 
                 if (result.first)
                     ++passed;
@@ -223,6 +265,7 @@ private:
     int m_testCount;
     float m_significanceLevel;
     std::vector<BSDF *> m_bsdfs;
+    std::vector<PhaseFunction *> m_pfs;
 };
 
 NORI_REGISTER_CLASS(ChiSquareTest, "chi2test");
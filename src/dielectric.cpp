@@ -43,6 +43,20 @@ public:
         return 0.0f;
     }
 
+    void evalBatch(const BSDFQueryRecord *, Color3f *result, size_t count) const {
+        std::fill(result, result + count, Color3f(0.0f));
+    }
+
+    void pdfBatch(const BSDFQueryRecord *, float *result, size_t count) const {
+        std::fill(result, result + count, 0.0f);
+    }
+
+    void sampleBatch(BSDFQueryRecord *bRecs, const Point2f *samples,
+            Color3f *result, size_t count) const {
+        for (size_t i = 0; i < count; ++i)
+            result[i] = Dielectric::sample(bRecs[i], samples[i]);
+    }
+
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &sample) const {
         
         float cosThetaI = Frame::cosTheta(bRec.wi);
@@ -69,6 +83,11 @@ public:
 
     }
 
+    float getRoughness(const Point2f &) const {
+        /* Emitter sampling never helps a smooth dielectric */
+        return 0.0f;
+    }
+
     std::string toString() const {
         return tfm::format(
             "Dielectric[\n"
@@ -86,10 +86,53 @@ NORI_NAMESPACE_BEGIN
             return m_albedo->eval(bRec.uv);
         }
 
+        /// Draw samples for a span of query records
+        void sampleBatch(BSDFQueryRecord* bRecs, const Point2f* samples,
+            Color3f* result, size_t count) const {
+            /* The weight of every sample is the albedo */
+            evalTexture(m_albedo, bRecs, result, count);
+
+            for (size_t i = 0; i < count; ++i) {
+                BSDFQueryRecord& bRec = bRecs[i];
+                if (Frame::cosTheta(bRec.wi) <= 0) {
+                    result[i] = Color3f(0.0f);
+                    continue;
+                }
+                bRec.measure = ESolidAngle;
+                bRec.wo = Warp::squareToCosineHemisphere(samples[i]);
+                bRec.eta = 1.0f;
+            }
+        }
+
+        /// Evaluate the BRDF model for a span of query records
+        void evalBatch(const BSDFQueryRecord* bRecs, Color3f* result, size_t count) const {
+            evalTexture(m_albedo, bRecs, result, count);
+
+            for (size_t i = 0; i < count; ++i) {
+                const BSDFQueryRecord& bRec = bRecs[i];
+                if (bRec.measure != ESolidAngle
+                    || Frame::cosTheta(bRec.wi) <= 0
+                    || Frame::cosTheta(bRec.wo) <= 0)
+                    result[i] = Color3f(0.0f);
+                else
+                    result[i] *= INV_PI;
+            }
+        }
+
+        /// Compute the density of \ref sample() for a span of query records
+        void pdfBatch(const BSDFQueryRecord* bRecs, float* result, size_t count) const {
+            for (size_t i = 0; i < count; ++i)
+                result[i] = Diffuse::pdf(bRecs[i]);
+        }
+
         bool isDiffuse() const {
             return true;
         }
 
+        bool isLambertian() const {
+            return true;
+        }
+
         /*
         *  \brief Checks if the bsdf has a displacement map.
         * This displacement map is used for bump mapping
@@ -3,27 +3,172 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+#include <nori/reservoir.h>
 NORI_NAMESPACE_BEGIN
+
+/**
+ * Direct illumination, combining emitter and BSDF sampling with MIS.
+ *
+ * Parameters:
+ *  - \c risCandidates: if positive, the emitter sample is resampled out of
+ *    this many unshadowed candidates, and only the chosen one is tested for
+ *    visibility (default 0 = a single emitter sample)
+ *  - \c spatialReuse: additionally merge the reservoirs of neighbouring
+ *    pixels of the image block (biased, default false)
+ *  - \c spatialNeighbours: neighbours merged per pixel (default 5)
+ *  - \c spatialRadius: radius of the neighbourhood in pixels (default 10)
+ */
 class DirectMIS : public Integrator
 {
 public:
 	DirectMIS(const PropertyList& props)
 	{
-		/* No parameters this time */
+		m_risCandidates = props.getInteger("risCandidates", 0);
+		m_spatialReuse = props.getBoolean("spatialReuse", false);
+		m_spatialNeighbours = props.getInteger("spatialNeighbours", 5);
+		m_spatialRadius = props.getFloat("spatialRadius", 10.f);
+		if (m_risCandidates < 0 || m_spatialNeighbours < 0)
+			throw NoriException("DirectMIS: invalid candidate or neighbour count!");
+		if (m_spatialReuse && m_risCandidates == 0)
+			throw NoriException("DirectMIS: spatialReuse requires risCandidates!");
 	}
+
 	Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
 	{
-		Color3f Lo(0.); // Total radiance
-		Color3f Le(0.); // From the first intersection (If its emitter only)
-		Color3f Li_mats(0.); // From the material sampling
-		Color3f Li_ems(0.); // From the emmiter sampling
-
 		// Find the surface that is visible in the requested direction
 		Intersection its;
 		if (!scene->rayIntersect(ray, its)) {
 			return scene->getBackground(ray);
 		}
 
+		if (m_risCandidates == 0)
+			return shade(scene, sampler, ray, its, nullptr);
+
+		Reservoir r;
+		sampleLightReservoir(scene, sampler, its.p, m_risCandidates, SurfaceScatter(its, ray), r);
+		return shade(scene, sampler, ray, its, &r);
+	}
+
+	/**
+	 * With spatial reuse, all pixels of the block choose their reservoirs
+	 * first. Every pixel then merges the reservoirs of a few random
+	 * neighbours with similar geometry before it is shaded.
+	 */
+	void renderBlock(const Scene* scene, Sampler* sampler, ImageBlock& block,
+		uint32_t sampleCount, int stride) const
+	{
+		if (!m_spatialReuse) {
+			Integrator::renderBlock(scene, sampler, block, sampleCount, stride);
+			return;
+		}
+
+		const Camera* camera = scene->getCamera();
+		Point2i offset = block.getOffset();
+		Vector2i size = block.getSize();
+		int width = (size.x() + stride - 1) / stride;
+		int height = (size.y() + stride - 1) / stride;
+		std::vector<ShadingPoint> points((size_t) width * height);
+
+		for (uint32_t i = 0; i < sampleCount; ++i) {
+			for (int y = 0; y < height; ++y) {
+				for (int x = 0; x < width; ++x) {
+					ShadingPoint& sp = points[(size_t) y * width + x];
+					sp.pixelSample = Point2f((float) (x * stride + offset.x()), (float) (y * stride + offset.y())) + sampler->next2D();
+					Point2f apertureSample = sampler->next2D();
+					sp.value = camera->sampleRay(sp.ray, sp.pixelSample, apertureSample);
+					sp.hit = scene->rayIntersect(sp.ray, sp.its);
+					if (sp.hit)
+						sampleLightReservoir(scene, sampler, sp.its.p, m_risCandidates, SurfaceScatter(sp.its, sp.ray), sp.reservoir);
+				}
+			}
+
+			for (int y = 0; y < height; ++y) {
+				for (int x = 0; x < width; ++x) {
+					const ShadingPoint& sp = points[(size_t) y * width + x];
+					if (!sp.hit) {
+						block.put(sp.pixelSample, sp.value * scene->getBackground(sp.ray));
+						continue;
+					}
+
+					SurfaceScatter scatter(sp.its, sp.ray);
+					Reservoir r = sp.reservoir;
+					for (int k = 0; k < m_spatialNeighbours; ++k) {
+						Point2f d = Warp::squareToUniformDisk(sampler->next2D()) * (m_spatialRadius / stride);
+						int nx = x + (int) std::round(d.x()), ny = y + (int) std::round(d.y());
+						if (nx < 0 || ny < 0 || nx >= width || ny >= height || (nx == x && ny == y))
+							continue;
+						const ShadingPoint& neighbour = points[(size_t) ny * width + nx];
+						if (!neighbour.hit || !similar(sp, neighbour))
+							continue;
+						mergeReservoir(r, neighbour.reservoir, sp.its.p, scatter, sampler->next1D());
+					}
+					block.put(sp.pixelSample, sp.value * shade(scene, sampler, sp.ray, sp.its, &r));
+				}
+			}
+		}
+	}
+
+	std::string toString() const {
+		return tfm::format(
+			"DirectMIS[\n"
+			"  risCandidates = %i,\n"
+			"  spatialReuse = %s,\n"
+			"  spatialNeighbours = %i,\n"
+			"  spatialRadius = %f\n"
+			"]",
+			m_risCandidates,
+			m_spatialReuse ? "true" : "false",
+			m_spatialNeighbours,
+			m_spatialRadius);
+	}
+
+private:
+	/// BSDF times cosine at a surface point (scatter functor of the reservoir functions)
+	struct SurfaceScatter {
+		const Intersection& its;
+		Vector3f wi;
+
+		SurfaceScatter(const Intersection& its, const Ray3f& ray) : its(its), wi(its.toLocal(-ray.d)) { }
+
+		Color3f operator()(const Vector3f& wo, float& pdf) const {
+			BSDFQueryRecord bRec(wi, its.toLocal(wo), its.uv, ESolidAngle);
+			pdf = its.mesh->getBSDF()->pdf(bRec);
+			return Color3f(its.mesh->getBSDF()->eval(bRec) * its.shFrame.n.dot(wo)).clamp();
+		}
+	};
+
+	/// Primary hit of a pixel sample with spatial reuse
+	struct ShadingPoint {
+		Point2f pixelSample;
+		Color3f value;
+		Ray3f ray;
+		Intersection its;
+		bool hit;
+		Reservoir reservoir;
+	};
+
+	/// Only reuse neighbours with similar normals and depths
+	static bool similar(const ShadingPoint& a, const ShadingPoint& b)
+	{
+		return a.its.shFrame.n.dot(b.its.shFrame.n) > 0.9f
+			&& std::abs(a.its.t - b.its.t) < 0.1f * a.its.t;
+	}
+
+	/**
+	 * Radiance leaving the surface point \c its towards the camera. The
+	 * emitter sample is taken from \c r if given.
+	 */
+	Color3f shade(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+		const Intersection& its, const Reservoir* r) const
+	{
+		Color3f Lo(0.); // Total radiance
+		Color3f Le(0.); // From the first intersection (If its emitter only)
+		Color3f Li_mats(0.); // From the material sampling
+		Color3f Li_ems(0.); // From the emmiter sampling
+
 		//**********************************************************
 		//Check if the intersected mesh is an emitter and compute Le
 		//**********************************************************
@@ -38,37 +183,48 @@ public:
 		float p_mat_wem = 0;
 		float p_mat_wmat = 0;
 		float p_em_wmat = 0;
-		const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_light); 	//const Emitter *sampleEmitter(float rnd, float &pdf) const;
-		//Sample a point from the light
-		EmitterQueryRecord emitterRecordEms(its.p);
-		Li_ems = light->sample(emitterRecordEms, sampler->next2D(), 0.);
-		//Visibility check
-		Ray3f sray(its.p, emitterRecordEms.wi);
-		Intersection it_shadow;
-		bool isEmmiterVisible = true;
-		if (scene->rayIntersect(sray, it_shadow)) {
-			if (it_shadow.t < (emitterRecordEms.dist - 1.e-5)) {
-				isEmmiterVisible = false;
+		if (r) {
+			//Resampled emitter sample: a single shadow ray for all candidates
+			if (r->valid() && !scene->rayIntersect(Ray3f(its.p, r->sample.lRec.wi, Epsilon, r->sample.lRec.dist - Epsilon))) {
+				p_em_wem = r->sample.p_em;
+				// BSDF sampling can't hit delta lights
+				p_mat_wem = r->candidate.emitter->isDelta() ? 0.f : r->sample.p_mat;
+				Li_ems = r->sample.value * r->weight();
 			}
 		}
+		else {
+			const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_light); 	//const Emitter *sampleEmitter(float rnd, float &pdf) const;
+			//Sample a point from the light
+			EmitterQueryRecord emitterRecordEms(its.p);
+			Li_ems = light->sample(emitterRecordEms, sampler->next2D(), 0.);
+			//Visibility check
+			Ray3f sray(its.p, emitterRecordEms.wi);
+			Intersection it_shadow;
+			bool isEmmiterVisible = true;
+			if (scene->rayIntersect(sray, it_shadow)) {
+				if (it_shadow.t < (emitterRecordEms.dist - 1.e-5)) {
+					isEmmiterVisible = false;
+				}
+			}
 
-		//BSDF 
-		BSDFQueryRecord bsdfRecordEms(its.toLocal(-ray.d),
-			its.toLocal(emitterRecordEms.wi), its.uv, ESolidAngle);
+			//BSDF 
+			BSDFQueryRecord bsdfRecordEms(its.toLocal(-ray.d),
+				its.toLocal(emitterRecordEms.wi), its.uv, ESolidAngle);
 		
-		if (isEmmiterVisible) {
+			if (isEmmiterVisible) {
 			
 
-			//Probability of the sample of the point of the light source
-			float pdf_light_point = light->pdf(emitterRecordEms);
+				//Probability of the sample of the point of the light source
+				float pdf_light_point = light->pdf(emitterRecordEms);
 
-			//Compute the p_em(sample ems) and p_mat(sample ems)
-			p_em_wem = pdf_light_point * pdf_light;
-			// For MSI we need to evaluate respect to p_mat_wem the pdf of the direction
-			p_mat_wem = its.mesh->getBSDF()->pdf(bsdfRecordEms);
-			//Accumulate the sample
-			Li_ems *= (its.mesh->getBSDF()->eval(bsdfRecordEms) *
-				its.shFrame.n.dot(emitterRecordEms.wi)) / p_em_wem;
+				//Compute the p_em(sample ems) and p_mat(sample ems)
+				p_em_wem = pdf_light_point * pdf_light;
+				// For MSI we need to evaluate respect to p_mat_wem the pdf of the direction
+				p_mat_wem = its.mesh->getBSDF()->pdf(bsdfRecordEms);
+				//Accumulate the sample
+				Li_ems *= (its.mesh->getBSDF()->eval(bsdfRecordEms) *
+					its.shFrame.n.dot(emitterRecordEms.wi)) / p_em_wem;
+			}
 		}
 
 		
@@ -90,8 +246,9 @@ public:
 				Li_mats = it_next.mesh->getEmitter()->eval(emitterRecordMat);
 				Li_mats = Li_mats * fr;
 
-				// Get p_em_wmat
-				p_em_wmat = it_next.mesh->getEmitter()->pdf(emitterRecordMat);
+				// Get p_em_wmat (including the probability of choosing the emitter)
+				p_em_wmat = scene->pdfEmitter(it_next.mesh->getEmitter()) *
+					it_next.mesh->getEmitter()->pdf(emitterRecordMat);
 				//Compute the p_mat(sample mats)
 				p_mat_wmat = its.mesh->getBSDF()->pdf(bsdfRecordMat);
 			}
@@ -114,11 +271,10 @@ public:
 		return Lo;
 	}
 
-
-	std::string toString() const {
-		return "Multiple Importance Sampling []";
-	}
-
+	int m_risCandidates;
+	bool m_spatialReuse;
+	int m_spatialNeighbours;
+	float m_spatialRadius;
 };
 NORI_REGISTER_CLASS(DirectMIS, "direct_mis");
 NORI_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,180 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/distribution.h>
+
+NORI_NAMESPACE_BEGIN
+
+Distribution1D::Distribution1D(const float* f, int n) : cdf(n + 1), func(f, f + n) {
+    /* Integral of the step function over [0, 1) */
+    cdf[0] = 0;
+    for (int i = 1; i < n + 1; ++i)
+        cdf[i] = cdf[i - 1] + func[i - 1] / n;
+    funcInt = cdf[n];
+
+    /* Normalize; fall back to a uniform distribution if everything is zero */
+    if (funcInt == 0) {
+        for (int i = 1; i < n + 1; ++i)
+            cdf[i] = float(i) / float(n);
+    } else {
+        for (int i = 1; i < n + 1; ++i)
+            cdf[i] /= funcInt;
+    }
+
+    guide.resize(n);
+    int interval = 0;
+    for (int i = 0; i < n; ++i) {
+        float u = float(i) / float(n);
+        while (interval < n - 1 && cdf[interval + 1] <= u)
+            ++interval;
+        guide[i] = interval;
+    }
+}
+
+int Distribution1D::Count() const {
+    return (int) func.size();
+}
+
+float Distribution1D::SampleContinuous(float u, float* pdf, int* off) const {
+    int n = Count();
+    int offset = guide[std::min((int) (u * n), n - 1)];
+    while (offset < n - 1 && cdf[offset + 1] <= u)
+        ++offset;
+    if (off)
+        *off = offset;
+
+    float du = u - cdf[offset];
+    if (cdf[offset + 1] - cdf[offset] > 0)
+        du /= cdf[offset + 1] - cdf[offset];
+
+    if (pdf)
+        *pdf = funcInt > 0 ? func[offset] / funcInt : 1.f;
+
+    return std::min((offset + du) / n, 1.f - FLT_EPSILON);
+}
+
+float Distribution1D::DiscretePdf(int index) const {
+    return cdf[index + 1] - cdf[index];
+}
+
+Distribution2D::Distribution2D(const float* func, int nu, int nv) {
+    for (int v = 0; v < nv; ++v)
+        pConditionalV.emplace_back(new Distribution1D(&func[v * nu], nu));
+
+    std::vector<float> marginalFunc;
+    for (int v = 0; v < nv; ++v)
+        marginalFunc.push_back(pConditionalV[v]->funcInt);
+    pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
+}
+
+Point2f Distribution2D::SampleContinuous2(const Point2f& u, float* pdf) const {
+    float pdfs[2];
+    int v;
+    float d1 = pMarginal->SampleContinuous(u[1], &pdfs[1], &v);
+    float d0 = pConditionalV[v]->SampleContinuous(u[0], &pdfs[0], nullptr);
+    *pdf = pdfs[0] * pdfs[1];
+    return Point2f(d0, d1);
+}
+
+float Distribution2D::DiscretePdf2(const Point2f& p) const {
+    int nu = pConditionalV[0]->Count(), nv = pMarginal->Count();
+    int iu = std::min(std::max((int) (p[0] * nu), 0), nu - 1);
+    int iv = std::min(std::max((int) (p[1] * nv), 0), nv - 1);
+    if (pMarginal->funcInt == 0)
+        return 1.f;
+    return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
+}
+
+AliasTable::AliasTable(const float* weights, int n) : bins(n) {
+    double sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += weights[i];
+    /* Fall back to a uniform distribution if everything is zero */
+    for (int i = 0; i < n; ++i)
+        bins[i].p = sum > 0 ? float(weights[i] / sum) : 1.f / n;
+
+    /* Bins with less than the average probability get filled up by the ones with more */
+    std::vector<std::pair<int, double>> under, over;
+    for (int i = 0; i < n; ++i) {
+        double pScaled = (double) bins[i].p * n;
+        if (pScaled < 1)
+            under.push_back(std::make_pair(i, pScaled));
+        else
+            over.push_back(std::make_pair(i, pScaled));
+    }
+    while (!under.empty() && !over.empty()) {
+        std::pair<int, double> small = under.back(), large = over.back();
+        under.pop_back();
+        over.pop_back();
+        bins[small.first].q = (float) small.second;
+        bins[small.first].alias = large.first;
+
+        double excess = large.second + small.second - 1;
+        if (excess < 1)
+            under.push_back(std::make_pair(large.first, excess));
+        else
+            over.push_back(std::make_pair(large.first, excess));
+    }
+    /* What remains is (up to round-off) exactly one */
+    for (const auto& bin : over) {
+        bins[bin.first].q = 1;
+        bins[bin.first].alias = -1;
+    }
+    for (const auto& bin : under) {
+        bins[bin.first].q = 1;
+        bins[bin.first].alias = -1;
+    }
+}
+
+int AliasTable::Count() const {
+    return (int) bins.size();
+}
+
+int AliasTable::Sample(float u, float v, float* pmf) const {
+    int n = Count();
+    int offset = std::min((int) (u * n), n - 1);
+    if (v >= bins[offset].q)
+        offset = bins[offset].alias;
+    if (pmf)
+        *pmf = bins[offset].p;
+    return offset;
+}
+
+int AliasTable::Sample(float u, float* pmf, float* uRemapped) const {
+    int n = Count();
+    int offset = std::min((int) (u * n), n - 1);
+    float v = std::min(u * n - offset, 1.f - FLT_EPSILON);
+    float q = bins[offset].q;
+    if (v < q) {
+        v /= q;
+    } else {
+        v = (v - q) / (1 - q);
+        offset = bins[offset].alias;
+    }
+    if (pmf)
+        *pmf = bins[offset].p;
+    if (uRemapped)
+        *uRemapped = std::min(std::max(v, 0.f), 1.f - FLT_EPSILON);
+    return offset;
+}
+
+float AliasTable::PMF(int index) const {
+    return bins[index].p;
+}
+
+NORI_NAMESPACE_END
@@ -87,10 +87,11 @@ public:
 
 		//Sample the point
 		Vector3f spherePoint = Warp::squareToUniformSphere(sample);
-		Point3f sampledPointSphere = Point3f(spherePoint[0], spherePoint[1], spherePoint[2]);
 		lRec.p = Point3f(1, 1, 1) * INFINITY;
 		lRec.dist = INFINITY;
-		lRec.wi = (sampledPointSphere - lRec.ref) / (sampledPointSphere - lRec.ref).norm();
+		// The environment is infinitely far away, so the direction towards it
+		// does not depend on the reference point
+		lRec.wi = spherePoint;
 
 		lRec.pdf = Warp::squareToUniformSpherePdf(spherePoint);
 		return eval(lRec) ;//* m_radiance
@@ -100,7 +101,9 @@ public:
 	// Assumes all information about the intersection point is already provided inside.
 	// WARNING: Use with care. Malformed EmitterQueryRecords can result in undefined behavior. Plus no visibility is considered.
 	virtual float pdf(const EmitterQueryRecord& lRec) const {
-		return lRec.pdf;
+		// Directions are sampled uniformly, so this does not depend on lRec.wi
+		// (records built after a BSDF-sampled escape have no valid lRec.pdf)
+		return Warp::squareToUniformSpherePdf(lRec.wi);
 	}
 
 
@@ -0,0 +1,482 @@
+/*
+*/
+
+#include <nori/medium.h>
+#include <nori/volume.h>
+#include <nori/sampler.h>
+#include <nori/emitter.h>
+#include <nori/distribution.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Gaussian lobe of the analytic fit of the CIE 1931 matching functions
+   (Wyman et al. 2013), with different widths on both sides of its mean */
+static float cieLobe(float lambda, float mean, float sigma1, float sigma2) {
+    float t = (lambda - mean) / (lambda < mean ? sigma1 : sigma2);
+    return std::exp(-0.5f * t * t);
+}
+
+/* Linear sRGB radiance of a blackbody at temperature T (Kelvin), relative
+   to the luminance of one at 6500 K */
+static Color3f blackbody(float T) {
+    auto xyz = [](float T) {
+        const double h = 6.62607015e-34, c = 2.99792458e8, k = 1.380649e-23;
+        Vector3f XYZ(0.f);
+        for (float lambda = 360; lambda <= 830; lambda += 5) {
+            double l = lambda * 1e-9;
+            float B = (float) (2 * h * c * c / (std::pow(l, 5) * (std::exp(h * c / (l * k * T)) - 1)));
+            XYZ += B * Vector3f(
+                1.056f * cieLobe(lambda, 599.8f, 37.9f, 31.0f) + 0.362f * cieLobe(lambda, 442.0f, 16.0f, 26.7f)
+                    - 0.065f * cieLobe(lambda, 501.1f, 20.4f, 26.2f),
+                0.821f * cieLobe(lambda, 568.8f, 46.9f, 40.5f) + 0.286f * cieLobe(lambda, 530.9f, 16.3f, 31.1f),
+                1.217f * cieLobe(lambda, 437.0f, 11.8f, 36.0f) + 0.681f * cieLobe(lambda, 459.0f, 26.0f, 13.8f));
+        }
+        return XYZ;
+    };
+    if (!(T > 0))
+        return Color3f(0.f);
+    static const float reference = xyz(6500.f).y();
+    Vector3f XYZ = xyz(T) / reference;
+    Color3f rgb(
+         3.240479f * XYZ.x() - 1.537150f * XYZ.y() - 0.498535f * XYZ.z(),
+        -0.969256f * XYZ.x() + 1.875991f * XYZ.y() + 0.041556f * XYZ.z(),
+         0.055648f * XYZ.x() - 0.204043f * XYZ.y() + 1.057311f * XYZ.z());
+    return rgb.cwiseMax(0.f);
+}
+
+/**
+ * \brief Heterogeneous medium with the density given by a volume
+ *
+ * The extinction is mu_t(x) = scale * density(x) (gray), and the
+ * scattering coefficient albedo * mu_t(x). Along a segment from x, the
+ * extinction is taken as constant on steps of the size of the density
+ * grid that start where the segment enters the grid (see march()), so
+ * \ref sampleBetween(), \ref pdfBetween() and \ref Transmittance() all
+ * integrate the same step function exactly and the weights of the
+ * integrators cancel. Shadow rays get unbiased ratio tracking estimates
+ * instead (\ref evalTransmittance()).
+ *
+ * Fire and explosions add an "emission" volume (radiance per unit length,
+ * one or three channels) or a "temperature" volume (temperatureScale
+ * times its values in Kelvin, emitting as a blackbody relative to one at
+ * 6500 K), both times emissionScale. The emission is independent of the
+ * density. At load time, a grid of up to MaxEmissionResolution cells per
+ * axis over the emission gets an alias table of the power of its cells,
+ * which the emitter of the medium (see VolumeEmitter) uses to target the
+ * bright voxels.
+ *
+ *   <medium type="heterogeneous">
+ *       <float name="scale" value="4"/>
+ *       <color name="albedo" value="0.9, 0.9, 0.9"/>
+ *       <volume type="gridvolume" name="density">
+ *           <string name="filename" value="smoke.vol"/>
+ *       </volume>
+ *       <float name="emissionScale" value="200"/>
+ *       <volume type="gridvolume" name="temperature">
+ *           <string name="filename" value="temperature.vol"/>
+ *       </volume>
+ *   </medium>
+ */
+class Heterogeneous : public Medium {
+public:
+    Heterogeneous(const PropertyList &propList) {
+        m_scale = propList.getFloat("scale", 1.f);
+        m_albedo = propList.getColor("albedo", Color3f(0.8f));
+        m_emissionScale = propList.getFloat("emissionScale", 1.f);
+        m_temperatureScale = propList.getFloat("temperatureScale", 1.f);
+    }
+
+    void addChild(NoriObject *obj, const std::string& name) {
+        if (obj->getClassType() != EVolume) {
+            Medium::addChild(obj, name);
+            return;
+        }
+        VolumeDataSource** volume = name == "density" ? &m_density
+            : name == "emission" ? &m_emission
+            : name == "temperature" ? &m_temperature : nullptr;
+        if (!volume)
+            throw NoriException("Heterogeneous: unknown volume \"%s\"!", name);
+        if (*volume)
+            throw NoriException("Heterogeneous: tried to register multiple %s volumes!", name);
+        *volume = static_cast<VolumeDataSource*>(obj);
+    }
+
+    void activate() {
+        Medium::activate();
+        if (!m_density)
+            throw NoriException("Heterogeneous: a density volume is required!");
+        if (!m_density->supportsFloatLookups())
+            throw NoriException("Heterogeneous: the density volume must have a single channel!");
+        // Without a mesh, the medium is where the density is
+        if (!m_bbox.isValid())
+            m_bbox = m_density->getBoundingBox();
+        m_maxExtinction = m_scale * m_density->getMaximumFloatValue();
+
+        if (m_emission && m_temperature)
+            throw NoriException("Heterogeneous: use either an emission or a temperature volume!");
+        if (m_temperature && !m_temperature->supportsFloatLookups())
+            throw NoriException("Heterogeneous: the temperature volume must have a single channel!");
+        if (m_temperature) {
+            // Blackbody colors are tabulated up to the hottest voxel
+            float maxTemperature = std::max(m_temperatureScale * m_temperature->getMaximumFloatValue(), Epsilon);
+            m_blackbodyStep = maxTemperature / (BlackbodyResolution - 1);
+            m_blackbody.resize(BlackbodyResolution);
+            for (int i = 0; i < BlackbodyResolution; ++i)
+                m_blackbody[i] = blackbody(i * m_blackbodyStep);
+        }
+        if (isEmissive()) {
+            buildEmission();
+            // Next event estimation is the only way integrators find the emission from surfaces
+            if (!m_emitter) {
+                m_emitter = static_cast<Emitter*>(
+                    NoriObjectFactory::createInstance("volumelight", PropertyList()));
+                m_emitter->setParent(this);
+            }
+        }
+    }
+
+    ~Heterogeneous() {
+        delete m_density;
+        delete m_emission;
+        delete m_temperature;
+    }
+
+    bool isEmissive() const {
+        return m_emission || m_temperature;
+    }
+
+    Color3f getEmission(const Point3f& p) const {
+        if (!isEmissive() || !m_emissionBounds.contains(p))
+            return Color3f(0.f);
+        if (m_temperature) {
+            float pos = std::max(m_temperatureScale * m_temperature->lookupFloat(p), 0.f) / m_blackbodyStep;
+            int i = std::min((int) pos, BlackbodyResolution - 2);
+            float f = std::min(pos - i, 1.f);
+            return m_emissionScale * (m_blackbody[i] * (1 - f) + m_blackbody[i + 1] * f);
+        }
+        if (m_emission->supportsColorLookups())
+            return m_emissionScale * m_emission->lookupColor(p);
+        return Color3f(m_emissionScale * m_emission->lookupFloat(p));
+    }
+
+    /// Ray marched like the optical depth, with the emission taken at the middle of each step
+    Color3f evalEmission(const Point3f& x, const Point3f& xz) const {
+        float start, end;
+        if (!isEmissive() || !clip(m_emissionBounds, x, xz, start, end))
+            return Color3f(0.f);
+        Vector3f d = (xz - x).normalized();
+        float stepSize = std::min(m_density->getStepSize(), emissionSource()->getStepSize());
+        int steps = std::max(1, (int) std::ceil((end - start) / stepSize));
+        float dt = (end - start) / steps;
+
+        float tau = opticalDepth(x, x + start * d);
+        Color3f L(0.f);
+        float density[LookupBatch];
+        for (int i0 = 0; i0 < steps; i0 += LookupBatch) {
+            int count = std::min((int) LookupBatch, steps - i0);
+            m_density->lookupFloatRay(x, d, start + (i0 + 0.5f) * dt, dt, density, count);
+            for (int i = 0; i < count; ++i) {
+                float mu_t = m_scale * density[i];
+                Point3f p = x + (start + (i0 + i + 0.5f) * dt) * d;
+                L += getEmission(p) * (std::exp(-(tau + 0.5f * mu_t * dt)) * dt);
+                tau += mu_t * dt;
+            }
+        }
+        return L;
+    }
+
+    /*
+    * Emitters get two random numbers for three dimensions and the cell: the
+    * alias table takes the first and passes on what is left of it for x,
+    * and the second gives y and, from its digits below 1/4096, z. The point
+    * is a deterministic function of the sample that moves little for small
+    * changes of it (except where the digits wrap).
+    */
+    float sampleEmission(const Point2f& sample, Point3f& p) const {
+        if (m_emissionTable.Count() == 0)
+            return 0.f;
+        float pmf, rest;
+        int index = m_emissionTable.Sample(sample.x(), &pmf, &rest);
+
+        Vector3i cell(index % m_emissionRes.x(), (index / m_emissionRes.x()) % m_emissionRes.y(),
+            index / (m_emissionRes.x() * m_emissionRes.y()));
+        float digits = sample.y() * 4096.f;
+        Vector3f offset(rest, sample.y(), digits - std::floor(digits));
+        p = m_emissionBounds.min + (cell.cast<float>() + offset).cwiseProduct(m_emissionCell);
+        return pmf / m_emissionCell.prod();
+    }
+
+    float pdfEmission(const Point3f& p) const {
+        if (m_emissionTable.Count() == 0 || !m_emissionBounds.contains(p))
+            return 0.f;
+        Vector3f pos = (p - m_emissionBounds.min).cwiseQuotient(m_emissionCell);
+        int cell[3];
+        for (int k = 0; k < 3; ++k)
+            cell[k] = std::min(std::max((int) pos[k], 0), m_emissionRes[k] - 1);
+        int index = (cell[2] * m_emissionRes.y() + cell[1]) * m_emissionRes.x() + cell[0];
+        return m_emissionTable.PMF(index) / m_emissionCell.prod();
+    }
+
+    float extinction(const Point3f& p) const {
+        return m_scale * m_density->lookupFloat(p);
+    }
+
+    Color3f Transmittance(Point3f x, Point3f xz) const {
+        return Color3f(std::exp(-opticalDepth(x, xz)));
+    }
+
+    /// Ratio tracking (Novak et al. 2014) against the maximum extinction
+    Color3f evalTransmittance(const Point3f& x, const Point3f& xz, Sampler* sampler) const {
+        float tmin, tmax;
+        if (!sampler || !(m_maxExtinction > 0) || !clip(x, xz, tmin, tmax))
+            return Transmittance(x, xz);
+
+        Vector3f d = (xz - x).normalized();
+        float T = 1.f, t = tmin;
+        // Consecutive collisions often fall in the same cell of the grid
+        VolumeCellCache cache;
+        while (true) {
+            t -= std::log(1 - sampler->next1D()) / m_maxExtinction;
+            if (t >= tmax)
+                break;
+            T *= 1 - m_scale * m_density->lookupFloat(x + t * d, cache) / m_maxExtinction;
+        }
+        return Color3f(T);
+    }
+
+    float pdfBetween(const MediumIntersection& medIts, float t) const {
+        if (t >= medIts.distZ)
+            return 0.f;
+        // Extinction of the step that contains t (zero outside of the grid)
+        float tau = 0.f, mu_t = 0.f;
+        march(medIts.x, (medIts.xz - medIts.x).normalized(), t,
+            [&](float t0, float t1, float mu) {
+                tau += mu * (t1 - t0);
+                mu_t = t1 >= t ? mu : 0.f;
+                return true;
+            });
+        return mu_t * std::exp(-tau);
+    }
+
+    Color3f getScatteringCoeficient(const Point3f& p) const {
+        return m_albedo * extinction(p);
+    }
+
+    /*
+    * Inverts the optical depth of march(): steps from x until it reaches
+    * -log(1 - rnd), and solves for the distance inside of the step where
+    * that happens (where the extinction is constant)
+    */
+    virtual void sampleBetween(float rnd, MediumIntersection& medIts) const {
+        Vector3f Z = medIts.xz - medIts.x;
+        float tmax = Z.norm();
+        Vector3f d = Z / std::max(tmax, FLT_MIN);
+
+        medIts.shFrame = Frame(Vector3f(1, 0, 0));
+        medIts.distZ = tmax;
+
+        float target = -std::log(1 - rnd);
+        float tau = 0.f;
+        bool scattered = false;
+        march(medIts.x, d, tmax,
+            [&](float t0, float t1, float mu_t) {
+                // Steps without density can't hold the sample (even if target is zero)
+                if (mu_t > 0 && tau + mu_t * (t1 - t0) >= target) {
+                    float t = std::min(t0 + (target - tau) / mu_t, t1);
+                    medIts.distT = t;
+                    medIts.xt = medIts.x + t * d;
+                    medIts.prob = mu_t * std::exp(-target);
+                    scattered = true;
+                    return false;
+                }
+                tau += mu_t * (t1 - t0);
+                return true;
+            });
+        if (scattered)
+            return;
+
+        // We didn't scatter: the probability of that is the transmittance
+        medIts.distT = FLT_MAX;
+        medIts.xt = medIts.xz;
+        medIts.prob = std::exp(-tau);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Heterogeneous[\n"
+            "  scale = %f,\n"
+            "  albedo = %s,\n"
+            "  density = %s,\n"
+            "  emissionScale = %f,\n"
+            "  emission = %s\n"
+            "]",
+            m_scale, m_albedo.toString(), indent(m_density ? m_density->toString() : std::string("null")),
+            m_emissionScale, indent(isEmissive() ? emissionSource()->toString() : std::string("null")));
+    }
+
+protected:
+    /// Number of ray marching steps whose densities are looked up at once
+    static const int LookupBatch = 32;
+
+    /// Upper limit of the cells of the emission distribution along each axis
+    static const int MaxEmissionResolution = 128;
+
+    /// Entries of the table of blackbody colors
+    static const int BlackbodyResolution = 1024;
+
+    /// Fraction of the samples of the emission spread evenly over its bounds
+    static constexpr float DefensiveEmission = 0.01f;
+
+    /// Distances from x of the part of the segment to xz that overlaps the density grid
+    bool clip(const Point3f& x, const Point3f& xz, float& start, float& end) const {
+        return clip(m_density->getBoundingBox(), x, xz, start, end);
+    }
+
+    /// Distances from x of the part of the segment to xz that is inside of \c bounds
+    static bool clip(const BoundingBox3f& bounds, const Point3f& x, const Point3f& xz, float& start, float& end) {
+        Vector3f Z = xz - x;
+        float length = Z.norm();
+        if (!(length > 0))
+            return false;
+        Ray3f ray(x, Z / length, 0.f, length);
+        float nearT, farT;
+        if (!bounds.rayIntersect(ray, nearT, farT))
+            return false;
+        start = std::max(nearT, 0.f);
+        end = std::min(farT, length);
+        return start < end;
+    }
+
+    const VolumeDataSource* emissionSource() const {
+        return m_temperature ? m_temperature : m_emission;
+    }
+
+    /*
+    * Cells of about the size of the voxels of the emission, clipped to the
+    * medium. The integral of the (trilinear) emission over a cell is the
+    * average of its corners; a small part of the samples is spread evenly,
+    * so cells that don't line up with the voxels can't miss any emission.
+    */
+    void buildEmission() {
+        const VolumeDataSource* source = emissionSource();
+        m_emissionBounds = source->getBoundingBox();
+        m_emissionBounds.min = m_emissionBounds.min.cwiseMax(m_bbox.min);
+        m_emissionBounds.max = m_emissionBounds.max.cwiseMin(m_bbox.max);
+        if (!m_emissionBounds.isValid())
+            throw NoriException("Heterogeneous: the emission is outside of the medium!");
+
+        Vector3f extents = m_emissionBounds.getExtents();
+        float cellSize = 2 * source->getStepSize();
+        for (int i = 0; i < 3; ++i)
+            m_emissionRes[i] = std::min(std::max((int) std::ceil(extents[i] / cellSize), 1), (int) MaxEmissionResolution);
+        m_emissionCell = extents.cwiseQuotient(m_emissionRes.cast<float>()).cwiseMax(Epsilon);
+
+        Vector3i corners = m_emissionRes + Vector3i(1, 1, 1);
+        std::vector<float> corner((size_t) corners.x() * corners.y() * corners.z());
+        tbb::parallel_for(tbb::blocked_range<int>(0, corners.z()),
+            [&](const tbb::blocked_range<int> &range) {
+                for (int z = range.begin(); z < range.end(); ++z)
+                    for (int y = 0; y < corners.y(); ++y)
+                        for (int x = 0; x < corners.x(); ++x) {
+                            Point3f p = m_emissionBounds.min + Vector3f(x, y, z).cwiseProduct(m_emissionCell);
+                            p = p.cwiseMin(m_emissionBounds.max);
+                            corner[((size_t) z * corners.y() + y) * corners.x() + x]
+                                = std::max(getEmission(p).getLuminance(), 0.f);
+                        }
+            }
+        );
+
+        size_t cellCount = (size_t) m_emissionRes.x() * m_emissionRes.y() * m_emissionRes.z();
+        std::vector<float> power(cellCount);
+        double total = 0;
+        for (int z = 0; z < m_emissionRes.z(); ++z)
+            for (int y = 0; y < m_emissionRes.y(); ++y)
+                for (int x = 0; x < m_emissionRes.x(); ++x) {
+                    float sum = 0.f;
+                    for (int k = 0; k < 8; ++k)
+                        sum += corner[((size_t) (z + (k >> 2)) * corners.y() + y + ((k >> 1) & 1)) * corners.x() + x + (k & 1)];
+                    power[((size_t) z * m_emissionRes.y() + y) * m_emissionRes.x() + x] = sum / 8;
+                    total += sum / 8;
+                }
+        if (!(total > 0)) {
+            cout << "Heterogeneous: the medium doesn't emit any light" << endl;
+            m_emissionTable = AliasTable();
+            return;
+        }
+        for (float& p : power)
+            p += (float) (DefensiveEmission * total / cellCount);
+        m_emissionTable = AliasTable(power.data(), (int) cellCount);
+    }
+
+    /*
+    * Calls step(t0, t1, mu_t) for the steps of the segment from x to
+    * x + length * d inside of the density grid, in order, until it returns
+    * false. Steps are the grid's step size long and start where the ray
+    * enters the grid; mu_t is the extinction in the middle of the whole
+    * step, also when the segment ends inside of it. A segment is therefore
+    * split like every longer one from x in the same direction, and all of
+    * them see the same extinction. The last step ends exactly at length
+    * unless the ray leaves the grid before.
+    */
+    template <typename Step>
+    void march(const Point3f& x, const Vector3f& d, float length, const Step& step) const {
+        float nearT, farT;
+        if (!(length >= 0) || !m_density->getBoundingBox().rayIntersect(Ray3f(x, d), nearT, farT))
+            return;
+        float start = std::max(nearT, 0.f), end = std::min(farT, length);
+        if (!(start <= end))
+            return;
+        float h = m_density->getStepSize();
+        int steps = std::max(1, (int) std::ceil((end - start) / h));
+        float density[LookupBatch];
+        for (int i0 = 0; i0 < steps; i0 += LookupBatch) {
+            int count = std::min((int) LookupBatch, steps - i0);
+            m_density->lookupFloatRay(x, d, start + (i0 + 0.5f) * h, h, density, count);
+            for (int i = 0; i < count; ++i) {
+                float t0 = start + (i0 + i) * h;
+                float t1 = std::min(t0 + h, end);
+                if (t1 < t0 || !step(t0, t1, m_scale * density[i]))
+                    return;
+            }
+        }
+    }
+
+    /// Integral of the step function of march() along the segment
+    float opticalDepth(const Point3f& x, const Point3f& xz) const {
+        Vector3f Z = xz - x;
+        float length = Z.norm();
+        if (!(length > 0))
+            return 0.f;
+        float tau = 0.f;
+        march(x, Z / length, length,
+            [&](float t0, float t1, float mu_t) {
+                tau += mu_t * (t1 - t0);
+                return true;
+            });
+        return tau;
+    }
+
+    VolumeDataSource* m_density = nullptr;
+    float m_scale;
+    Color3f m_albedo;
+    float m_maxExtinction = 0.f;
+
+    /* Emission (see getEmission()) */
+    VolumeDataSource* m_emission = nullptr;
+    VolumeDataSource* m_temperature = nullptr;
+    float m_emissionScale;
+    float m_temperatureScale;
+    /// Color of a blackbody at i * m_blackbodyStep Kelvin
+    std::vector<Color3f> m_blackbody;
+    float m_blackbodyStep = 1.f;
+    BoundingBox3f m_emissionBounds;
+    Vector3i m_emissionRes;
+    Vector3f m_emissionCell;
+    /// Power of the cells of the emission grid, x varies fastest
+    AliasTable m_emissionTable;
+};
+
+NORI_REGISTER_CLASS(Heterogeneous, "heterogeneous");
+NORI_NAMESPACE_END
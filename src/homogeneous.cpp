@@ -2,20 +2,66 @@
 */
 
 #include <nori/medium.h>
+#include <nori/mesh.h>
+#include <nori/pf.h>
 
 NORI_NAMESPACE_BEGIN
 
 /**
  * \brief Loader for Homogeneus
+ *
+ * The coefficients can be colors (or floats for gray media). Distances are
+ * sampled with the hero channel scheme described in Medium::sampleBetween.
+ *
+ * Dense media can set "approximateAfter" to end random walks after that
+ * many scattering events; the untraced orders are then estimated
+ * analytically (see activate()).
  */
 class Homogeneous : public Medium {
 public:
     Homogeneous(const PropertyList &propList) {
         // Here load other stuff:
-        mu_a = propList.getFloat("mu_a", 0.1f); //("radiance", Color3f(1.f));
-        mu_s = propList.getFloat("mu_s", 0.6f);
+        mu_a = propList.getColor("mu_a", Color3f(0.1f)); //("radiance", Color3f(1.f));
+        mu_s = propList.getColor("mu_s", Color3f(0.6f));
         mu_t = mu_s + mu_a;
-        std::cout << " Mu_t : " << mu_t <<"\n";
+        m_approximateAfter = propList.getInteger("approximateAfter", 0);
+    }
+
+    /*
+    * Estimates the multiple scattering gain with similarity theory: each
+    * scattering event keeps a fraction albedo = mu_s/mu_t of the energy, and
+    * a walk in a medium with anisotropy g diffuses like an isotropic one with
+    * the reduced extinction mu_t' = mu_a + mu_s(1-g). Such a walk needs about
+    * (mu_t' R)^2/2 reduced steps, i.e. 1/(1-g) times as many events, to escape
+    * a medium of radius R. Treating escape as a per-event probability, the
+    * energy left after each event is albedo_eff = albedo * N/(1+N), and
+    * all the orders after the last traced one add up to the geometric
+    * series albedo_eff/(1-albedo_eff) times its direct light.
+    */
+    void activate() {
+        Medium::activate();
+        if (m_approximateAfter <= 0)
+            return;
+
+        float g = m_pf->getMeanCosine();
+        Color3f mu_tr = mu_a + mu_s * (1 - g);
+        // Radius of the sphere inscribed in the bounds (unbounded without a mesh)
+        float radius = std::numeric_limits<float>::infinity();
+        if (m_mesh && m_mesh->getBoundingBox().isValid())
+            radius = 0.5f * m_mesh->getBoundingBox().getExtents().minCoeff();
+
+        for (int i = 0; i < 3; ++i) {
+            float albedo = mu_t[i] > 0 ? mu_s[i] / mu_t[i] : 0.f;
+            float steps = 0.5f * (mu_tr[i] * radius) * (mu_tr[i] * radius) / std::max(1 - g, Epsilon);
+            float albedoEff = std::isfinite(steps) ? albedo * steps / (1 + steps) : albedo;
+            // Conservative media without bounds would never lose any energy
+            albedoEff = std::min(albedoEff, 0.999f);
+            m_msGain[i] = albedoEff / (1 - albedoEff);
+        }
+    }
+
+    Color3f getMultipleScatteringGain() const {
+        return m_msGain;
     }
 
 
@@ -24,12 +70,19 @@ public:
     * This assumes the medium is actually between the 2 points you selected, if you pick a new 
     * random point without checking if it's on the bounding box of the medium or not, it will not work
     */
-    float Transmittance(Point3f x, Point3f xz) const {
-        float res = std::exp(-mu_t * (xz - x).norm());
+    Color3f Transmittance(Point3f x, Point3f xz) const {
+        Color3f res = (-mu_t * (xz - x).norm()).exp();
         return res;
     }
 
-    float getScatteringCoeficient() const{
+    float pdfBetween(const MediumIntersection& medIts, float t) const {
+        if (t >= medIts.distZ)
+            return 0.f;
+        // Average over the channels that could have been chosen
+        return (mu_t * (-mu_t * t).exp()).mean();
+    }
+
+    Color3f getScatteringCoeficient(const Point3f& p) const{
         return mu_s;
     }
 
@@ -46,12 +99,15 @@ public:
         // This frame will be different for heterogeneus media or media where the phase function has orientation.
         medIts.shFrame = Frame(Vector3f(1, 0, 0));
 
-        
-        float t = -log(rnd) / mu_t;
-        medIts.xt = x + t * Z.normalized(); //t*direction
-        if (mu_t <= 0.001) {
-            t = FLT_MAX;
+        // Choose the channel that drives the sampling and reuse the rest of rnd
+        int channel = std::min((int) (rnd * 3), 2);
+        rnd = std::max(rnd * 3 - channel, FLT_MIN);
+
+        float t = FLT_MAX;
+        if (mu_t[channel] > 0) {
+            t = -log(rnd) / mu_t[channel];
         }
+        medIts.xt = x + std::min(t, tmax) * Z.normalized(); //t*direction
         // Distance from x to xt:
         medIts.distT = t;
         // Distance from x to xz:
@@ -59,20 +115,21 @@ public:
         
         
         if (medIts.distT < tmax) { //We didn't hit the surface!
-            medIts.prob = mu_t * exp(-mu_t * t);
+            medIts.prob = pdfBetween(medIts, t);
         }
         else {
-            // We actually save the cdf
+            // We actually save the cdf (averaged over the channels)
             medIts.xt = xz;
-            medIts.prob = (Transmittance(x, medIts.xz));
+            medIts.prob = Transmittance(x, medIts.xz).mean();
         }
     }
 
 
 protected:
-    float mu_a;
-    float mu_s;
-    float mu_t;
+    Color3f mu_a;
+    Color3f mu_s;
+    Color3f mu_t;
+    Color3f m_msGain = Color3f(0.f);
 };
 
 NORI_REGISTER_CLASS(Homogeneous, "homogeneous");
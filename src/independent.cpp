@@ -44,17 +44,37 @@ public:
         std::unique_ptr<Independent> cloned(new Independent());
         cloned->m_sampleCount = m_sampleCount;
         cloned->m_seed = m_seed;
+        cloned->m_pass = m_pass;
         cloned->m_random = m_random;
         return std::move(cloned);
     }
 
     void prepare(const ImageBlock &block) {
+        /* Every pass uses its own stream (pass 0 matches a regular render) */
         m_random.seed(
             block.getOffset().x() + m_seed,
-            block.getOffset().y() + m_seed
+            (block.getOffset().y() + m_seed) ^ ((uint64_t) m_pass << 32)
         );
     }
 
+    void serialize(std::ostream &os) const {
+        Sampler::serialize(os);
+        os.write((const char *) &m_seed, sizeof(m_seed));
+        os.write((const char *) &m_random.state, sizeof(m_random.state));
+        os.write((const char *) &m_random.inc, sizeof(m_random.inc));
+    }
+
+    void unserialize(std::istream &is) {
+        Sampler::unserialize(is);
+        uint64_t seed;
+        is.read((char *) &seed, sizeof(seed));
+        if (is && seed != m_seed)
+            throw NoriException("Independent: the checkpoint was rendered with "
+                "a different seed (%i instead of %i)!", seed, m_seed);
+        is.read((char *) &m_random.state, sizeof(m_random.state));
+        is.read((char *) &m_random.inc, sizeof(m_random.inc));
+    }
+
     void generate() { /* No-op for this sampler */ }
     void advance()  { /* No-op for this sampler */ }
 
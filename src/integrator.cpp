@@ -0,0 +1,64 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+void Integrator::renderBlock(const Scene *scene, Sampler *sampler,
+        ImageBlock &block, uint32_t sampleCount, int stride) const {
+    const Camera *camera = scene->getCamera();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* For each pixel and pixel sample sample (the cost estimate
+       only looks at every stride-th pixel) */
+    for (int y=0; y<size.y(); y += stride) {
+        for (int x=0; x<size.x(); x += stride) {
+            for (uint32_t i=0; i<sampleCount; ++i) {
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                /* Compute the incident radiance */
+                value *= Li(scene, sampler, ray);
+
+                /* Store in the image block */
+                block.put(pixelSample, value);
+            }
+        }
+    }
+}
+
+void Integrator::splat(const Point2f &pos, const Color3f &value) const {
+    if (m_splatImage)
+        m_splatImage->splat(pos, value);
+    if (m_splatSecondary)
+        m_splatSecondary->splat(pos, value);
+}
+
+NORI_NAMESPACE_END
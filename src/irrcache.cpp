@@ -0,0 +1,128 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/irrcache.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/* Records don't descend beyond this depth, however small they are */
+static const int MaxOctreeDepth = 24;
+
+IrradianceCache::IrradianceCache() : m_nodes(1), m_center(0.f), m_halfSize(1.f), m_errorThreshold(0.2f) { }
+
+void IrradianceCache::clear(const BoundingBox3f &bounds, float errorThreshold) {
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, true);
+    m_records.clear();
+    m_nodes.assign(1, Node());
+    m_center = bounds.getCenter();
+    m_halfSize = std::max(0.5f * bounds.getExtents().maxCoeff(), Epsilon);
+    m_errorThreshold = errorThreshold;
+}
+
+bool IrradianceCache::lookup(const Point3f &p, const Normal3f &n, Color3f &E) const {
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+
+    struct Entry { uint32_t node; Point3f center; float halfSize; };
+    Entry stack[8 * MaxOctreeDepth + 1];
+    int stackSize = 0;
+    stack[stackSize++] = Entry { 0, m_center, m_halfSize };
+
+    Color3f sum(0.f);
+    float weightSum = 0.f;
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        const Node &node = m_nodes[entry.node];
+
+        for (uint32_t index : node.records) {
+            const Record &r = m_records[index];
+            Vector3f d = p - r.p;
+            float error = d.norm() / r.R + std::sqrt(std::max(0.f, 1.f - n.dot(r.n)));
+            if (error >= m_errorThreshold)
+                continue;
+            /* Skip records in front of p, they see different surroundings */
+            if (0.5f * d.dot(n + r.n) < -0.01f * r.R)
+                continue;
+
+            /* Weight that falls off smoothly to zero at the border of
+               the valid region (Tabellion and Lamorlette 2004) */
+            float weight = 1.f / std::max(error, 1e-4f) - 1.f / m_errorThreshold;
+            Vector3f rotation = r.n.cross(n);
+            Color3f extrapolated;
+            for (int c = 0; c < 3; ++c)
+                extrapolated[c] = r.E[c] + r.rotGrad[c].dot(rotation) + r.transGrad[c].dot(d);
+            sum += extrapolated.clamp() * weight;
+            weightSum += weight;
+        }
+
+        if (node.children == 0)
+            continue;
+        /* Visit all children whose enlarged cubes contain p */
+        float childHalf = 0.5f * entry.halfSize;
+        for (uint32_t i = 0; i < 8; ++i) {
+            Point3f center = entry.center + Vector3f(
+                (i & 1) ? childHalf : -childHalf,
+                (i & 2) ? childHalf : -childHalf,
+                (i & 4) ? childHalf : -childHalf);
+            if ((p - center).cwiseAbs().maxCoeff() <= 2.f * childHalf)
+                stack[stackSize++] = Entry { node.children + i, center, childHalf };
+        }
+    }
+
+    if (!(weightSum > 0))
+        return false;
+    E = sum / weightSum;
+    return true;
+}
+
+void IrradianceCache::insert(const Record &record) {
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, true);
+    float radius = m_errorThreshold * record.R;
+
+    uint32_t node = 0;
+    Point3f center = m_center;
+    float halfSize = m_halfSize;
+    for (int depth = 0; depth < MaxOctreeDepth && radius <= 0.5f * halfSize; ++depth) {
+        if (m_nodes[node].children == 0) {
+            m_nodes[node].children = (uint32_t) m_nodes.size();
+            m_nodes.resize(m_nodes.size() + 8);
+        }
+        halfSize *= 0.5f;
+        uint32_t i = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (record.p[axis] > center[axis]) {
+                i |= 1 << axis;
+                center[axis] += halfSize;
+            } else {
+                center[axis] -= halfSize;
+            }
+        }
+        node = m_nodes[node].children + i;
+    }
+
+    m_nodes[node].records.push_back((uint32_t) m_records.size());
+    m_records.push_back(record);
+}
+
+size_t IrradianceCache::size() const {
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+    return m_records.size();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,126 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/lightcache.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/medium.h>
+#include <pcg32.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Visibility times medium transmittance between p and a point sampled on an emitter */
+static Color3f shadowTransmittance(const Scene *scene, const Point3f &p, const EmitterQueryRecord &lRec) {
+    /* No sampler while building: grid media use their deterministic estimate */
+    return scene->transmittance(Ray3f(p, lRec.wi, Epsilon, lRec.dist - Epsilon), nullptr);
+}
+
+void VolumeLightCache::build(const Scene *scene, int resolution, int samplesPerLight) {
+    m_data.clear();
+    m_lights.clear();
+    if (scene->getMedia().empty())
+        return;
+
+    /* Environment emitters are infinitely far away; they aren't cached */
+    for (const Emitter *emitter : scene->getLights())
+        if (emitter != scene->getEnvironmentalEmitter())
+            m_lights.push_back(emitter);
+    if (m_lights.empty())
+        return;
+
+    m_bounds.reset();
+    for (const Medium *medium : scene->getMedia()) {
+        /* Media without bounds fill the whole scene */
+        if (!medium->getBoundingBox().isValid()) {
+            m_bounds = scene->getBoundingBox();
+            break;
+        }
+        m_bounds.expandBy(medium->getBoundingBox());
+    }
+    Vector3f extents = m_bounds.getExtents();
+    float spacing = std::max(extents.maxCoeff(), Epsilon) / std::max(resolution - 1, 1);
+    for (int i = 0; i < 3; ++i) {
+        m_res[i] = std::max(2, (int) std::ceil(extents[i] / spacing) + 1);
+        m_cellSize[i] = std::max(extents[i], Epsilon) / (m_res[i] - 1);
+    }
+
+    size_t vertexCount = (size_t) m_res.x() * m_res.y() * m_res.z();
+    m_data.resize(vertexCount * m_lights.size());
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_res.z()),
+        [&](const tbb::blocked_range<int> &range) {
+            for (int z = range.begin(); z < range.end(); ++z) {
+                for (int y = 0; y < m_res.y(); ++y) {
+                    for (int x = 0; x < m_res.x(); ++x) {
+                        size_t vertex = ((size_t) z * m_res.y() + y) * m_res.x() + x;
+                        Point3f p = m_bounds.min + Vector3f(x, y, z).cwiseProduct(m_cellSize);
+                        pcg32 random(PCG32_DEFAULT_STATE, vertex);
+
+                        for (size_t light = 0; light < m_lights.size(); ++light) {
+                            Color3f T(0.f);
+                            for (int s = 0; s < samplesPerLight; ++s) {
+                                EmitterQueryRecord lRec(p);
+                                Point2f sample(random.nextFloat(), random.nextFloat());
+                                if (m_lights[light]->sample(lRec, sample, 0.f).maxCoeff() > 0)
+                                    T += shadowTransmittance(scene, p, lRec);
+                            }
+                            m_data[light * vertexCount + vertex] = T / (float) samplesPerLight;
+                        }
+                    }
+                }
+            }
+        }
+    );
+}
+
+bool VolumeLightCache::lookup(const Point3f &p, const Emitter *emitter, Color3f &T) const {
+    if (m_data.empty() || !m_bounds.contains(p))
+        return false;
+    size_t light = std::find(m_lights.begin(), m_lights.end(), emitter) - m_lights.begin();
+    if (light == m_lights.size())
+        return false;
+
+    /* Cell and position inside of it */
+    Vector3f pos = (p - m_bounds.min).cwiseQuotient(m_cellSize);
+    int i[3];
+    float f[3];
+    for (int k = 0; k < 3; ++k) {
+        i[k] = std::min(std::max((int) pos[k], 0), m_res[k] - 2);
+        f[k] = std::min(std::max(pos[k] - i[k], 0.f), 1.f);
+    }
+
+    size_t vertexCount = (size_t) m_res.x() * m_res.y() * m_res.z();
+    const Color3f *grid = &m_data[light * vertexCount];
+    auto at = [&](int x, int y, int z) {
+        return grid[((size_t) z * m_res.y() + y) * m_res.x() + x];
+    };
+
+    Color3f c00 = at(i[0], i[1], i[2]) * (1 - f[0]) + at(i[0] + 1, i[1], i[2]) * f[0];
+    Color3f c10 = at(i[0], i[1] + 1, i[2]) * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2]) * f[0];
+    Color3f c01 = at(i[0], i[1], i[2] + 1) * (1 - f[0]) + at(i[0] + 1, i[1], i[2] + 1) * f[0];
+    Color3f c11 = at(i[0], i[1] + 1, i[2] + 1) * (1 - f[0]) + at(i[0] + 1, i[1] + 1, i[2] + 1) * f[0];
+    Color3f c0 = c00 * (1 - f[1]) + c10 * f[1];
+    Color3f c1 = c01 * (1 - f[1]) + c11 * f[1];
+    T = c0 * (1 - f[2]) + c1 * f[2];
+    return true;
+}
+
+NORI_NAMESPACE_END
@@ -25,45 +25,190 @@
 #include <nori/sampler.h>
 #include <nori/integrator.h>
 #include <nori/gui.h>
+#include <nori/checkpoint.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/task_scheduler_init.h>
 #include <filesystem/resolver.h>
 #include <thread>
+#include <fstream>
+#include <atomic>
 
 using namespace nori;
 
 static int threadCount = -1;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
+/* Progressive rendering options (see \ref render()) */
+static bool progressive = false;
+static uint32_t passSampleCount = 1;
+static double timeBudget = 0.0;      /* in seconds, 0 = unlimited */
+static float noiseThreshold = 0.0f;  /* 0 = disabled */
+static double flushInterval = 60.0;  /* in seconds */
+static BlockGenerator::EOrder blockOrder = BlockGenerator::ESpiral;
+static double checkpointInterval = 0.0; /* in seconds, 0 = no checkpoints */
+static bool resume = false;
+
+/* Cost-aware scheduling options */
+static bool costPrepass = false;
+static std::string tileStatsName;
+
+static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+        uint32_t sampleCount, int stride = 1) {
     /* Clear the block contents */
     block.clear();
 
-    /* For each pixel and pixel sample sample */
+    scene->getIntegrator()->renderBlock(scene, sampler, block, sampleCount, stride);
+}
+
+/**
+ * \brief Estimate the remaining noise of a progressive render
+ *
+ * Compares the image made of all passes against the image made of the odd
+ * passes only (following Dammertz et al., "A Hierarchical Automatic
+ * Stopping Condition for Monte Carlo Global Illumination"). The per-pixel
+ * difference between the two halves is normalized by the square root of
+ * the pixel intensity, which roughly matches the perceived noise level.
+ */
+static float estimateNoise(const ImageBlock &all, const ImageBlock &odd) {
+    int border = all.getBorderSize();
+    Vector2i size = all.getSize();
+    double error = 0.0;
+    int count = 0;
+
     for (int y=0; y<size.y(); ++y) {
         for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+            const Color4f &a = all.coeff(y + border, x + border);
+            const Color4f &o = odd.coeff(y + border, x + border);
+            Color4f e = a - o;
+            if (o.w() <= 0 || e.w() <= 0)
+                continue;
+
+            Color3f mean = a.divideByFilterWeight();
+            Color3f diff = (o.divideByFilterWeight() - e.divideByFilterWeight()).abs();
+            error += diff.sum() / std::sqrt(mean.sum() + 1e-4f);
+            ++count;
+        }
+    }
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+    return count > 0 ? (float) (error / count) : std::numeric_limits<float>::infinity();
+}
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+/**
+ * \brief Estimate the rendering cost of every block
+ *
+ * Renders one sample for every 4th pixel along each axis and records the
+ * time spent per block (in milliseconds). The result is discarded.
+ */
+static std::vector<float> estimateTileCosts(const Scene *scene, const BlockGenerator &blockGenerator) {
+    const Camera *camera = scene->getCamera();
+    std::vector<float> costs(blockGenerator.getBlockCount());
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
+    tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+        [&](const tbb::blocked_range<int> &range) {
+            ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+            sampler->setPass(std::numeric_limits<uint32_t>::max());
+
+            for (int i = range.begin(); i < range.end(); ++i) {
+                Point2i offset;
+                Vector2i size;
+                blockGenerator.getBlock(i, offset, size);
+                block.setOffset(offset);
+                block.setSize(size);
+
+                Timer timer;
+                sampler->prepare(block);
+                renderBlock(scene, sampler.get(), block, 1, 4);
+                costs[i] = (float) timer.elapsed();
             }
         }
+    );
+
+    return costs;
+}
+
+/**
+ * \brief Decide into how many sub-tiles (per axis) each block is split
+ *
+ * Blocks that are much more expensive than the average one are split
+ * so that each sub-tile costs roughly as much as an average block.
+ * Sub-tiles are at least 8x8 pixels large.
+ */
+static std::vector<int> computeTileSplits(const std::vector<float> &costs) {
+    std::vector<int> splits(costs.size(), 1);
+    if (costs.empty())
+        return splits;
+
+    double mean = 0.0;
+    for (float cost : costs)
+        mean += cost;
+    mean /= costs.size();
+
+    for (size_t i = 0; i < costs.size(); ++i) {
+        float ratio = mean > 0 ? (float) (costs[i] / mean) : 1.0f;
+        if (ratio > 16.0f)
+            splits[i] = 4;
+        else if (ratio > 2.0f)
+            splits[i] = 2;
+    }
+    return splits;
+}
+
+/// Print a summary of the per-tile timings and optionally write them to a CSV file
+static void reportTileTimings(const BlockGenerator &blockGenerator, const std::vector<double> &tileTimes,
+        const std::vector<int> &tileSplits, const std::vector<float> &tileCosts, double tail, double total) {
+    std::vector<double> sorted(tileTimes);
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted.empty())
+        return;
+
+    double sum = 0.0;
+    for (double time : sorted)
+        sum += time;
+    auto percentile = [&](float p) { return sorted[std::min(sorted.size() - 1, (size_t) (p * sorted.size()))]; };
+
+    int splitCount = 0;
+    for (int split : tileSplits)
+        splitCount += split > 1 ? 1 : 0;
+
+    cout << "Tile timings: " << sorted.size() << " tiles (" << splitCount << " split), mean "
+         << timeString(sum / sorted.size(), true) << ", median " << timeString(percentile(0.5f), true)
+         << ", p99 " << timeString(percentile(0.99f), true) << ", max "
+         << timeString(sorted.back(), true) << endl;
+    cout << "Tail (threads idling while the last tiles finish): " << timeString(tail)
+         << tfm::format(" (%.1f%% of the rendering time)", 100.0 * tail / std::max(total, 1e-3)) << endl;
+
+    if (tileStatsName.empty())
+        return;
+
+    std::ofstream os(tileStatsName);
+    os << "x,y,width,height,splits,estimated_ms,time_ms" << std::endl;
+    for (size_t i = 0; i < tileTimes.size(); ++i) {
+        Point2i offset;
+        Vector2i size;
+        blockGenerator.getBlock((int) i, offset, size);
+        os << offset.x() << "," << offset.y() << "," << size.x() << "," << size.y() << ","
+           << (tileSplits.empty() ? 1 : tileSplits[i]) << ","
+           << (tileCosts.empty() ? 0.0f : tileCosts[i]) << "," << tileTimes[i] << std::endl;
     }
+    cout << "Per-tile timings written to \"" << tileStatsName << "\"" << endl;
+}
+
+/// Parse a duration such as "300", "300s", "5m" or "2h" into seconds (-1 on failure)
+static double parseDuration(const std::string &str) {
+    char *end = nullptr;
+    double value = std::strtod(str.c_str(), &end);
+    if (end == str.c_str() || value < 0)
+        return -1.0;
+
+    std::string unit(end);
+    if (unit == "" || unit == "s")
+        return value;
+    else if (unit == "m" || unit == "min")
+        return value * 60.0;
+    else if (unit == "h")
+        return value * 3600.0;
+    return -1.0;
 }
 
 static void render(Scene* scene, const std::string& filename, bool nogui) {
@@ -71,13 +216,49 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
     Vector2i outputSize = camera->getOutputSize();
     scene->getIntegrator()->preprocess(scene);
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Determine the filename of the output bitmap */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
 
     /* Allocate memory for the entire output image and clear it */
     ImageBlock result(outputSize, camera->getReconstructionFilter());
     result.clear();
 
+    /* When a noise threshold is given, the odd passes are additionally
+       accumulated into a second image that is used to estimate the error.
+       Checkpoints always include it, so that a resumed render can still
+       use the noise threshold */
+    bool checkpointing = checkpointInterval > 0 || resume;
+    std::unique_ptr<ImageBlock> oddPasses;
+    if (progressive && (noiseThreshold > 0 || checkpointing)) {
+        oddPasses.reset(new ImageBlock(outputSize, camera->getReconstructionFilter()));
+        oddPasses->clear();
+    }
+
+    /* Number of samples taken per pixel */
+    Checkpoint::SampleCounts sampleCounts(outputSize.y(), outputSize.x());
+    sampleCounts.setZero();
+
+    /* Continue an interrupted render if requested */
+    std::string checkpointName = outputName + ".nchk";
+    std::vector<float> tileCosts;
+    bool resumed = false;
+    Checkpoint checkpoint(result, oddPasses.get(), sampleCounts, scene->getSampler());
+    checkpoint.setTileCosts(&tileCosts);
+    if (resume) {
+        if (std::ifstream(checkpointName).good()) {
+            checkpoint.load(checkpointName);
+            resumed = true;
+            cout << "Resuming from \"" << checkpointName << "\" after pass "
+                 << checkpoint.getPassCount() << " (" << checkpoint.getSamplesTaken()
+                 << " spp)" << endl;
+        } else {
+            cout << "No checkpoint \"" << checkpointName << "\" found, starting from scratch." << endl;
+        }
+    }
+
     /* Create a window that visualizes the partially rendered result */
     NoriScreen* screen = 0;
     if (!nogui)
@@ -92,42 +273,209 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
 
         cout << "Rendering .. ";
         cout.flush();
-        Timer timer;
-
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
-
-        auto map = [&](const tbb::blocked_range<int>& range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
-
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+        Timer timer, flushTimer, checkpointTimer;
+        double previousTime = checkpoint.getElapsed();
+
+        /* Without progressive mode, all samples are taken in a single pass. A
+           time budget makes the number of passes unbounded, otherwise the
+           sample count of the sampler is the upper limit */
+        uint32_t sampleCount = (uint32_t) scene->getSampler()->getSampleCount();
+        uint32_t samplesPerPass = progressive ? passSampleCount : sampleCount;
+        uint32_t samplesTaken = checkpoint.getSamplesTaken();
+        double lastPassTime = 0.0;
+
+        /* Create a block generator (i.e. a work scheduler) */
+        BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE, blockOrder);
+
+        /* Cost-aware scheduling: estimate the cost of every block with a
+           quick pre-pass, render expensive blocks first, and split them into
+           sub-tiles that idle threads can steal. A resumed render reuses the
+           estimate of the original run, which keeps the sub-tiles (and thus
+           the random number streams) the same. */
+        if (costPrepass && !resumed) {
+            Timer prepassTimer;
+            tileCosts = estimateTileCosts(scene, blockGenerator);
+            cout << "cost estimate took " << prepassTimer.elapsedString() << " .. ";
+            cout.flush();
+        }
+        std::vector<int> tileSplits;
+        if (!tileCosts.empty()) {
+            blockGenerator.sortByCost(tileCosts);
+            tileSplits = computeTileSplits(tileCosts);
+        }
 
-            for (int i = range.begin(); i < range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
+        /* Per-tile timings (summed over all passes) */
+        std::vector<double> tileTimes(blockGenerator.getBlockCount(), 0.0);
+        double tailTime = 0.0, renderTime = 0.0;
 
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
+        for (uint32_t pass = checkpoint.getPassCount(); ; ++pass) {
+            uint32_t passSamples = samplesPerPass;
+            if (timeBudget <= 0) {
+                if (samplesTaken >= sampleCount)
+                    break;
+                passSamples = std::min(passSamples, sampleCount - samplesTaken);
+            }
 
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+            blockGenerator.reset();
+            ImageBlock *oddBlock = (pass % 2 == 1) ? oddPasses.get() : nullptr;
+            scene->getIntegrator()->setSplatTargets(&result, oddBlock);
+
+            tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+
+            /* Latest time (in microseconds since the start of the pass) at
+               which a tile or sub-tile was started. Afterwards, there is no
+               more work to distribute and threads start idling. */
+            Timer passTimer;
+            std::atomic<int64_t> lastStart(0);
+            auto markStart = [&]() {
+                int64_t now = (int64_t) (passTimer.elapsed() * 1000.0), prev = lastStart;
+                while (now > prev && !lastStart.compare_exchange_weak(prev, now))
+                    ;
+            };
+
+            /* Add a rendered block to the output */
+            auto merge = [&](ImageBlock &block) {
+                /* Blocks never overlap without their borders */
+                sampleCounts.block(block.getOffset().y(), block.getOffset().x(),
+                    block.getSize().y(), block.getSize().x()) += passSamples;
 
                 /* The image block has been processed. Now add it to
                    the "big" block that represents the entire image */
                 result.put(block);
+                if (oddBlock)
+                    oddBlock->put(block);
+            };
+
+            auto map = [&](const tbb::blocked_range<int>& range) {
+                /* Allocate memory for a small image block to be rendered
+                   by the current thread */
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+                    camera->getReconstructionFilter());
+
+                /* Create a clone of the sampler for the current thread */
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                sampler->setPass(pass);
+
+                for (int i = range.begin(); i < range.end(); ++i) {
+                    /* Request an image block from the block generator */
+                    int index;
+                    blockGenerator.next(block, index);
+                    int splits = tileSplits.empty() ? 1 : tileSplits[index];
+
+                    if (splits == 1) {
+                        markStart();
+                        Timer tileTimer;
+
+                        /* Inform the sampler about the block to be rendered */
+                        sampler->prepare(block);
+
+                        /* Render all contained pixels */
+                        renderBlock(scene, sampler.get(), block, passSamples);
+
+                        merge(block);
+                        tileTimes[index] += tileTimer.elapsed();
+                        continue;
+                    }
+
+                    /* Expensive block: render its sub-tiles as separate tasks,
+                       so that idle threads can steal them */
+                    int subSize = NORI_BLOCK_SIZE / splits;
+                    std::vector<double> subTimes(splits * splits, 0.0);
+                    Point2i offset = block.getOffset();
+                    Vector2i size = block.getSize();
+
+                    tbb::parallel_for(tbb::blocked_range<int>(0, splits * splits, 1),
+                        [&](const tbb::blocked_range<int> &subRange) {
+                            ImageBlock subBlock(Vector2i(subSize), camera->getReconstructionFilter());
+                            std::unique_ptr<Sampler> subSampler(scene->getSampler()->clone());
+                            subSampler->setPass(pass);
+
+                            for (int j = subRange.begin(); j < subRange.end(); ++j) {
+                                Vector2i subOffset = Vector2i(j % splits, j / splits) * subSize;
+                                if ((subOffset.array() >= size.array()).any())
+                                    continue;
+
+                                markStart();
+                                Timer tileTimer;
+                                subBlock.setOffset(offset + subOffset);
+                                subBlock.setSize((size - subOffset).cwiseMin(Vector2i::Constant(subSize)));
+                                subSampler->prepare(subBlock);
+                                renderBlock(scene, subSampler.get(), subBlock, passSamples);
+                                merge(subBlock);
+                                subTimes[j] = tileTimer.elapsed();
+                            }
+                        }
+                    );
+
+                    for (double time : subTimes)
+                        tileTimes[index] += time;
+                }
+            };
+
+            /// Default: parallel rendering
+            tbb::parallel_for(range, map);
+            double passTime = passTimer.elapsed();
+            lastPassTime = passTime / 1000.0;
+            renderTime += passTime;
+            tailTime += std::max(0.0, passTime - lastStart / 1000.0);
+
+            /// (equivalent to the following single-threaded call)
+            // map(range);
+
+            samplesTaken += passSamples;
+            if (!progressive)
+                break;
+
+            /* Check the stopping criteria */
+            double elapsed = previousTime + timer.elapsed() / 1000.0;
+            float noise = oddPasses && pass > 0 ? estimateNoise(result, *oddPasses) : -1.0f;
+
+            cout << endl << "Pass " << pass + 1 << ": " << samplesTaken << " spp";
+            if (noise >= 0)
+                cout << ", noise " << noise;
+            cout << " (" << timeString(elapsed * 1000.0) << ")";
+            cout.flush();
+
+            bool done = false;
+            if (timeBudget > 0) {
+                /* Don't start another pass that would overrun the budget */
+                done = elapsed + lastPassTime > timeBudget;
+            } else {
+                done = samplesTaken >= sampleCount;
+            }
+            if (noise >= 0 && noise < noiseThreshold)
+                done = true;
+            if (done)
+                break;
+
+            /* Periodically write the intermediate result to disk */
+            if (flushInterval > 0 && flushTimer.elapsed() / 1000.0 >= flushInterval) {
+                result.lock();
+                std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+                result.unlock();
+                bitmap->saveEXR(outputName);
+                flushTimer.reset();
             }
-        };
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+            /* Periodically save a checkpoint that allows resuming the render */
+            if (checkpointInterval > 0 && checkpointTimer.elapsed() / 1000.0 >= checkpointInterval) {
+                scene->getSampler()->setPass(pass + 1);
+                checkpoint.setProgress(pass + 1, samplesTaken, elapsed);
+                try {
+                    checkpoint.save(checkpointName);
+                } catch (const std::exception &e) {
+                    cerr << endl << "Warning: " << e.what() << endl;
+                }
+                checkpointTimer.reset();
+            }
+        }
 
-        /// (equivalent to the following single-threaded call)
-        // map(range);
+        if (progressive)
+            cout << endl << "Rendering .. ";
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << samplesTaken << " spp)" << endl;
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        reportTileTimings(blockGenerator, tileTimes, tileSplits, tileCosts, tailTime, renderTime);
     });
 
     if (!nogui)
@@ -150,12 +498,6 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
        a properly normalized bitmap */
     std::unique_ptr<Bitmap> bitmap(result.toBitmap());
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
-
     /* Save using the OpenEXR format */
     bitmap->saveEXR(outputName);
 
@@ -165,7 +507,19 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [options]" << endl
+             << "  -t, --threads <n>   Number of rendering threads" << endl
+             << "  -b, --nogui         Render without opening a window" << endl
+             << "  --block-order <o>   Block order: spiral (default), hilbert or morton" << endl
+             << "  --cost-prepass      Estimate tile costs first; split expensive tiles" << endl
+             << "  --tile-stats <csv>  Write per-tile timings to a CSV file" << endl
+             << "  -p, --progressive   Render in passes over the whole image" << endl
+             << "  --pass-spp <n>      Samples per pixel and pass (default: 1)" << endl
+             << "  --time <duration>   Stop after the given time budget (e.g. 300s)" << endl
+             << "  --noise <value>     Stop once the estimated noise falls below this value" << endl
+             << "  --flush <duration>  Interval for writing intermediate EXRs (default: 60s)" << endl
+             << "  --checkpoint <duration>  Interval for writing <scene>.nchk checkpoints" << endl
+             << "  --resume            Continue from <scene>.nchk if it exists" << endl;
         return -1;
     }
 
@@ -190,6 +544,79 @@ int main(int argc, char **argv) {
         }
         else if(token == "--nogui" || token == "-b")
             nogui = true;
+        else if (token == "-p" || token == "--progressive")
+            progressive = true;
+        else if (token == "--pass-spp") {
+            int value = i+1 < argc ? atoi(argv[i+1]) : 0;
+            if (value <= 0) {
+                cerr << "\"--pass-spp\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+            passSampleCount = (uint32_t) value;
+            progressive = true;
+            i++;
+        }
+        else if (token == "--time" || token == "--flush") {
+            double value = i+1 < argc ? parseDuration(argv[i+1]) : -1.0;
+            if (value < 0) {
+                cerr << "\"" << token << "\" argument expects a duration (e.g. 300s, 5m, 1h) following it." << endl;
+                return -1;
+            }
+            if (token == "--time") {
+                timeBudget = value;
+                progressive = true;
+            } else {
+                flushInterval = value;
+            }
+            i++;
+        }
+        else if (token == "--block-order") {
+            if (i+1 >= argc) {
+                cerr << "\"--block-order\" argument expects spiral, hilbert or morton following it." << endl;
+                return -1;
+            }
+            try {
+                blockOrder = BlockGenerator::parseOrder(argv[i+1]);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                return -1;
+            }
+            i++;
+        }
+        else if (token == "--cost-prepass")
+            costPrepass = true;
+        else if (token == "--tile-stats") {
+            if (i+1 >= argc) {
+                cerr << "\"--tile-stats\" argument expects a filename following it." << endl;
+                return -1;
+            }
+            tileStatsName = argv[i+1];
+            i++;
+        }
+        else if (token == "--checkpoint") {
+            double value = i+1 < argc ? parseDuration(argv[i+1]) : -1.0;
+            if (value <= 0) {
+                cerr << "\"--checkpoint\" argument expects a duration (e.g. 300s, 5m, 1h) following it." << endl;
+                return -1;
+            }
+            checkpointInterval = value;
+            progressive = true;
+            i++;
+        }
+        else if (token == "--resume") {
+            resume = true;
+            progressive = true;
+        }
+        else if (token == "--noise") {
+            float value = i+1 < argc ? (float) atof(argv[i+1]) : 0.0f;
+            if (value <= 0) {
+                cerr << "\"--noise\" argument expects a positive number following it." << endl;
+                return -1;
+            }
+            noiseThreshold = value;
+            progressive = true;
+            i++;
+        }
         else
         {
             filesystem::path path(argv[i]);
@@ -5,6 +5,7 @@
 #include <nori/bbox.h>
 #include <nori/pf.h>
 #include <nori/warp.h>
+#include <nori/emitter.h>
 #include <Eigen/Geometry>
 
 // I have doubts of:
@@ -17,6 +18,7 @@ Medium::Medium() { }
 
 Medium::~Medium() {
     delete m_pf;
+    delete m_emitter;
 }
 
 void Medium::activate() {
@@ -25,6 +27,8 @@ void Medium::activate() {
         m_pf = static_cast<PhaseFunction*>(
             NoriObjectFactory::createInstance("pf_fog", PropertyList()));
     }
+    if (m_mesh)
+        m_bbox = m_mesh->getBoundingBox();
 }
 
 void Medium::sampleBetween(float rnd, MediumIntersection& medIts) const {
@@ -34,6 +38,58 @@ void Medium::sampleBetween(float rnd, MediumIntersection& medIts) const {
 }
 
 
+float Medium::pdfBetween(const MediumIntersection& medIts, float t) const {
+    throw NoriException(
+        "Medium: pdfBetween not defined for parent class!");
+}
+
+/* The angles under which the segment ends are seen from the center, with
+   the foot of the perpendicular at distance delta along the segment */
+static void equiangularSetup(const Point3f& center, const MediumIntersection& medIts,
+        Vector3f& d, float& delta, float& D, float& thetaA, float& thetaB) {
+    d = medIts.xz - medIts.x;
+    float tmax = d.norm();
+    if (!(tmax > 0)) {
+        delta = D = thetaA = thetaB = 0.f;
+        return;
+    }
+    d /= tmax;
+    delta = (center - medIts.x).dot(d);
+    D = std::max((center - (medIts.x + delta * d)).norm(), Epsilon);
+    thetaA = std::atan2(-delta, D);
+    thetaB = std::atan2(tmax - delta, D);
+}
+
+void Medium::sampleEquiangular(float rnd, const Point3f& center, MediumIntersection& medIts) {
+    Vector3f d;
+    float delta, D, thetaA, thetaB;
+    equiangularSetup(center, medIts, d, delta, D, thetaA, thetaB);
+
+    medIts.distZ = (medIts.xz - medIts.x).norm();
+    if (!(thetaB > thetaA)) {
+        /* Empty segment */
+        medIts.distT = medIts.distZ;
+        medIts.xt = medIts.xz;
+        medIts.prob = 0.f;
+        return;
+    }
+
+    float theta = thetaA + rnd * (thetaB - thetaA);
+    float t = std::min(std::max(delta + D * std::tan(theta), 0.f), medIts.distZ);
+    medIts.distT = t;
+    medIts.xt = medIts.x + t * d;
+    medIts.prob = D / ((thetaB - thetaA) * (D * D + (t - delta) * (t - delta)));
+}
+
+float Medium::pdfEquiangular(const Point3f& center, const MediumIntersection& medIts, float t) {
+    Vector3f d;
+    float delta, D, thetaA, thetaB;
+    equiangularSetup(center, medIts, d, delta, D, thetaA, thetaB);
+    if (t < 0 || t > (medIts.xz - medIts.x).norm() || !(thetaB > thetaA))
+        return 0.f;
+    return D / ((thetaB - thetaA) * (D * D + (t - delta) * (t - delta)));
+}
+
 void Medium::addChild(NoriObject *obj, const std::string& name) {
     switch (obj->getClassType()) {
         case EPhaseFunction: {
@@ -52,6 +108,13 @@ void Medium::addChild(NoriObject *obj, const std::string& name) {
             std::cout << " Mesh Aded as child to the Medium \n";
             break;
         }
+        case EEmitter: {
+            if (m_emitter)
+                throw NoriException(
+                    "Medium: tried to register multiple Emitter instances!");
+            m_emitter = static_cast<Emitter*>(obj);
+            break;
+        }
                   
         default:
             throw NoriException("Medium::addChild(<%s>) is not supported!",
@@ -44,68 +44,54 @@ public:
 
     /// Evaluate the BRDF for the given pair of directions
     Color3f eval(const BSDFQueryRecord& bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-        is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return Color3f(0.0f);
-
-        Vector3f wh = (bRec.wi + bRec.wo);
-        wh.normalize();
-
-        float alpha = m_alpha->eval(bRec.uv).mean();
-        float cosThetaI = Frame::cosTheta(bRec.wi);
-        float cosThetaO = Frame::cosTheta(bRec.wo);
-
-        float D = Reflectance::BeckmannNDF(wh, alpha);
-        Color3f F = Reflectance::fresnel(cosThetaI, m_R0->eval(bRec.uv));
-        float G = Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha);
-
-        return D * F * G / (4 * cosThetaI * cosThetaO);
+        return evalBRDF(bRec, m_alpha->eval(bRec.uv).mean(), m_R0->eval(bRec.uv));
     }
 
     /// Evaluate the sampling density of \ref sample() wrt. solid angles
     float pdf(const BSDFQueryRecord& bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-        is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return 0.0f;
-
-        float alpha = m_alpha->eval(bRec.uv).mean();
-        Vector3f wh = (bRec.wi + bRec.wo).normalized();
-        return Warp::squareToBeckmannPdf(wh, alpha); //
+        return pdfBRDF(bRec, m_alpha->eval(bRec.uv).mean());
     }
 
     /// Sample the BRDF
     Color3f sample(BSDFQueryRecord& bRec, const Point2f& _sample) const {
-        // Note: Once you have implemented the part that computes the scattered
-        // direction, the last part of this function should simply return the
-        // BRDF value divided by the solid angle density and multiplied by the
-        // cosine factor from the reflection equation, i.e.
-        // return eval(bRec) * Frame::cosTheta(bRec.wo) / pdf(bRec);
-        if (Frame::cosTheta(bRec.wi) <= 0)
-            return Color3f(0.0f);
-
         // float alpha = m_alpha->eval(bRec.uv).getLuminance();
-        float alpha = m_alpha->eval(bRec.uv).mean();
-        bRec.measure = ESolidAngle;
+        return sampleBRDF(bRec, _sample, m_alpha->eval(bRec.uv).mean(), m_R0->eval(bRec.uv));
+    }
 
-        // Sampling wh and getting wo from it.
-        Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
-        // Calculate wo with equation from https://math.stackexchange.com/questions/13261/how-to-get-a-reflection-vector
-        bRec.wo = (-bRec.wi + 2 * bRec.wi.dot(wh) * wh);
-        bRec.wo.normalize();
+    /// Sample the BRDF for a span of query records
+    void sampleBatch(BSDFQueryRecord* bRecs, const Point2f* samples,
+        Color3f* result, size_t count) const {
+        Color3f alpha[NORI_SHADING_CHUNK];
+        for (size_t begin = 0; begin < count; begin += NORI_SHADING_CHUNK) {
+            size_t n = std::min(count - begin, (size_t) NORI_SHADING_CHUNK);
+            evalTexture(m_alpha, bRecs + begin, alpha, n);
+            evalTexture(m_R0, bRecs + begin, result + begin, n);
+            for (size_t i = 0; i < n; ++i)
+                result[begin + i] = sampleBRDF(bRecs[begin + i], samples[begin + i],
+                    alpha[i].mean(), result[begin + i]);
+        }
+    }
 
-        // Return the value 
-        float pdf_sample = pdf(bRec);
-        if (pdf_sample < FLT_EPSILON) {
-            return Color3f(0.0f);
+    /// Evaluate the BRDF for a span of query records
+    void evalBatch(const BSDFQueryRecord* bRecs, Color3f* result, size_t count) const {
+        Color3f alpha[NORI_SHADING_CHUNK];
+        for (size_t begin = 0; begin < count; begin += NORI_SHADING_CHUNK) {
+            size_t n = std::min(count - begin, (size_t) NORI_SHADING_CHUNK);
+            evalTexture(m_alpha, bRecs + begin, alpha, n);
+            evalTexture(m_R0, bRecs + begin, result + begin, n);
+            for (size_t i = 0; i < n; ++i)
+                result[begin + i] = evalBRDF(bRecs[begin + i], alpha[i].mean(), result[begin + i]);
         }
-        else {
-            return eval(bRec) * Frame::cosTheta(bRec.wo) / (pdf_sample);
+    }
+
+    /// Evaluate the sampling density for a span of query records
+    void pdfBatch(const BSDFQueryRecord* bRecs, float* result, size_t count) const {
+        Color3f alpha[NORI_SHADING_CHUNK];
+        for (size_t begin = 0; begin < count; begin += NORI_SHADING_CHUNK) {
+            size_t n = std::min(count - begin, (size_t) NORI_SHADING_CHUNK);
+            evalTexture(m_alpha, bRecs + begin, alpha, n);
+            for (size_t i = 0; i < n; ++i)
+                result[begin + i] = pdfBRDF(bRecs[begin + i], alpha[i].mean());
         }
     }
 
@@ -116,6 +102,10 @@ public:
         return true;
     }
 
+    float getRoughness(const Point2f& uv) const {
+        return std::min(1.0f, m_alpha->eval(uv).mean());
+    }
+
     /*
     *  \brief Checks if the bsdf has a displacement map.
     * This displacement map is used for bump mapping
@@ -181,6 +171,64 @@ public:
         );
     }
 private:
+    /// Evaluate the BRDF once the textures have been looked up
+    static Color3f evalBRDF(const BSDFQueryRecord& bRec, float alpha, const Color3f& R0) {
+        /* This is a smooth BRDF -- return zero if the measure
+        is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return Color3f(0.0f);
+
+        Vector3f wh = (bRec.wi + bRec.wo);
+        wh.normalize();
+
+        float cosThetaI = Frame::cosTheta(bRec.wi);
+        float cosThetaO = Frame::cosTheta(bRec.wo);
+
+        float D = Reflectance::BeckmannNDF(wh, alpha);
+        Color3f F = Reflectance::fresnel(cosThetaI, R0);
+        float G = Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha);
+
+        return D * F * G / (4 * cosThetaI * cosThetaO);
+    }
+
+    /// Evaluate the sampling density once the roughness has been looked up
+    static float pdfBRDF(const BSDFQueryRecord& bRec, float alpha) {
+        /* This is a smooth BRDF -- return zero if the measure
+        is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return 0.0f;
+
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        return Warp::squareToBeckmannPdf(wh, alpha); //
+    }
+
+    /// Sample the BRDF once the textures have been looked up
+    static Color3f sampleBRDF(BSDFQueryRecord& bRec, const Point2f& _sample, float alpha, const Color3f& R0) {
+        if (Frame::cosTheta(bRec.wi) <= 0)
+            return Color3f(0.0f);
+
+        bRec.measure = ESolidAngle;
+
+        // Sampling wh and getting wo from it.
+        Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
+        // Calculate wo with equation from https://math.stackexchange.com/questions/13261/how-to-get-a-reflection-vector
+        bRec.wo = (-bRec.wi + 2 * bRec.wi.dot(wh) * wh);
+        bRec.wo.normalize();
+
+        // Return the value: eval(bRec) * Frame::cosTheta(bRec.wo) / pdf(bRec)
+        float pdf_sample = pdfBRDF(bRec, alpha);
+        if (pdf_sample < FLT_EPSILON) {
+            return Color3f(0.0f);
+        }
+        else {
+            return evalBRDF(bRec, alpha, R0) * Frame::cosTheta(bRec.wo) / (pdf_sample);
+        }
+    }
+
     Texture* m_alpha;
     Texture* m_R0;
     Texture* m_displacement;
@@ -412,18 +460,19 @@ public:
         Point2f sample = _sample;
         //Compute the Fresnell term
         float F = Reflectance::fresnel(cosThetaI, m_extIOR, m_intIOR);
-        //Russian Roulette 
-        float rnd = (float)rand() / RAND_MAX;
-        if (rnd < F) {
+        //Russian Roulette (reusing the first sample dimension)
+        if (sample.x() < F) {
             //Diffusion
             //Sample the half vector
-            Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
+            sample.x() /= F;
+            Vector3f wh = Warp::squareToBeckmann(sample, alpha);
             bRec.wo = (-bRec.wi + 2 * bRec.wi.dot(wh) * wh);
             bRec.wo.normalize();
         }
         else {
             // Microfacet:
-            bRec.wo = Warp::squareToCosineHemisphere(_sample);
+            sample.x() = (sample.x() - F) / (1 - F);
+            bRec.wo = Warp::squareToCosineHemisphere(sample);
         }
 
         return eval(bRec) * Frame::cosTheta(bRec.wo) / pdf(bRec);
@@ -54,6 +54,11 @@ public:
         return Color3f(1.0f);
     }
 
+    float getRoughness(const Point2f &) const {
+        /* Emitter sampling never helps a perfect mirror */
+        return 0.0f;
+    }
+
     std::string toString() const {
         return "Mirror[]";
     }
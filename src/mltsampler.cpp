@@ -0,0 +1,109 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/mltsampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+MLTSampler::MLTSampler(uint64_t seed, float sigma, float largeStepProbability)
+    : m_sigma(sigma), m_largeStepProbability(largeStepProbability) {
+    m_sampleCount = 1;
+    this->seed(seed);
+}
+
+std::unique_ptr<Sampler> MLTSampler::clone() const {
+    return std::unique_ptr<Sampler>(new MLTSampler(*this));
+}
+
+void MLTSampler::seed(uint64_t seed) {
+    /* Fixed initial state, the seed selects the stream */
+    m_random.seed(PCG32_DEFAULT_STATE, seed);
+}
+
+float MLTSampler::next1D() {
+    ensureReady(m_sampleIndex);
+    return m_X[m_sampleIndex++].value;
+}
+
+Point2f MLTSampler::next2D() {
+    float x = next1D();
+    return Point2f(x, next1D());
+}
+
+void MLTSampler::startIteration() {
+    m_currentIteration++;
+    m_largeStep = m_random.nextFloat() < m_largeStepProbability;
+    m_sampleIndex = 0;
+}
+
+void MLTSampler::accept() {
+    if (m_largeStep)
+        m_lastLargeStepIteration = m_currentIteration;
+}
+
+void MLTSampler::reject() {
+    for (PrimarySample &X : m_X)
+        if (X.lastModificationIteration == m_currentIteration)
+            X.restore();
+    m_currentIteration--;
+}
+
+void MLTSampler::ensureReady(size_t index) {
+    if (index >= m_X.size())
+        m_X.resize(index + 1);
+    PrimarySample &X = m_X[index];
+
+    /* Components that weren't used since the last accepted large step
+       still hold a stale value; replace it by a fresh one first */
+    if (X.lastModificationIteration < m_lastLargeStepIteration) {
+        X.value = m_random.nextFloat();
+        X.lastModificationIteration = m_lastLargeStepIteration;
+    }
+
+    X.backup();
+    if (m_largeStep) {
+        X.value = m_random.nextFloat();
+    } else {
+        /* Apply all small steps this component missed at once: the sum
+           of n Gaussian steps has a standard deviation of sigma*sqrt(n) */
+        int64_t smallSteps = m_currentIteration - X.lastModificationIteration;
+        float u1 = m_random.nextFloat(), u2 = m_random.nextFloat();
+        float normal = std::sqrt(-2.f * std::log(1.f - u1)) * std::cos(2.f * M_PI * u2);
+        X.value += normal * m_sigma * std::sqrt((float) smallSteps);
+        X.value -= std::floor(X.value);
+        /* Wrapping a tiny negative value can round up to 1 */
+        if (X.value >= 1.f)
+            X.value = 0.f;
+    }
+    X.lastModificationIteration = m_currentIteration;
+}
+
+std::string MLTSampler::toString() const {
+    return tfm::format(
+        "MLTSampler[\n"
+        "  sigma = %f,\n"
+        "  largeStepProbability = %f,\n"
+        "  iteration = %i\n"
+        "]",
+        m_sigma,
+        m_largeStepProbability,
+        m_currentIteration);
+}
+
+NORI_NAMESPACE_END
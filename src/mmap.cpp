@@ -0,0 +1,127 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/mmap.h>
+
+#if defined(PLATFORM_WINDOWS)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+#if defined(PLATFORM_WINDOWS)
+
+MemoryMappedFile::MemoryMappedFile(const std::string &filename, EAccessHint hint)
+    : m_filename(filename) {
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (hint == ESequential)
+        flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    else if (hint == ERandom)
+        flags |= FILE_FLAG_RANDOM_ACCESS;
+
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, flags, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw NoriException("MemoryMappedFile: could not open \"%s\"", filename);
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(m_file, &size);
+    m_size = (size_t) size.QuadPart;
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        throw NoriException("MemoryMappedFile: could not map \"%s\"", filename);
+    }
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    CloseHandle(m_file);
+}
+
+void MemoryMappedFile::prefetch(size_t, size_t) const {
+    /* The access hint was given when opening the file */
+}
+
+#else
+
+MemoryMappedFile::MemoryMappedFile(const std::string &filename, EAccessHint hint)
+    : m_filename(filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw NoriException("MemoryMappedFile: could not open \"%s\": %s", filename, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw NoriException("MemoryMappedFile: could not stat \"%s\": %s", filename, strerror(errno));
+    }
+    m_size = (size_t) st.st_size;
+    if (m_size == 0) {
+        close(fd);
+        return;
+    }
+
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* The mapping stays valid after closing the descriptor */
+    close(fd);
+    if (m_data == MAP_FAILED) {
+        m_data = nullptr;
+        throw NoriException("MemoryMappedFile: could not map \"%s\": %s", filename, strerror(errno));
+    }
+
+    int advice = hint == ESequential ? MADV_SEQUENTIAL
+        : hint == ERandom ? MADV_RANDOM : MADV_NORMAL;
+    madvise(m_data, m_size, advice);
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+    if (m_data)
+        munmap(m_data, m_size);
+}
+
+void MemoryMappedFile::prefetch(size_t offset, size_t size) const {
+    if (!m_data || offset >= m_size)
+        return;
+    /* madvise() wants page aligned addresses */
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page - 1);
+    size_t end = std::min(offset + size, m_size);
+    madvise((uint8_t *) m_data + start, end - start, MADV_WILLNEED);
+}
+
+#endif
+
+NORI_NAMESPACE_END
@@ -0,0 +1,68 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/bsdf.h>
+#include <nori/frame.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Null BSDF: an invisible surface that light goes straight through,
+ * e.g. the boundary of a medium that should not be rendered
+ */
+class NullBSDF : public BSDF {
+public:
+    NullBSDF(const PropertyList &) { }
+
+    Color3f eval(const BSDFQueryRecord &) const {
+        /* Discrete BRDFs always evaluate to zero in Nori */
+        return Color3f(0.0f);
+    }
+
+    float pdf(const BSDFQueryRecord &) const {
+        /* Discrete BRDFs always evaluate to zero in Nori */
+        return 0.0f;
+    }
+
+    Color3f sample(BSDFQueryRecord &bRec, const Point2f &) const {
+        // Continue in the same direction
+        bRec.wo = -bRec.wi;
+        bRec.measure = EDiscrete;
+
+        /* Relative index of refraction: no change */
+        bRec.eta = 1.0f;
+
+        return Color3f(1.0f);
+    }
+
+    bool isNull() const {
+        return true;
+    }
+
+    float getRoughness(const Point2f &) const {
+        /* Emitter sampling never helps a pass-through surface */
+        return 0.0f;
+    }
+
+    std::string toString() const {
+        return "NullBSDF[]";
+    }
+};
+
+NORI_REGISTER_CLASS(NullBSDF, "null");
+NORI_NAMESPACE_END
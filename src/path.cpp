@@ -3,78 +3,678 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/medium.h>
+#include <nori/pf.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+#include <nori/reservoir.h>
+#include <nori/lightcache.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <memory>
 NORI_NAMESPACE_BEGIN
-class PathTracing : public Integrator
+
+/// Russian roulette policies of \ref PathTracer
+enum ERussianRoulette {
+    /// Never terminate paths early (only sensible with a maximum depth)
+    ERRNone = 0,
+    /// After the third bounce, continue with probability min(0.9, max(throughput))
+    ERRThroughput,
+    /// Weight-window Russian roulette and splitting driven by a per-pixel estimate (ADRRS)
+    ERRADRRS
+};
+
+/**
+ * \brief Unidirectional path tracer
+ *
+ * A single bounce loop that serves all path tracing integrators. Its feature
+ * set is fixed at compile time, so every registered variant only contains the
+ * code it actually needs:
+ *
+ * \tparam NEE       Sample emitters at every scattering vertex (next event
+ *                   estimation). Without it, emission is only found by
+ *                   hitting emitters.
+ * \tparam MIS       Combine emitter and BSDF/phase function sampling through
+ *                   the balance heuristic. Without it, BSDF-sampled emitter
+ *                   hits only count after discrete bounces (when \c NEE is on).
+ * \tparam Media     Sample scattering events in the participating medium.
+ * \tparam MaxDepth  Maximum number of scattering events (-1 = unlimited)
+ * \tparam RR        Russian roulette policy
+ *
+ * Runtime parameters:
+ *  - \c lightSamples: emitter samples per vertex (default 1). The samples
+ *    are averaged; the balance heuristic weighs the N emitter samples
+ *    against the single BSDF sample.
+ *  - \c adaptiveLightSamples: scale the count at surfaces by
+ *    \ref BSDF::getRoughness(), so glossy vertices take fewer samples and
+ *    specular ones none (default false).
+ *  - \c equiangular: media only. Every segment through the medium takes an
+ *    additional equiangular sample towards a point on an emitter for
+ *    direct light, combined with the transmittance-sampled scattering
+ *    vertex by the balance heuristic (default false).
+ *  - \c lightCache: media only. Bake the transmittance towards every
+ *    emitter into a grid over the medium in \ref preprocess() and use it
+ *    for next event estimation at scattering vertices instead of shadow
+ *    rays (see \ref VolumeLightCache, default false; disable for exact
+ *    final renders). \c lightCacheResolution and \c lightCacheSamples set
+ *    the grid resolution (default 32) and the emitter samples per grid
+ *    vertex (default 16).
+ *  - \c risCandidates: if positive, every vertex instead resamples a single
+ *    emitter sample out of this many unshadowed candidates and traces one
+ *    shadow ray (see \ref sampleLightReservoir(), default 0).
+ *  - \c adrrsSamples, \c windowSize, \c maxSplit: only for \ref ERRADRRS,
+ *    see \ref weightWindow().
+ */
+template <bool NEE, bool MIS, bool Media, int MaxDepth, ERussianRoulette RR>
+class PathTracer : public Integrator
 {
 public:
-    PathTracing(const PropertyList &props)
+    PathTracer(const PropertyList& props)
     {
-        /* No parameters this time */
+        m_lightSamples = props.getInteger("lightSamples", 1);
+        m_adaptiveLightSamples = props.getBoolean("adaptiveLightSamples", false);
+        m_risCandidates = props.getInteger("risCandidates", 0);
+        m_equiangular = props.getBoolean("equiangular", false);
+        m_lightCache = props.getBoolean("lightCache", false);
+        m_lightCacheResolution = props.getInteger("lightCacheResolution", 32);
+        m_lightCacheSamples = props.getInteger("lightCacheSamples", 16);
+        m_adrrsSamples = props.getInteger("adrrsSamples", 4);
+        m_windowSize = props.getFloat("windowSize", 5.f);
+        m_maxSplit = props.getInteger("maxSplit", 4);
+        if (m_lightSamples < 1)
+            throw NoriException("PathTracer: lightSamples must be at least 1!");
+        if (m_risCandidates < 0)
+            throw NoriException("PathTracer: risCandidates can't be negative!");
+        if (m_lightCacheResolution < 2 || m_lightCacheSamples < 1)
+            throw NoriException("PathTracer: invalid light cache resolution or sample count!");
+        if (m_windowSize < 1 || m_maxSplit < 1)
+            throw NoriException("PathTracer: invalid weight window parameters!");
     }
-    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+
+    /**
+     * \brief Compute the per-pixel estimate used by ADRRS
+     *
+     * Renders the image at \c adrrsSamples spp with regular Russian roulette
+     * and keeps the luminance of every pixel. Also bakes the volumetric
+     * light cache if requested.
+     */
+    void preprocess(const Scene* scene)
     {
-        Color3f Lo(0.); // Total radiance
-        Color3f Le(0.); // Emitter radiance
-        Color3f fr(1); // Accumulation of f*cos/p
-        bool keepTracing = true;
-        Ray3f next_ray(ray);
-        Intersection its;
-        float rr_limit = 0.9f;
-        size_t n_bounces = 0;
-        while (keepTracing && fr.mean() > 0) { // If it won't give light stop
-            // 1:
-            // Find the surface that is visible in the requested direction
-            if (scene->rayIntersect(next_ray, its)) {
-                // If it intersect but it's not an emitter create another bounce with some prob.
-                if (!its.mesh->isEmitter()) {
-                    // If it's not an emitter, keep sampling
-                    //keepTracing = true; (not needed)
-                    // 2 Sample with BSDF:
-                    BSDFQueryRecord bsdfRecord(its.toLocal(-next_ray.d), its.uv);
-                    // We sample a direction wo with probability proportional to the BSDF. Then we get the fr*cos/p_omega            
-                    fr *= its.mesh->getBSDF()->sample(bsdfRecord, sampler->next2D());
-                    // New intersection and new ray:
-                    next_ray = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
-                    // For RR saying to not continuing with probability of sample()
-                    rr_limit = std::min(0.9f, (std::max(fr[0], std::max(fr[1], fr[2]))));
+        if (Media && m_lightCache)
+            m_volumeLightCache.build(scene, m_lightCacheResolution, m_lightCacheSamples);
+
+        if (RR != ERRADRRS)
+            return;
+
+        const Camera* camera = scene->getCamera();
+        m_estimateSize = camera->getOutputSize();
+        m_pixelEstimate.assign((size_t) m_estimateSize.x() * m_estimateSize.y(), 0.f);
+        m_meanEstimate = 0;
+
+        BlockGenerator blockGenerator(m_estimateSize, NORI_BLOCK_SIZE);
+        tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+            [&](const tbb::blocked_range<int>& range) {
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                sampler->setPass(std::numeric_limits<uint32_t>::max() - 1);
+
+                for (int i = range.begin(); i < range.end(); ++i) {
+                    Point2i offset;
+                    Vector2i size;
+                    blockGenerator.getBlock(i, offset, size);
+                    block.setOffset(offset);
+                    block.setSize(size);
+                    block.clear();
+                    sampler->prepare(block);
+                    Integrator::renderBlock(scene, sampler.get(), block, m_adrrsSamples, 1);
+
+                    int border = block.getBorderSize();
+                    for (int y = 0; y < size.y(); ++y)
+                        for (int x = 0; x < size.x(); ++x)
+                            m_pixelEstimate[(size_t) (offset.y() + y) * m_estimateSize.x() + offset.x() + x] =
+                                block.coeff(y + border, x + border).divideByFilterWeight().getLuminance();
                 }
-                else {
-                    // If it does intersect with an emitter stop the bouncing and add up the contribution
-                    keepTracing = false;
-                    EmitterQueryRecord emitterRecord(its.mesh->getEmitter(), next_ray.o, its.p, its.shFrame.n, its.uv);
-                    Le = its.mesh->getEmitter()->eval(emitterRecord);
+            }
+        );
+
+        double sum = 0;
+        for (float value : m_pixelEstimate)
+            sum += value;
+        m_meanEstimate = (float) (sum / std::max((size_t) 1, m_pixelEstimate.size()));
+
+        /* Very dark pixels would otherwise ask for endless splitting */
+        for (float& value : m_pixelEstimate)
+            value = std::max(value, 0.1f * m_meanEstimate);
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        return trace(scene, sampler, ray, 0.f);
+    }
+
+    void renderBlock(const Scene* scene, Sampler* sampler, ImageBlock& block,
+        uint32_t sampleCount, int stride) const
+    {
+        if (RR != ERRADRRS || m_pixelEstimate.empty() || !(m_meanEstimate > 0)) {
+            Integrator::renderBlock(scene, sampler, block, sampleCount, stride);
+            return;
+        }
+
+        /* Same as the default implementation, but every path knows the
+           estimate of the pixel it contributes to */
+        const Camera* camera = scene->getCamera();
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        for (int y = 0; y < size.y(); y += stride) {
+            for (int x = 0; x < size.x(); x += stride) {
+                float pixelEstimate = m_pixelEstimate[(size_t) (y + offset.y()) * m_estimateSize.x() + x + offset.x()];
+                for (uint32_t i = 0; i < sampleCount; ++i) {
+                    Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                    Point2f apertureSample = sampler->next2D();
+
+                    Ray3f ray;
+                    Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                    value *= trace(scene, sampler, ray, pixelEstimate);
+                    block.put(pixelSample, value);
                 }
             }
-            else {
-                // If it doesn't intersect stop, and get Background (enviromental light as well)
-                keepTracing = false;
-                Le = scene->getBackground(next_ray);
+        }
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PathTracer[\n"
+            "  nee = %s,\n"
+            "  mis = %s,\n"
+            "  media = %s,\n"
+            "  maxDepth = %i,\n"
+            "  lightSamples = %i,\n"
+            "  adaptiveLightSamples = %s,\n"
+            "  risCandidates = %i,\n"
+            "  equiangular = %s,\n"
+            "  lightCache = %s,\n"
+            "  adrrs = %s\n"
+            "]",
+            NEE ? "true" : "false",
+            MIS ? "true" : "false",
+            Media ? "true" : "false",
+            MaxDepth,
+            m_lightSamples,
+            m_adaptiveLightSamples ? "true" : "false",
+            m_risCandidates,
+            m_equiangular ? "true" : "false",
+            m_lightCache ? "true" : "false",
+            RR == ERRADRRS ? "true" : "false");
+    }
+
+protected:
+    /// Number of pending split paths that one camera ray can have
+    static const int SplitStackSize = RR == ERRADRRS ? 16 : 1;
+
+    /// State of a path between two vertices
+    struct PathState {
+        Ray3f ray;
+        /// Accumulation of f*cos/p
+        Color3f fr;
+        /// MIS: density of the direction sampling that generated ray
+        float p_mat;
+        /// MIS: emitter samples taken at the vertex that generated ray
+        int lightSamples;
+        /// Camera rays and discrete bounces can't be generated by emitter sampling
+        bool specular;
+        int depth;
+        /// Scattering events in the medium so far (see Medium::getApproximationDepth())
+        int mediumEvents;
+    };
+
+    /**
+     * \brief Estimate the radiance along \c ray
+     *
+     * \param pixelEstimate
+     *    Estimate of the pixel the ray contributes to (ADRRS only, 0 falls
+     *    back to regular Russian roulette)
+     */
+    Color3f trace(const Scene* scene, Sampler* sampler, const Ray3f& ray, float pixelEstimate) const
+    {
+        PathState stack[SplitStackSize];
+        int stackSize = 0;
+
+        PathState path;
+        path.ray = ray;
+        path.fr = Color3f(1.f);
+        path.p_mat = 0;
+        path.lightSamples = 0;
+        path.specular = true;
+        path.depth = 0;
+        path.mediumEvents = 0;
+
+        Color3f Lo(0.); // Total radiance
+        while (true) {
+            Lo += tracePath(scene, sampler, path, pixelEstimate, stack, stackSize);
+            if (stackSize == 0)
+                break;
+            path = stack[--stackSize];
+        }
+        return Lo;
+    }
+
+    /// Follow one path until it ends; split copies are pushed onto \c stack
+    Color3f tracePath(const Scene* scene, Sampler* sampler, PathState& path,
+        float pixelEstimate, PathState* stack, int& stackSize) const
+    {
+        Color3f Lo(0.);
+        bool hasMedia = Media && !scene->getMedia().empty();
+        std::vector<MediumIntersection> media;
+
+        for (; path.fr.maxCoeff() > 0; ++path.depth) {
+            const Ray3f& next_ray = path.ray;
+            Intersection its;
+            bool hit = scene->rayIntersect(next_ray, its);
+
+            if (hasMedia) {
+                /* Sample a scattering event in each medium the ray passes through
+                   (in order) until one of them scatters the path */
+                Ray3f segment(next_ray);
+                if (hit)
+                    segment.maxt = its.t;
+                scene->rayIntersectMedia(segment, media);
+                bool scattered = false, alive = true;
+                for (MediumIntersection& medIts : media) {
+                    const Medium* medium = medIts.medium;
+                    int lightSamples = vertexLightSamples(NEE ? m_lightSamples : 0);
+                    Point3f anchor;
+                    bool equiangular = NEE && m_equiangular && !(MaxDepth >= 0 && path.depth >= MaxDepth)
+                        && sampleAnchor(scene, sampler, medIts.x, anchor);
+                    Color3f frSegment = path.fr;
+                    // Approximated media end the walk at a scattering event, the direct light stands in for the rest
+                    int approximateAfter = NEE && lightSamples > 0 ? medium->getApproximationDepth() : 0;
+                    bool last = approximateAfter > 0 && path.mediumEvents + 1 >= approximateAfter;
+
+                    // Emission of the medium, unless next event estimation at the last vertex covered it
+                    if (medium->isEmissive() && (!NEE || path.specular || path.lightSamples == 0))
+                        Lo += frSegment * medium->evalEmission(medIts.x, medIts.xz);
+
+                    medium->sampleBetween(sampler->next1D(), medIts);
+                    path.fr *= medium->Transmittance(medIts.x, medIts.xt) / medIts.prob;
+
+                    if (equiangular)
+                        Lo += frSegment * equiangularLight(scene, sampler, medIts, next_ray.d, anchor, lightSamples, last);
+
+                    if (medIts.distT < medIts.distZ) {
+                        scattered = true;
+                        if (MaxDepth >= 0 && path.depth >= MaxDepth) {
+                            alive = false;
+                            break;
+                        }
+                        const PhaseFunction* pf = medium->getPhaseFunction();
+                        Vector3f wi = medIts.toLocal(-next_ray.d);
+                        Color3f mu_s = medium->getScatteringCoeficient(medIts.xt);
+                        if (approximateAfter > 0)
+                            ++path.mediumEvents;
+
+                        if (NEE) {
+                            /* Balance heuristic against the equiangular sample */
+                            float w_distance = equiangular ? medIts.prob
+                                / (medIts.prob + Medium::pdfEquiangular(anchor, medIts, medIts.distT)) : 1.f;
+                            Color3f Ld = mediumDirectLight(scene, sampler, medIts, next_ray.d, lightSamples, last);
+                            Lo += path.fr * Ld * w_distance;
+                            if (last)
+                                Lo += path.fr * Ld * medium->getMultipleScatteringGain();
+                        }
+                        if (last) {
+                            alive = false;
+                            break;
+                        }
+
+                        alive = scatter(sampler, path, lightSamples, pixelEstimate, stack, stackSize,
+                            [&](PathState& state) {
+                                PFQueryRecord pRec(wi);
+                                state.fr *= pf->sample(pRec, sampler->next2D()) * mu_s;
+                                state.specular = false;
+                                if (MIS)
+                                    state.p_mat = pf->pdf(pRec);
+                                state.ray = Ray3f(medIts.xt, medIts.toWorld(pRec.wo));
+                            });
+                        break;
+                    }
+                }
+                if (scattered) {
+                    if (!alive)
+                        break;
+                    continue;
+                }
             }
 
-            // Extra end conditions:
-            // not continuing with probability of sample() accumulated
-            float rnd = (float)rand() / RAND_MAX;
-            keepTracing = keepTracing && (rnd < rr_limit || n_bounces < 3); //90% of continuing.
-            if (n_bounces >= 3) {
-                if (keepTracing) {
-                    // Then we continue with probability:
-                    fr /= rr_limit;
+            if (!hit) {
+                // The path escapes: add the background (environment emitter)
+                const Emitter* env_emitter = scene->getEnvironmentalEmitter();
+                if (env_emitter) {
+                    EmitterQueryRecord lRec(env_emitter, next_ray.o, next_ray.o + next_ray.d, Normal3f(0, 0, 1), Point2f());
+                    float w_mat = emissionWeight(scene, env_emitter, lRec, path);
+                    if (w_mat > 0)
+                        Lo += path.fr * scene->getBackground(next_ray) * w_mat;
                 }
-                else {
-                    // We don't continue with probability:
-                    fr /= (1 - rr_limit);
+                break;
+            }
+
+            if (its.mesh->isEmitter()) {
+                // Paths end at emitters
+                const Emitter* emitter = its.mesh->getEmitter();
+                EmitterQueryRecord lRec(emitter, next_ray.o, its.p, its.shFrame.n, its.uv);
+                float w_mat = emissionWeight(scene, emitter, lRec, path);
+                if (w_mat > 0)
+                    Lo += path.fr * emitter->eval(lRec) * w_mat;
+                break;
+            }
+
+            if (MaxDepth >= 0 && path.depth >= MaxDepth)
+                break;
+
+            const BSDF* bsdf = its.mesh->getBSDF();
+            //Modify the normal shading if the bsdf has a normal map
+            if (bsdf->hasDisplacementMap()) {
+                its.shading.n = its.shFrame.n + bsdf->displacement(its.uv);
+                its.shFrame = Frame(its.shading.n);
+            }
+            Vector3f wi = its.toLocal(-next_ray.d);
+
+            int lightSamples = 0;
+            if (NEE) {
+                lightSamples = m_lightSamples;
+                if (m_adaptiveLightSamples) {
+                    float roughness = bsdf->getRoughness(its.uv);
+                    lightSamples = roughness <= 0 ? 0
+                        : std::max(1, (int) std::ceil(m_lightSamples * std::min(1.f, roughness)));
                 }
+                lightSamples = vertexLightSamples(lightSamples);
+                Lo += path.fr * directLight(scene, sampler, its.p, lightSamples,
+                    [&](const Vector3f& wo, float& pdf) {
+                        BSDFQueryRecord bRec(wi, its.toLocal(wo), its.uv, ESolidAngle);
+                        pdf = MIS ? bsdf->pdf(bRec) : 0.f;
+                        return Color3f(bsdf->eval(bRec) * its.shFrame.n.dot(wo)).clamp();
+                    });
             }
-            n_bounces+=1;
+
+            bool alive = scatter(sampler, path, lightSamples, pixelEstimate, stack, stackSize,
+                [&](PathState& state) {
+                    BSDFQueryRecord bRec(wi, its.uv);
+                    state.fr *= bsdf->sample(bRec, sampler->next2D());
+                    state.specular = bRec.measure == EDiscrete;
+                    if (MIS)
+                        state.p_mat = state.specular ? 0.f : bsdf->pdf(bRec);
+                    state.ray = Ray3f(its.p, its.toWorld(bRec.wo));
+                });
+            if (!alive)
+                break;
         }
-        Lo = fr * Le;
-        
         return Lo;
     }
-    std::string toString() const
+
+    /**
+     * \brief Continue \c path from its current vertex
+     *
+     * Applies the Russian roulette policy and, with ADRRS, creates split
+     * copies that are pushed onto \c stack. \c sampleDirection samples the
+     * next ray of a path state. Returns \c false if \c path ends here.
+     */
+    template <typename SampleDirection>
+    bool scatter(Sampler* sampler, PathState& path, int lightSamples, float pixelEstimate,
+        PathState* stack, int& stackSize, const SampleDirection& sampleDirection) const
+    {
+        path.lightSamples = lightSamples;
+
+        if (RR == ERRADRRS && pixelEstimate > 0) {
+            int copies = weightWindow(sampler, path.fr, pixelEstimate, 1 + SplitStackSize - stackSize);
+            for (int k = 1; k < copies; ++k) {
+                PathState& copy = stack[stackSize++];
+                copy = path;
+                sampleDirection(copy);
+                copy.depth = path.depth + 1;
+            }
+            if (copies == 0)
+                return false;
+            sampleDirection(path);
+            return true;
+        }
+
+        sampleDirection(path);
+        return russianRoulette(sampler, path.fr, path.depth);
+    }
+
+protected:
+    /**
+     * \brief Next event estimation from \c p
+     *
+     * Averages \c lightSamples emitter samples. Each one includes visibility,
+     * medium transmittance and its MIS weight, and is divided by the density
+     * of the light sample. \c scatter evaluates the BSDF times cosine (or the
+     * phase function times the scattering coefficient) for a world space
+     * direction and reports the density of sampling it the other way.
+     * \c inMedium marks scattering vertices, which may use the light cache.
+     */
+    template <typename Scatter>
+    Color3f directLight(const Scene* scene, Sampler* sampler, const Point3f& p,
+        int lightSamples, const Scatter& scatter, bool inMedium = false) const
+    {
+        if (m_risCandidates > 0 && lightSamples > 0)
+            return directLightRIS(scene, sampler, p, scatter, inMedium);
+
+        Color3f Ld(0.f);
+        for (int i = 0; i < lightSamples; ++i) {
+            float pdf_select;
+            const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_select);
+            EmitterQueryRecord lRec(p);
+            Color3f Le = light->sample(lRec, sampler->next2D(), 0.);
+            float pdf_light = light->pdf(lRec);
+            if (!(pdf_light > 0) || !(Le.maxCoeff() > 0))
+                continue;
+
+            float p_em = pdf_select * pdf_light;
+            float p_mat;
+            Color3f f = scatter(lRec.wi, p_mat);
+            if (!(f.maxCoeff() > 0))
+                continue;
+
+            Color3f V = transmittance(scene, sampler, p, lRec, light, inMedium);
+            if (!(V.maxCoeff() > 0))
+                continue;
+
+            // Delta lights can't be hit by BSDF sampling
+            float w_em = (MIS && !light->isDelta()) ? balance(lightSamples * p_em, p_mat) : 1.f;
+            Ld += Le * f * V * (w_em / p_em);
+        }
+        return lightSamples > 1 ? Color3f(Ld / (float) lightSamples) : Ld;
+    }
+
+    /**
+     * \brief Next event estimation at the scattering point \c medIts.xt of a ray with direction \c d
+     *
+     * \param last
+     *    The path ends at this point, so phase function sampling can't
+     *    take over any part of the direct light (no MIS)
+     */
+    Color3f mediumDirectLight(const Scene* scene, Sampler* sampler, const MediumIntersection& medIts,
+        const Vector3f& d, int lightSamples, bool last = false) const
+    {
+        const PhaseFunction* pf = medIts.medium->getPhaseFunction();
+        Vector3f wi = medIts.toLocal(-d);
+        Color3f mu_s = medIts.medium->getScatteringCoeficient(medIts.xt);
+        return directLight(scene, sampler, medIts.xt, lightSamples,
+            [&](const Vector3f& wo, float& pdf) {
+                PFQueryRecord pRec(wi, medIts.toLocal(wo));
+                pdf = MIS && !last ? pf->pdf(pRec) : 0.f;
+                return Color3f(pf->eval(pRec) * mu_s);
+            }, true);
+    }
+
+    /// Choose the center of equiangular sampling, a point on an emitter (fails for emitters at infinity)
+    static bool sampleAnchor(const Scene* scene, Sampler* sampler, const Point3f& ref, Point3f& anchor)
+    {
+        float pdf_select;
+        const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_select);
+        EmitterQueryRecord lRec(ref);
+        light->sample(lRec, sampler->next2D(), 0.f);
+        anchor = lRec.p;
+        return std::isfinite(lRec.dist);
+    }
+
+    /**
+     * \brief Direct light scattered on the medium segment of \c medIts
+     *
+     * Takes a scattering point by equiangular sampling around \c anchor.
+     * \c medIts holds the result of the transmittance sampling, whose
+     * density enters the balance heuristic. \c last is passed on to
+     * \ref mediumDirectLight().
+     */
+    Color3f equiangularLight(const Scene* scene, Sampler* sampler, const MediumIntersection& medIts,
+        const Vector3f& d, const Point3f& anchor, int lightSamples, bool last) const
+    {
+        MediumIntersection eq = medIts;
+        Medium::sampleEquiangular(sampler->next1D(), anchor, eq);
+        if (!(eq.prob > 0))
+            return Color3f(0.f);
+        float p_free = medIts.medium->pdfBetween(eq, eq.distT);
+        return medIts.medium->Transmittance(eq.x, eq.xt)
+            * mediumDirectLight(scene, sampler, eq, d, lightSamples, last) / (eq.prob + p_free);
+    }
+
+    /// Next event estimation with one emitter sample resampled from \c risCandidates candidates
+    template <typename Scatter>
+    Color3f directLightRIS(const Scene* scene, Sampler* sampler, const Point3f& p,
+        const Scatter& scatter, bool inMedium) const
     {
-        return "Direct Whitted Integrator []";
+        Reservoir r;
+        sampleLightReservoir(scene, sampler, p, m_risCandidates, scatter, r);
+        if (!r.valid())
+            return Color3f(0.f);
+
+        Color3f V = transmittance(scene, sampler, p, r.sample.lRec, r.candidate.emitter, inMedium);
+        if (!(V.maxCoeff() > 0))
+            return Color3f(0.f);
+
+        /* The MIS weight is part of the integrand that the reservoir
+           estimates, so BSDF sampling keeps its usual weight */
+        float w_em = (MIS && !r.candidate.emitter->isDelta()) ? balance(r.sample.p_em, r.sample.p_mat) : 1.f;
+        return r.sample.value * V * (w_em * r.weight());
+    }
+
+    /// Emitter samples taken at a vertex with \c lightSamples nominal samples (RIS resamples them to one)
+    int vertexLightSamples(int lightSamples) const
+    {
+        return m_risCandidates > 0 ? std::min(lightSamples, 1) : lightSamples;
+    }
+
+    /**
+     * \brief Visibility times medium transmittance between \c p and the sampled emitter point
+     *
+     * Taken from the light cache (if there is one) when \c cached is set.
+     */
+    Color3f transmittance(const Scene* scene, Sampler* sampler, const Point3f& p,
+        const EmitterQueryRecord& lRec, const Emitter* emitter, bool cached) const
+    {
+        Color3f T;
+        if (Media && cached && m_volumeLightCache.lookup(p, emitter, T))
+            return T;
+
+        Ray3f shadowRay(p, lRec.wi, Epsilon, lRec.dist - Epsilon);
+        if (Media && !scene->getMedia().empty())
+            return scene->transmittance(shadowRay, sampler);
+        return scene->rayIntersect(shadowRay) ? Color3f(0.f) : Color3f(1.f);
+    }
+
+    /// Weight of emission that was reached by BSDF or phase function sampling
+    float emissionWeight(const Scene* scene, const Emitter* emitter,
+        const EmitterQueryRecord& lRec, const PathState& path) const
+    {
+        if (!NEE || path.specular || path.lightSamples == 0)
+            return 1.f;
+        if (!MIS)
+            return 0.f; // Already accounted for by next event estimation
+        float p_em = scene->pdfEmitter(emitter) * emitter->pdf(lRec);
+        return balance(path.p_mat, path.lightSamples * p_em);
+    }
+
+    /// Balance heuristic weight of a technique with density \c a against one with density \c b
+    static float balance(float a, float b)
+    {
+        return (a + b) > FLT_EPSILON ? a / (a + b) : 0.f;
+    }
+
+    /// Apply the Russian roulette policy; returns \c false if the path ends here
+    static bool russianRoulette(Sampler* sampler, Color3f& fr, int depth)
+    {
+        if (RR == ERRNone || depth < 3)
+            return true;
+        float rr_limit = std::min(0.9f, fr.maxCoeff());
+        if (sampler->next1D() >= rr_limit)
+            return false;
+        fr /= rr_limit;
+        return true;
+    }
+
+    /**
+     * \brief ADRRS weight window (Vorba and Krivanek 2016)
+     *
+     * The expected contribution of a path is approximated by its throughput
+     * times the mean pixel estimate (a cheap stand-in for the radiance that
+     * arrives at the vertex) and compared to the estimate of its own pixel.
+     * Below the window the path plays Russian roulette, above it the path is
+     * split into at most \c maxSplit copies. Returns the number of copies to
+     * continue with (0 = killed) and adjusts the throughput accordingly.
+     */
+    int weightWindow(Sampler* sampler, Color3f& fr, float pixelEstimate, int maxCopies) const
+    {
+        float ratio = fr.getLuminance() * m_meanEstimate / pixelEstimate;
+        float lower = 2.f / (1.f + m_windowSize);
+        float upper = lower * m_windowSize;
+
+        if (ratio < lower) {
+            float q = ratio / lower;
+            if (!(sampler->next1D() < q))
+                return 0;
+            fr /= q;
+            return 1;
+        }
+        if (ratio > upper) {
+            int copies = std::min((int) std::ceil(ratio / upper), std::min(m_maxSplit, maxCopies));
+            copies = std::max(copies, 1);
+            fr /= (float) copies;
+            return copies;
+        }
+        return 1;
     }
+
+    int m_lightSamples;
+    bool m_adaptiveLightSamples;
+    int m_risCandidates;
+    bool m_equiangular;
+    bool m_lightCache;
+    int m_lightCacheResolution;
+    int m_lightCacheSamples;
+    VolumeLightCache m_volumeLightCache;
+
+    /* ADRRS */
+    int m_adrrsSamples;
+    float m_windowSize;
+    int m_maxSplit;
+    Vector2i m_estimateSize;
+    std::vector<float> m_pixelEstimate;
+    float m_meanEstimate = 0;
 };
-NORI_REGISTER_CLASS(PathTracing,"path");
-NORI_NAMESPACE_END
\ No newline at end of file
+
+/* Registered variants */
+typedef PathTracer<false, false, false, -1, ERRThroughput> PathTracing;
+typedef PathTracer<true, false, false, -1, ERRThroughput> PathTracingNEE;
+typedef PathTracer<true, true, false, -1, ERRThroughput> PathTracingMIS;
+typedef PathTracer<true, true, true, -1, ERRThroughput> VolPathIntegrator;
+typedef PathTracer<true, true, false, -1, ERRADRRS> PathTracingADRRS;
+
+NORI_REGISTER_CLASS(PathTracing, "path");
+NORI_REGISTER_CLASS(PathTracingNEE, "path_nee");
+NORI_REGISTER_CLASS(PathTracingMIS, "path_mis");
+NORI_REGISTER_CLASS(VolPathIntegrator, "vol_path_integrator");
+NORI_REGISTER_CLASS(PathTracingADRRS, "path_adrrs");
+NORI_NAMESPACE_END
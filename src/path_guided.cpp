@@ -0,0 +1,312 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+#include <nori/sdtree.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <memory>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path tracer with learned guiding distributions
+ *
+ * Follows Mueller et al., "Practical Path Guiding for Efficient
+ * Light-Transport Simulation" (2017). \ref preprocess() renders a number of
+ * training passes with a doubling sample count. Each pass records the
+ * incident radiance at every path vertex into an \ref SDTree (one recorder
+ * per TBB thread, merged once the pass is done) and refines the tree for the
+ * next pass. The final render draws directions from the guiding
+ * distribution of the last pass, combined with BSDF sampling by one-sample
+ * MIS. Emitters are sampled as in path_mis.
+ *
+ * Parameters:
+ *  - \c trainingPasses: number of training passes; pass k renders 2^k spp
+ *    (default 6)
+ *  - \c bsdfSamplingFraction: probability of sampling the BSDF instead of
+ *    the guiding distribution (default 0.5)
+ *  - \c spatialThreshold: spatial leaves are split after receiving
+ *    spatialThreshold * sqrt(2^k) samples in pass k (default 12000)
+ *  - \c directionalThreshold: fraction of the flux above which a directional
+ *    quadrant is subdivided (default 0.01)
+ *  - \c maxDirectionalDepth: maximum depth of the directional trees (default 20)
+ */
+class PathTracingGuided : public Integrator
+{
+public:
+    PathTracingGuided(const PropertyList& props)
+    {
+        m_trainingPasses = props.getInteger("trainingPasses", 6);
+        m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+        m_spatialThreshold = props.getFloat("spatialThreshold", 12000.f);
+        m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+        m_maxDirectionalDepth = props.getInteger("maxDirectionalDepth", 20);
+        if (m_trainingPasses < 0 || m_trainingPasses > 16)
+            throw NoriException("PathTracingGuided: trainingPasses must be between 0 and 16!");
+        if (m_bsdfSamplingFraction <= 0 || m_bsdfSamplingFraction > 1)
+            throw NoriException("PathTracingGuided: bsdfSamplingFraction must be in (0, 1]!");
+    }
+
+    /// Train the guiding distributions
+    void preprocess(const Scene* scene)
+    {
+        m_sdtree = SDTree(scene->getBoundingBox());
+
+        const Camera* camera = scene->getCamera();
+        BlockGenerator blockGenerator(camera->getOutputSize(), NORI_BLOCK_SIZE);
+
+        for (int pass = 0; pass < m_trainingPasses; ++pass) {
+            uint32_t sampleCount = 1u << pass;
+            tbb::enumerable_thread_specific<SDTree::Recorder> recorders;
+
+            tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+                [&](const tbb::blocked_range<int>& range) {
+                    SDTree::Recorder& recorder = recorders.local();
+                    if (recorder.samples.empty())
+                        m_sdtree.resetRecorder(recorder);
+
+                    ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+                    std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                    sampler->setPass(std::numeric_limits<uint32_t>::max() - 2 - (uint32_t) pass);
+
+                    for (int i = range.begin(); i < range.end(); ++i) {
+                        Point2i offset;
+                        Vector2i size;
+                        blockGenerator.getBlock(i, offset, size);
+                        block.setOffset(offset);
+                        block.setSize(size);
+                        sampler->prepare(block);
+
+                        for (int y = 0; y < size.y(); ++y) {
+                            for (int x = 0; x < size.x(); ++x) {
+                                for (uint32_t s = 0; s < sampleCount; ++s) {
+                                    Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                                    Point2f apertureSample = sampler->next2D();
+                                    Ray3f ray;
+                                    camera->sampleRay(ray, pixelSample, apertureSample);
+                                    trace(scene, sampler.get(), ray, &recorder);
+                                }
+                            }
+                        }
+                    }
+                }
+            );
+
+            for (const SDTree::Recorder& recorder : recorders)
+                m_sdtree.accumulate(recorder);
+            m_sdtree.refine((uint32_t) (m_spatialThreshold * std::sqrt((float) sampleCount)),
+                m_directionalThreshold, m_maxDirectionalDepth);
+
+            cout << tfm::format("Path guiding pass %i/%i (%i spp): %i spatial leaves, %i directional nodes",
+                pass + 1, m_trainingPasses, sampleCount, m_sdtree.getLeafCount(),
+                m_sdtree.getDirectionalNodeCount()) << endl;
+        }
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        return trace(scene, sampler, ray, nullptr);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PathTracingGuided[\n"
+            "  trainingPasses = %i,\n"
+            "  bsdfSamplingFraction = %f,\n"
+            "  spatialThreshold = %f,\n"
+            "  directionalThreshold = %f,\n"
+            "  maxDirectionalDepth = %i\n"
+            "]",
+            m_trainingPasses,
+            m_bsdfSamplingFraction,
+            m_spatialThreshold,
+            m_directionalThreshold,
+            m_maxDirectionalDepth);
+    }
+
+protected:
+    /// Maximum number of vertices of a path that record radiance
+    static const int MaxVertices = 32;
+
+    /// A guidable vertex of the current path
+    struct Vertex {
+        uint32_t leaf;
+        /// World space direction of the outgoing ray
+        Vector3f d;
+        /// Density of the combined (BSDF + guiding) sampling of d
+        float pdf;
+        /// Path throughput including the scattering at this vertex
+        Color3f throughput;
+        /// Radiance that arrived from d
+        Color3f radiance;
+    };
+
+    /// Estimate the radiance along \c ray, optionally recording it for training
+    Color3f trace(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+        SDTree::Recorder* recorder) const
+    {
+        Vertex vertices[MaxVertices];
+        int vertexCount = 0;
+
+        Color3f Lo(0.);
+        Color3f fr(1.f);         // Accumulation of f*cos/p
+        float p_mat = 0;         // Density of the sampling that generated next_ray
+        bool specular = true;    // Camera rays and discrete bounces can't be found by NEE
+        Ray3f next_ray = ray;
+
+        for (int depth = 0; fr.maxCoeff() > 0; ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(next_ray, its)) {
+                const Emitter* env_emitter = scene->getEnvironmentalEmitter();
+                if (env_emitter) {
+                    EmitterQueryRecord lRec(env_emitter, next_ray.o, next_ray.o + next_ray.d, Normal3f(0, 0, 1), Point2f());
+                    float w_mat = specular ? 1.f : balance(p_mat, scene->pdfEmitter(env_emitter) * env_emitter->pdf(lRec));
+                    addRadiance(Lo, fr * scene->getBackground(next_ray) * w_mat, vertices, vertexCount);
+                }
+                break;
+            }
+
+            if (its.mesh->isEmitter()) {
+                // Paths end at emitters
+                const Emitter* emitter = its.mesh->getEmitter();
+                EmitterQueryRecord lRec(emitter, next_ray.o, its.p, its.shFrame.n, its.uv);
+                float w_mat = specular ? 1.f : balance(p_mat, scene->pdfEmitter(emitter) * emitter->pdf(lRec));
+                addRadiance(Lo, fr * emitter->eval(lRec) * w_mat, vertices, vertexCount);
+                break;
+            }
+
+            const BSDF* bsdf = its.mesh->getBSDF();
+            //Modify the normal shading if the bsdf has a normal map
+            if (bsdf->hasDisplacementMap()) {
+                its.shading.n = its.shFrame.n + bsdf->displacement(its.uv);
+                its.shFrame = Frame(its.shading.n);
+            }
+            Vector3f wi = its.toLocal(-next_ray.d);
+
+            // Specular BSDFs gain nothing from guiding
+            uint32_t leaf = m_sdtree.getLeaf(its.p);
+            const DTree& dtree = m_sdtree.getSamplingTree(leaf);
+            bool guided = bsdf->getRoughness(its.uv) > 0 && dtree.getFlux() > 0;
+            float alpha = guided ? m_bsdfSamplingFraction : 1.f;
+
+            // Next event estimation, weighted against the combined sampling
+            float pdf_select;
+            const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_select);
+            EmitterQueryRecord eRec(its.p);
+            Color3f Le = light->sample(eRec, sampler->next2D(), 0.);
+            float p_em = pdf_select * light->pdf(eRec);
+            if (p_em > 0 && Le.maxCoeff() > 0
+                && !scene->rayIntersect(Ray3f(its.p, eRec.wi, Epsilon, eRec.dist - Epsilon))) {
+                BSDFQueryRecord bRec(wi, its.toLocal(eRec.wi), its.uv, ESolidAngle);
+                Color3f f = Color3f(bsdf->eval(bRec) * its.shFrame.n.dot(eRec.wi)).clamp();
+                float p_dir = alpha * bsdf->pdf(bRec);
+                if (guided)
+                    p_dir += (1 - alpha) * dtree.pdf(eRec.wi);
+                float w_em = light->isDelta() ? 1.f : balance(p_em, p_dir);
+                addRadiance(Lo, fr * Le * f * (w_em / p_em), vertices, vertexCount);
+            }
+
+            // One-sample MIS between the BSDF and the guiding distribution
+            BSDFQueryRecord bRec(wi, its.uv);
+            Color3f weight;
+            if (!guided || sampler->next1D() < alpha) {
+                Color3f f = bsdf->sample(bRec, sampler->next2D());
+                if (bRec.measure == EDiscrete) {
+                    weight = f;
+                    specular = true;
+                    p_mat = 0;
+                } else {
+                    float pdf_bsdf = bsdf->pdf(bRec);
+                    p_mat = alpha * pdf_bsdf;
+                    if (guided)
+                        p_mat += (1 - alpha) * dtree.pdf(its.toWorld(bRec.wo));
+                    weight = p_mat > 0 ? Color3f(f * pdf_bsdf / p_mat) : Color3f(0.f);
+                    specular = false;
+                }
+            } else {
+                Vector3f wo = dtree.sample(sampler->next2D());
+                bRec = BSDFQueryRecord(wi, its.toLocal(wo), its.uv, ESolidAngle);
+                p_mat = alpha * bsdf->pdf(bRec) + (1 - alpha) * dtree.pdf(wo);
+                Color3f f = Color3f(bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo))).clamp();
+                weight = p_mat > 0 ? Color3f(f / p_mat) : Color3f(0.f);
+                specular = false;
+            }
+
+            fr *= weight;
+            next_ray = Ray3f(its.p, its.toWorld(bRec.wo));
+            bool record = !specular && vertexCount < MaxVertices;
+            if (record) {
+                Vertex& v = vertices[vertexCount++];
+                v.leaf = leaf;
+                v.d = next_ray.d;
+                v.pdf = p_mat;
+                v.radiance = Color3f(0.f);
+            }
+
+            if (!russianRoulette(sampler, fr, depth))
+                break;
+            // Radiance found further along is divided by the throughput after the roulette
+            if (record)
+                vertices[vertexCount - 1].throughput = fr;
+        }
+
+        if (recorder) {
+            for (int i = 0; i < vertexCount; ++i) {
+                const Vertex& v = vertices[i];
+                float flux = v.radiance.getLuminance() / v.pdf;
+                if (v.pdf > 0 && std::isfinite(flux))
+                    m_sdtree.record(*recorder, v.leaf, v.d, std::max(flux, 0.f));
+            }
+        }
+        return Lo;
+    }
+
+    /// Add a contribution to the estimate and to the incident radiance of all recorded vertices
+    static void addRadiance(Color3f& Lo, const Color3f& L, Vertex* vertices, int vertexCount)
+    {
+        if (!(L.maxCoeff() > 0))
+            return;
+        Lo += L;
+        for (int i = 0; i < vertexCount; ++i) {
+            const Color3f& t = vertices[i].throughput;
+            for (int c = 0; c < 3; ++c) {
+                if (t[c] > 0)
+                    vertices[i].radiance[c] += L[c] / t[c];
+            }
+        }
+    }
+
+    /// Balance heuristic weight of a technique with density \c a against one with density \c b
+    static float balance(float a, float b)
+    {
+        return (a + b) > FLT_EPSILON ? a / (a + b) : 0.f;
+    }
+
+    /// After the third bounce, continue with probability min(0.9, max(throughput))
+    static bool russianRoulette(Sampler* sampler, Color3f& fr, int depth)
+    {
+        if (depth < 3)
+            return true;
+        float rr_limit = std::min(0.9f, fr.maxCoeff());
+        if (sampler->next1D() >= rr_limit)
+            return false;
+        fr /= rr_limit;
+        return true;
+    }
+
+    int m_trainingPasses;
+    float m_bsdfSamplingFraction;
+    float m_spatialThreshold;
+    float m_directionalThreshold;
+    int m_maxDirectionalDepth;
+    SDTree m_sdtree;
+};
+
+NORI_REGISTER_CLASS(PathTracingGuided, "path_guided");
+NORI_NAMESPACE_END
@@ -0,0 +1,298 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/irrcache.h>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path tracer with an irradiance cache for diffuse interreflection
+ *
+ * Meant for quick previews: camera paths follow all other bounces
+ * (including rough microfacet ones) by BSDF sampling until they reach the
+ * first Lambertian surface (\ref BSDF::isLambertian()). There, direct
+ * illumination is sampled as usual, while the indirect irradiance is
+ * interpolated from an \ref IrradianceCache and the path ends. Missing
+ * records are computed on the fly by the rendering threads with a
+ * stratified final gather of \c gatherRays rays, which also provides the
+ * irradiance gradients. The cache is kept for all progressive passes.
+ *
+ * The result is biased (smooth but possibly blotchy indirect light).
+ *
+ * Parameters:
+ *  - \c errorThreshold: maximum interpolation error of a record, smaller
+ *    values create more records (default 0.2)
+ *  - \c gatherRays: rays per final gather (default 256)
+ *  - \c minRadius, \c maxRadius: bounds of the record radius relative to
+ *    the scene diagonal (default 0.001 and 0.1)
+ *  - \c maxDepth: maximum number of bounces of camera and gather paths
+ *    (default 8)
+ */
+class IrradianceCachePath : public Integrator
+{
+public:
+    IrradianceCachePath(const PropertyList& props)
+    {
+        m_errorThreshold = props.getFloat("errorThreshold", 0.2f);
+        int gatherRays = props.getInteger("gatherRays", 256);
+        m_minRadius = props.getFloat("minRadius", 0.001f);
+        m_maxRadius = props.getFloat("maxRadius", 0.1f);
+        m_maxDepth = props.getInteger("maxDepth", 8);
+        if (!(m_errorThreshold > 0) || gatherRays < 4)
+            throw NoriException("IrradianceCachePath: invalid error threshold or gather ray count!");
+        if (!(m_minRadius > 0) || m_maxRadius < m_minRadius)
+            throw NoriException("IrradianceCachePath: invalid radius bounds!");
+
+        /* Ward's choice of N = pi * M azimuthal strata */
+        m_thetaStrata = std::max(2, (int) std::round(std::sqrt(gatherRays / M_PI)));
+        m_phiStrata = std::max(2, gatherRays / m_thetaStrata);
+    }
+
+    void preprocess(const Scene* scene)
+    {
+        m_cache.clear(scene->getBoundingBox(), m_errorThreshold);
+        m_sceneScale = scene->getBoundingBox().getExtents().norm();
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        Color3f Lo(0.f), fr(1.f);
+        Ray3f path = ray;
+        for (int depth = 0; depth <= m_maxDepth && fr.maxCoeff() > 0; ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(path, its)) {
+                Lo += fr * scene->getBackground(path);
+                break;
+            }
+
+            if (its.mesh->isEmitter()) {
+                const Emitter* emitter = its.mesh->getEmitter();
+                Lo += fr * emitter->eval(EmitterQueryRecord(emitter, path.o, its.p, its.shFrame.n, its.uv));
+                break;
+            }
+
+            const BSDF* bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-path.d);
+            // Only a constant BSDF can be pulled out of the irradiance integral
+            if (bsdf->isLambertian()) {
+                Lo += fr * directLight(scene, sampler, its, wi);
+
+                /* A Lambertian BSDF is constant, so any direction pair gives albedo / pi */
+                BSDFQueryRecord bRec(wi, Vector3f(0.f, 0.f, 1.f), its.uv, ESolidAngle);
+                Lo += fr * bsdf->eval(bRec) * irradiance(scene, sampler, its);
+                break;
+            }
+
+            BSDFQueryRecord bRec(wi, its.uv);
+            fr *= bsdf->sample(bRec, sampler->next2D());
+            path = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return Lo;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "IrradianceCachePath[\n"
+            "  errorThreshold = %f,\n"
+            "  gatherRays = %i x %i,\n"
+            "  minRadius = %f,\n"
+            "  maxRadius = %f,\n"
+            "  maxDepth = %i\n"
+            "]",
+            m_errorThreshold,
+            m_thetaStrata, m_phiStrata,
+            m_minRadius,
+            m_maxRadius,
+            m_maxDepth);
+    }
+
+private:
+    /// Indirect irradiance at a Lambertian surface point (from the cache if possible)
+    Color3f irradiance(const Scene* scene, Sampler* sampler, const Intersection& its) const
+    {
+        Color3f E;
+        if (m_cache.lookup(its.p, its.shFrame.n, E))
+            return E;
+
+        IrradianceCache::Record record;
+        finalGather(scene, sampler, its, record);
+        m_cache.insert(record);
+        return record.E;
+    }
+
+    /**
+     * \brief Compute a new cache record at \c its
+     *
+     * Stratified cosine-weighted gather over M x N strata, where stratum
+     * (j, k) covers sin^2(theta) in [j/M, (j+1)/M] and phi in
+     * [2 pi k/N, 2 pi (k+1)/N]. The gradients follow Ward and Heckbert
+     * 1992; they are computed in the local shading frame.
+     */
+    void finalGather(const Scene* scene, Sampler* sampler, const Intersection& its,
+        IrradianceCache::Record& record) const
+    {
+        const int M = m_thetaStrata, N = m_phiStrata;
+        std::vector<Color3f> L((size_t) M * N);
+        std::vector<float> dist((size_t) M * N);
+
+        Vector3f rotGrad[3] = { Vector3f(0.f), Vector3f(0.f), Vector3f(0.f) };
+        Color3f E(0.f);
+        float invDistSum = 0;
+        for (int j = 0; j < M; ++j) {
+            for (int k = 0; k < N; ++k) {
+                Point2f sample = sampler->next2D();
+                float sin2Theta = (j + sample.x()) / M;
+                float st = std::sqrt(sin2Theta), ct = std::sqrt(1.f - sin2Theta);
+                float phi = 2.f * M_PI * (k + sample.y()) / N;
+                Vector3f local(st * std::cos(phi), st * std::sin(phi), ct);
+
+                size_t index = (size_t) j * N + k;
+                Ray3f ray(its.p, its.toWorld(local));
+                Intersection gatherIts;
+                if (scene->rayIntersect(ray, gatherIts)) {
+                    L[index] = reflectedRadiance(scene, sampler, ray, gatherIts);
+                    dist[index] = gatherIts.t;
+                    invDistSum += 1.f / gatherIts.t;
+                } else {
+                    /* Emitted light (incl. the environment) is direct illumination */
+                    L[index] = Color3f(0.f);
+                    dist[index] = std::numeric_limits<float>::infinity();
+                }
+                E += L[index];
+
+                /* Rotational gradient: -tan(theta) L along the direction phi + pi/2 */
+                float tanTheta = st / std::max(ct, Epsilon);
+                for (int c = 0; c < 3; ++c) {
+                    rotGrad[c].x() += tanTheta * std::sin(phi) * L[index][c];
+                    rotGrad[c].y() -= tanTheta * std::cos(phi) * L[index][c];
+                }
+            }
+        }
+
+        /* Translational gradient: changes of the radiance between
+           neighbouring strata, divided by the distance of the closer one */
+        Vector3f transGrad[3] = { Vector3f(0.f), Vector3f(0.f), Vector3f(0.f) };
+        for (int k = 0; k < N; ++k) {
+            float phiMid = 2.f * M_PI * (k + 0.5f) / N, phiMin = 2.f * M_PI * k / N;
+            Vector3f u(std::cos(phiMid), std::sin(phiMid), 0.f);
+            Vector3f v(-std::sin(phiMin), std::cos(phiMin), 0.f);
+            int kPrev = (k + N - 1) % N;
+
+            for (int j = 0; j < M; ++j) {
+                size_t index = (size_t) j * N + k;
+                float sin2Min = (float) j / M, sin2Max = (float) (j + 1) / M;
+                float cosMin = std::sqrt(1.f - sin2Min), cosMax = std::sqrt(1.f - sin2Max);
+
+                if (j > 0) {
+                    size_t below = index - N;
+                    float weight = 2.f * M_PI / N * std::sqrt(sin2Min) * cosMin * cosMin
+                        / std::min(dist[index], dist[below]);
+                    Color3f diff = L[index] - L[below];
+                    for (int c = 0; c < 3; ++c)
+                        transGrad[c] += u * (weight * diff[c]);
+                }
+
+                /* Sine at the middle of the stratum, which unlike the sample's
+                   can't be zero */
+                size_t prev = (size_t) j * N + kPrev;
+                float sinMid = std::sqrt((j + 0.5f) / M);
+                float weight = (cosMin - cosMax) / (sinMid * std::min(dist[index], dist[prev]));
+                Color3f diff = L[index] - L[prev];
+                for (int c = 0; c < 3; ++c)
+                    transGrad[c] += v * (weight * diff[c]);
+            }
+        }
+
+        float scale = M_PI / (M * N);
+        record.p = its.p;
+        record.n = its.shFrame.n;
+        record.E = E * scale;
+        float radius = invDistSum > 0 ? M * N / invDistSum : std::numeric_limits<float>::infinity();
+        record.R = std::min(std::max(radius, m_minRadius * m_sceneScale), m_maxRadius * m_sceneScale);
+        for (int c = 0; c < 3; ++c) {
+            record.rotGrad[c] = its.toWorld(rotGrad[c] * scale);
+            record.transGrad[c] = its.toWorld(transGrad[c]);
+        }
+    }
+
+    /**
+     * \brief Radiance reflected towards \c ray.o at the first hit \c its
+     *
+     * A path tracer with next event estimation. Emission found by BSDF
+     * sampling only counts after discrete bounces.
+     */
+    Color3f reflectedRadiance(const Scene* scene, Sampler* sampler, Ray3f ray, Intersection its) const
+    {
+        Color3f L(0.f), fr(1.f);
+        bool countEmission = false;
+        for (int depth = 1; ; ++depth) {
+            if (its.mesh->isEmitter()) {
+                if (countEmission) {
+                    const Emitter* emitter = its.mesh->getEmitter();
+                    L += fr * emitter->eval(EmitterQueryRecord(emitter, ray.o, its.p, its.shFrame.n, its.uv));
+                }
+                break;
+            }
+            if (depth > m_maxDepth)
+                break;
+
+            const BSDF* bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+            L += fr * directLight(scene, sampler, its, wi);
+
+            BSDFQueryRecord bRec(wi, its.uv);
+            fr *= bsdf->sample(bRec, sampler->next2D());
+            countEmission = bRec.measure == EDiscrete;
+            if (!(fr.maxCoeff() > 0))
+                break;
+            if (depth >= 3) {
+                float q = std::min(0.9f, fr.maxCoeff());
+                if (sampler->next1D() >= q)
+                    break;
+                fr /= q;
+            }
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(ray, its)) {
+                const Emitter* env_emitter = scene->getEnvironmentalEmitter();
+                if (countEmission && env_emitter)
+                    L += fr * scene->getBackground(ray);
+                break;
+            }
+        }
+        return L;
+    }
+
+    /// Next event estimation with a single emitter sample
+    Color3f directLight(const Scene* scene, Sampler* sampler, const Intersection& its, const Vector3f& wi) const
+    {
+        float pdf_select;
+        const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_select);
+        if (!light)
+            return Color3f(0.f);
+        EmitterQueryRecord lRec(its.p);
+        Color3f Le = light->sample(lRec, sampler->next2D(), 0.);
+        float pdf_light = light->pdf(lRec);
+        if (!(pdf_light > 0) || !(Le.maxCoeff() > 0))
+            return Color3f(0.f);
+        if (scene->rayIntersect(Ray3f(its.p, lRec.wi, Epsilon, lRec.dist - Epsilon)))
+            return Color3f(0.f);
+
+        BSDFQueryRecord bRec(wi, its.toLocal(lRec.wi), its.uv, ESolidAngle);
+        Color3f f = its.mesh->getBSDF()->eval(bRec) * std::max(0.f, its.shFrame.n.dot(lRec.wi));
+        return Le * f / (pdf_select * pdf_light);
+    }
+
+    mutable IrradianceCache m_cache;
+    float m_errorThreshold;
+    int m_thetaStrata, m_phiStrata;
+    float m_minRadius, m_maxRadius;
+    float m_sceneScale = 1.f;
+    int m_maxDepth;
+};
+
+NORI_REGISTER_CLASS(IrradianceCachePath, "path_irrcache");
+NORI_NAMESPACE_END
@@ -0,0 +1,450 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <functional>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Wavefront path tracer
+ *
+ * Computes the same estimate as \c path_mis (next event estimation combined
+ * with BSDF sampling through the balance heuristic), but instead of following
+ * one path at a time it keeps a whole batch of paths in structure-of-arrays
+ * queues. Every iteration advances all live paths by one bounce, running
+ * the same sequence of stages over the complete batch:
+ *
+ *  1. intersect the current rays with the scene
+ *  2. account for escaped rays and emitter hits (these paths end here)
+ *  3. group the remaining surface hits by BSDF instance
+ *  4. shade them and sample one light for each
+ *  5. trace all shadow rays of the batch
+ *  6. sample the BSDFs to get the next rays
+ *  7. Russian roulette, which compacts the queue of live paths
+ *
+ * Each stage runs the same code for thousands of paths in a row, which keeps
+ * the intersection and shading work coherent. The shading stages hand every
+ * run of hits with the same material to the batched BSDF entry points
+ * (\ref BSDF::evalBatch() etc.), so that a material costs one virtual call
+ * per bounce instead of one per path.
+ */
+class PathTracingWavefront : public Integrator
+{
+public:
+    PathTracingWavefront(const PropertyList& props)
+    {
+        /* Number of paths that are traced together */
+        m_batchSize = props.getInteger("batchSize", 16384);
+        if (m_batchSize <= 0)
+            throw NoriException("path_wavefront: the batch size must be positive!");
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        /* Single path fallback: run the stages on a batch of size one */
+        PathStates paths;
+        paths.resize(1);
+        paths.start(0, ray, Color3f(1.f), Point2f(0.f));
+        trace(scene, sampler, paths);
+        return paths.radiance[0];
+    }
+
+    void renderBlock(const Scene* scene, Sampler* sampler, ImageBlock& block,
+        uint32_t sampleCount, int stride) const
+    {
+        const Camera* camera = scene->getCamera();
+
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+        uint32_t width = (uint32_t) ((size.x() + stride - 1) / stride);
+        uint32_t height = (uint32_t) ((size.y() + stride - 1) / stride);
+        size_t total = (size_t) width * height * sampleCount;
+
+        PathStates paths;
+        for (size_t begin = 0; begin < total; begin += (size_t) m_batchSize) {
+            size_t count = std::min(total - begin, (size_t) m_batchSize);
+            paths.resize(count);
+
+            /* Generate the camera rays of this batch */
+            for (size_t i = 0; i < count; ++i) {
+                size_t pixel = (begin + i) / sampleCount;
+                int x = (int) (pixel % width) * stride, y = (int) (pixel / width) * stride;
+
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                paths.start(i, ray, value, pixelSample);
+            }
+
+            trace(scene, sampler, paths);
+
+            /* Store the finished paths in the image block */
+            for (size_t i = 0; i < count; ++i)
+                block.put(paths.pixel[i], paths.radiance[i]);
+        }
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PathTracingWavefront[\n"
+            "  batchSize = %i\n"
+            "]", m_batchSize);
+    }
+
+protected:
+    /// Structure-of-arrays storage for a batch of paths and their queues
+    struct PathStates {
+        /* Current ray of each path */
+        std::vector<Point3f> origin;
+        std::vector<Vector3f> direction;
+        std::vector<float> mint, maxt;
+        /// Image plane position of the camera sample
+        std::vector<Point2f> pixel;
+        /// Product of the camera weight and all f*cos/pdf terms so far
+        std::vector<Color3f> throughput;
+        /// Radiance gathered so far
+        std::vector<Color3f> radiance;
+        /// Solid angle density of the BSDF sample that generated the current ray
+        std::vector<float> bsdfPdf;
+        /// Was the current ray generated by a discrete (specular) BSDF sample?
+        std::vector<uint8_t> specular;
+        /// Intersection of the current ray
+        std::vector<uint8_t> hit;
+        std::vector<Intersection> its;
+        /// Material at the current intersection
+        std::vector<const BSDF*> bsdf;
+        /* Random numbers of the current bounce */
+        std::vector<float> lightSample1D, rrSample;
+        std::vector<Point2f> lightSample, bsdfSample;
+
+        /// Indices of the paths that are still alive
+        std::vector<uint32_t> active;
+        /// Live paths that hit a non-emitting surface in this bounce
+        std::vector<uint32_t> surface;
+
+        /* Shadow ray queue: owning path, ray and unoccluded contribution */
+        std::vector<uint32_t> shadowPath;
+        std::vector<Ray3f> shadowRay;
+        std::vector<Color3f> shadowValue;
+
+        /* Scratch space for the BSDF queries of one material run */
+        std::vector<BSDFQueryRecord> records;
+        std::vector<uint32_t> recordPath;
+        std::vector<Point2f> recordSample;
+        std::vector<Color3f> recordValue, recordLight;
+        std::vector<float> recordPdf, recordPdfEm;
+        std::vector<Ray3f> recordRay;
+
+        size_t size() const { return origin.size(); }
+
+        void resize(size_t count) {
+            origin.resize(count);
+            direction.resize(count);
+            mint.resize(count);
+            maxt.resize(count);
+            pixel.resize(count);
+            throughput.resize(count);
+            radiance.resize(count);
+            bsdfPdf.resize(count);
+            specular.resize(count);
+            hit.resize(count);
+            its.resize(count);
+            bsdf.resize(count);
+            lightSample1D.resize(count);
+            rrSample.resize(count);
+            lightSample.resize(count);
+            bsdfSample.resize(count);
+        }
+
+        /// Initialize path \c i with a primary ray
+        void start(size_t i, const Ray3f& ray, const Color3f& weight, const Point2f& pixelSample) {
+            origin[i] = ray.o;
+            direction[i] = ray.d;
+            mint[i] = ray.mint;
+            maxt[i] = ray.maxt;
+            pixel[i] = pixelSample;
+            throughput[i] = weight;
+            radiance[i] = Color3f(0.f);
+            bsdfPdf[i] = 0.f;
+            specular[i] = false;
+        }
+
+        Ray3f ray(uint32_t i) const {
+            return Ray3f(origin[i], direction[i], mint[i], maxt[i]);
+        }
+    };
+
+    /// Advance all paths of the batch until every one of them has terminated
+    void trace(const Scene* scene, Sampler* sampler, PathStates& paths) const
+    {
+        paths.active.clear();
+        for (uint32_t i = 0; i < (uint32_t) paths.size(); ++i) {
+            if (paths.throughput[i].maxCoeff() > 0)
+                paths.active.push_back(i);
+        }
+
+        for (int depth = 0; !paths.active.empty(); ++depth) {
+            intersect(scene, paths);
+            gatherEmission(scene, paths, depth);
+            sortByMaterial(sampler, paths);
+            sampleLights(scene, paths);
+            traceShadowRays(scene, paths);
+            sampleBSDFs(paths);
+            russianRoulette(paths, depth);
+        }
+    }
+
+    /// Stage 1: find the closest intersection of every live path
+    void intersect(const Scene* scene, PathStates& paths) const
+    {
+        for (uint32_t i : paths.active)
+            paths.hit[i] = scene->rayIntersect(paths.ray(i), paths.its[i]);
+    }
+
+    /**
+     * \brief Stage 2: add the emission of escaped rays and emitter hits
+     *
+     * Like \c path_mis, paths end when they reach an emitter. All other
+     * paths are moved to the surface queue.
+     */
+    void gatherEmission(const Scene* scene, PathStates& paths, int depth) const
+    {
+        const Emitter* envEmitter = scene->getEnvironmentalEmitter();
+
+        paths.surface.clear();
+        for (uint32_t i : paths.active) {
+            if (!paths.hit[i]) {
+                if (envEmitter) {
+                    Ray3f ray = paths.ray(i);
+                    EmitterQueryRecord lRec(envEmitter, ray.o, ray.o + ray.d, Normal3f(0, 0, 1), Point2f());
+                    float w_mat = misWeightBSDF(scene, envEmitter, lRec, paths, i, depth);
+                    paths.radiance[i] += paths.throughput[i] * scene->getBackground(ray) * w_mat;
+                }
+                continue;
+            }
+
+            const Intersection& its = paths.its[i];
+            if (its.mesh->isEmitter()) {
+                const Emitter* emitter = its.mesh->getEmitter();
+                EmitterQueryRecord lRec(emitter, paths.origin[i], its.p, its.shFrame.n, its.uv);
+                float w_mat = misWeightBSDF(scene, emitter, lRec, paths, i, depth);
+                paths.radiance[i] += paths.throughput[i] * emitter->eval(lRec) * w_mat;
+                continue;
+            }
+
+            paths.surface.push_back(i);
+        }
+    }
+
+    /**
+     * \brief Stage 3: prepare the surface hits and group them by material
+     *
+     * All random numbers of the bounce are drawn here in path order, so that
+     * the image does not depend on where the materials live in memory.
+     */
+    void sortByMaterial(Sampler* sampler, PathStates& paths) const
+    {
+        for (uint32_t i : paths.surface) {
+            Intersection& its = paths.its[i];
+            const BSDF* bsdf = its.mesh->getBSDF();
+            paths.bsdf[i] = bsdf;
+
+            //Modify the normal shading if the bsdf has a normal map
+            if (bsdf->hasDisplacementMap()) {
+                its.shading.n = its.shFrame.n + bsdf->displacement(its.uv);
+                its.shFrame = Frame(its.shading.n);
+            }
+
+            paths.lightSample1D[i] = sampler->next1D();
+            paths.lightSample[i] = sampler->next2D();
+            paths.bsdfSample[i] = sampler->next2D();
+            paths.rrSample[i] = sampler->next1D();
+        }
+
+        std::stable_sort(paths.surface.begin(), paths.surface.end(),
+            [&paths](uint32_t a, uint32_t b) {
+                return std::less<const BSDF*>()(paths.bsdf[a], paths.bsdf[b]);
+            });
+    }
+
+    /// Return the end of the run of surface hits with the same material that starts at \c begin
+    static size_t materialRunEnd(const PathStates& paths, size_t begin)
+    {
+        const BSDF* bsdf = paths.bsdf[paths.surface[begin]];
+        size_t end = begin + 1;
+        while (end < paths.surface.size() && paths.bsdf[paths.surface[end]] == bsdf)
+            ++end;
+        return end;
+    }
+
+    /**
+     * \brief Stage 4: sample one emitter for every surface hit and shade it
+     *
+     * The contribution of every light sample is computed here, assuming that
+     * it is unoccluded; visibility is resolved later for the whole batch.
+     */
+    void sampleLights(const Scene* scene, PathStates& paths) const
+    {
+        paths.shadowPath.clear();
+        paths.shadowRay.clear();
+        paths.shadowValue.clear();
+
+        for (size_t begin = 0, end; begin < paths.surface.size(); begin = end) {
+            end = materialRunEnd(paths, begin);
+            const BSDF* bsdf = paths.bsdf[paths.surface[begin]];
+
+            paths.records.clear();
+            paths.recordPath.clear();
+            paths.recordLight.clear();
+            paths.recordPdfEm.clear();
+            paths.recordRay.clear();
+
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = paths.surface[k];
+                const Intersection& its = paths.its[i];
+
+                float pdf_select;
+                const Emitter* light = scene->sampleEmitter(paths.lightSample1D[i], pdf_select);
+                EmitterQueryRecord lRec(its.p);
+                Color3f Le = light->sample(lRec, paths.lightSample[i], 0.);
+                float pdf_light = light->pdf(lRec);
+                if (!(pdf_light > 0) || !(Le.maxCoeff() > 0))
+                    continue;
+
+                paths.records.push_back(BSDFQueryRecord(its.toLocal(-paths.direction[i]),
+                    its.toLocal(lRec.wi), its.uv, ESolidAngle));
+                paths.recordPath.push_back(i);
+                paths.recordLight.push_back(Le / (pdf_select * pdf_light));
+                // Delta lights can't be reached by BSDF sampling (w_em = 1)
+                paths.recordPdfEm.push_back(light->isDelta() ? -1.f : pdf_select * pdf_light);
+                paths.recordRay.push_back(Ray3f(its.p, lRec.wi, Epsilon, lRec.dist - Epsilon));
+            }
+
+            size_t count = paths.records.size();
+            paths.recordValue.resize(count);
+            paths.recordPdf.resize(count);
+            bsdf->evalBatch(paths.records.data(), paths.recordValue.data(), count);
+            bsdf->pdfBatch(paths.records.data(), paths.recordPdf.data(), count);
+
+            for (size_t k = 0; k < count; ++k) {
+                uint32_t i = paths.recordPath[k];
+                const Ray3f& shadowRay = paths.recordRay[k];
+
+                Color3f fr_light = Color3f(paths.recordValue[k] * paths.its[i].shFrame.n.dot(shadowRay.d)).clamp();
+
+                float w_em = 1;
+                float p_em = paths.recordPdfEm[k];
+                if (p_em >= 0) {
+                    float p_mat = paths.recordPdf[k];
+                    w_em = (p_em + p_mat) > FLT_EPSILON ? p_em / (p_em + p_mat) : 0;
+                }
+
+                Color3f value = paths.throughput[i] * paths.recordLight[k] * fr_light * w_em;
+                if (!(value.maxCoeff() > 0))
+                    continue;
+
+                paths.shadowPath.push_back(i);
+                paths.shadowRay.push_back(shadowRay);
+                paths.shadowValue.push_back(value);
+            }
+        }
+    }
+
+    /// Stage 5: resolve the visibility of all light samples of the batch
+    void traceShadowRays(const Scene* scene, PathStates& paths) const
+    {
+        for (size_t k = 0; k < paths.shadowPath.size(); ++k) {
+            if (!scene->rayIntersect(paths.shadowRay[k]))
+                paths.radiance[paths.shadowPath[k]] += paths.shadowValue[k];
+        }
+    }
+
+    /// Stage 6: sample the BSDF at every surface hit to continue the paths
+    void sampleBSDFs(PathStates& paths) const
+    {
+        for (size_t begin = 0, end; begin < paths.surface.size(); begin = end) {
+            end = materialRunEnd(paths, begin);
+            const BSDF* bsdf = paths.bsdf[paths.surface[begin]];
+
+            paths.records.clear();
+            paths.recordSample.clear();
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = paths.surface[k];
+                const Intersection& its = paths.its[i];
+                paths.records.push_back(BSDFQueryRecord(its.toLocal(-paths.direction[i]), its.uv));
+                paths.recordSample.push_back(paths.bsdfSample[i]);
+            }
+
+            size_t count = end - begin;
+            paths.recordValue.resize(count);
+            paths.recordPdf.resize(count);
+            bsdf->sampleBatch(paths.records.data(), paths.recordSample.data(), paths.recordValue.data(), count);
+            bsdf->pdfBatch(paths.records.data(), paths.recordPdf.data(), count);
+
+            for (size_t k = 0; k < count; ++k) {
+                uint32_t i = paths.surface[begin + k];
+                const Intersection& its = paths.its[i];
+                const BSDFQueryRecord& bRec = paths.records[k];
+
+                paths.throughput[i] *= paths.recordValue[k];
+                paths.specular[i] = bRec.measure == EDiscrete;
+                paths.bsdfPdf[i] = paths.specular[i] ? 0.f : paths.recordPdf[k];
+
+                paths.origin[i] = its.p;
+                paths.direction[i] = its.toWorld(bRec.wo);
+                paths.mint[i] = Epsilon;
+                paths.maxt[i] = std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+
+    /// Stage 7: Russian roulette after the third bounce; survivors form the new active queue
+    void russianRoulette(PathStates& paths, int depth) const
+    {
+        paths.active.clear();
+        for (uint32_t i : paths.surface) {
+            Color3f& throughput = paths.throughput[i];
+            float rr_limit = std::min(0.9f, throughput.maxCoeff());
+            if (!(rr_limit > 0))
+                continue;
+            if (depth >= 3) {
+                if (paths.rrSample[i] >= rr_limit)
+                    continue;
+                throughput /= rr_limit;
+            }
+            paths.active.push_back(i);
+        }
+
+        /* Back to path order for the next bounce */
+        std::sort(paths.active.begin(), paths.active.end());
+    }
+
+    /**
+     * \brief MIS weight of a BSDF-sampled ray that reached \c emitter
+     *
+     * Balance heuristic against next event estimation, which includes the
+     * probability of selecting \c emitter. Camera rays and rays leaving a
+     * discrete BSDF sample could not have been generated by light sampling.
+     */
+    float misWeightBSDF(const Scene* scene, const Emitter* emitter,
+        const EmitterQueryRecord& lRec, const PathStates& paths, uint32_t i, int depth) const
+    {
+        if (depth == 0 || paths.specular[i])
+            return 1.f;
+        float p_mat = paths.bsdfPdf[i];
+        float p_em = scene->pdfEmitter(emitter) * emitter->pdf(lRec);
+        return (p_em + p_mat) > FLT_EPSILON ? p_mat / (p_em + p_mat) : 0;
+    }
+
+    int m_batchSize;
+};
+
+NORI_REGISTER_CLASS(PathTracingWavefront, "path_wavefront");
+NORI_NAMESPACE_END
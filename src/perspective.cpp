@@ -79,6 +79,14 @@ public:
             Eigen::DiagonalMatrix<float, 3>(Vector3f(-0.5f, -0.5f * aspect, 1.0f)) *
             Eigen::Translation<float, 3>(-1.0f, -1.0f/aspect, 0.0f) * perspective).inverse();
 
+        /* Area of the film on the plane at z=1 (for light tracing) */
+        m_cameraToSample = m_sampleToCamera.inverse();
+        Point3f p0 = m_sampleToCamera * Point3f(0.0f, 0.0f, 0.0f);
+        Point3f p1 = m_sampleToCamera * Point3f(1.0f, 1.0f, 0.0f);
+        p0 /= p0.z();
+        p1 /= p1.z();
+        m_filmArea = std::abs((p1.x() - p0.x()) * (p1.y() - p0.y()));
+
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
         if (!m_rfilter)
             m_rfilter = static_cast<ReconstructionFilter *>(
@@ -108,6 +116,39 @@ public:
         return Color3f(1.0f);
     }
 
+    Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+            Vector3f &wi, float &dist) const {
+        Point3f o = m_cameraToWorld * Point3f(0, 0, 0);
+        wi = o - ref;
+        dist = wi.norm();
+        wi /= dist;
+
+        /* Project onto the film */
+        Vector3f local = m_cameraToWorld.inverse() * Vector3f(-wi);
+        float cosTheta = local.z();
+        if (cosTheta <= 0 || dist * cosTheta < m_nearClip || dist * cosTheta > m_farClip)
+            return Color3f(0.0f);
+        Point3f sample = m_cameraToSample * Point3f(local.x(), local.y(), local.z());
+        if (sample.x() < 0 || sample.x() >= 1 || sample.y() < 0 || sample.y() >= 1)
+            return Color3f(0.0f);
+        samplePosition = Point2f(sample.x() * m_outputSize.x(), sample.y() * m_outputSize.y());
+
+        /* The response is 1 / (filmArea * cos^4), times cos / dist^2 */
+        float cos2 = cosTheta * cosTheta;
+        return Color3f(1.0f / (m_filmArea * cos2 * cosTheta * dist * dist));
+    }
+
+    float pdfDirection(const Vector3f &d) const {
+        Vector3f local = m_cameraToWorld.inverse() * d;
+        float cosTheta = local.z() / local.norm();
+        if (cosTheta <= 0)
+            return 0.0f;
+        Point3f sample = m_cameraToSample * Point3f(local.x(), local.y(), local.z());
+        if (sample.x() < 0 || sample.x() >= 1 || sample.y() < 0 || sample.y() >= 1)
+            return 0.0f;
+        return 1.0f / (m_filmArea * cosTheta * cosTheta * cosTheta);
+    }
+
     void addChild(NoriObject *obj, const std::string& name = "none") {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -143,6 +184,8 @@ public:
 private:
     Vector2f m_invOutputSize;
     Transform m_sampleToCamera;
+    Transform m_cameraToSample;
+    float m_filmArea;
     Transform m_cameraToWorld;
     float m_fov;
     float m_nearClip;
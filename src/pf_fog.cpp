@@ -26,7 +26,9 @@ public:
     /// Compute the density of \ref sample() wrt. solid angles
     float pdf(const PFQueryRecord&bRec) const {
         float g = m_g;
-        float denom = 1 + g * g + 2 * g * Frame::cosTheta(bRec.wo);
+        // Cosine of the scattering angle (wi points back along the incoming ray)
+        float cosTheta = -bRec.wi.dot(bRec.wo);
+        float denom = 1 + g * g - 2 * g * cosTheta;
         return INV_FOURPI * (1 - g * g) / (denom * std::sqrt(denom));
     }
 
@@ -46,14 +48,13 @@ public:
             1 - cosTheta * cosTheta));
         float phi = 2 * M_PI * sample[1];
         
-        bRec.wo = Vector3f(sinTheta * std::cos(phi),
+        // cosTheta is measured from the forward direction -wi
+        bRec.wo = Frame(-bRec.wi).toWorld(Vector3f(sinTheta * std::cos(phi),
             sinTheta * std::sin(phi),
-            cosTheta);
+            cosTheta));
 
-        //float pdf_sample = pdf(bRec);
-        float pdf_sample = 1; //We assume we sample perfectly the values -> No need to weight the sample
-
-        return eval(bRec) / pdf_sample;
+        // Henyey-Greenstein is sampled exactly, so eval() / pdf() is just the albedo
+        return m_cte_albedo;
     }
 
     /// Return a human-readable summary
@@ -62,6 +63,10 @@ public:
             "Diffuse with cte albedo\n");
     }
 
+    float getMeanCosine() const {
+        return m_g;
+    }
+
     void addChild(NoriObject* obj, const std::string& name = "none") {
         throw NoriException("Diffuse::addChild(<%s>) is not supported!",
                 classTypeName(obj->getClassType()));
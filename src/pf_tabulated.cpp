@@ -0,0 +1,264 @@
+/*
+*/
+
+#include <nori/pf.h>
+#include <nori/frame.h>
+#include <nori/distribution.h>
+#include <filesystem/resolver.h>
+#include <Eigen/Geometry>
+#include <fstream>
+#include <sstream>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Tabulated phase function (e.g. measured or Mie scattering)
+ *
+ * The phase function is given as a function of the scattering angle theta
+ * (0 = forward) and optionally of the azimuth phi around the forward
+ * direction, measured from the plane that contains the local z axis of
+ * the medium (for oriented, anisotropic media). Sources, by priority:
+ *
+ *   - "filename": text file with "theta value" or "theta phi value" lines
+ *     (degrees; 2D data has to be a full grid), '#' starts a comment
+ *   - "values": values at equally spaced theta from 0 to 180 degrees
+ *   - "g": Henyey-Greenstein with that mean cosine (e.g. for validation)
+ *
+ * At load time the data is resampled into bins uniform in theta
+ * ("resolution") and phi ("phiResolution"), normalized, and turned into a
+ * 2D distribution whose inverse CDF is precomputed. Sampling is then O(1)
+ * and exact with respect to \ref pdf(), which is constant inside of each
+ * bin (i.e. the interpolated data averaged over the bin).
+ */
+class PF_Tabulated : public PhaseFunction {
+public:
+    PF_Tabulated(const PropertyList &propList) {
+        m_thetaRes = propList.getInteger("resolution", 1024);
+
+        std::string filename = propList.getString("filename", "");
+        std::string values = propList.getString("values", "");
+        if (!filename.empty())
+            loadFile(getFileResolver()->resolve(filename).str());
+        else if (!values.empty())
+            parseValues(values);
+        else
+            tabulateHG(propList.getFloat("g", 0.f));
+
+        m_phiRes = propList.getInteger("phiResolution", m_phis.size() > 1 ? 64 : 1);
+        if (m_thetaRes < 1 || m_phiRes < 1)
+            throw NoriException("PF_Tabulated: the resolution must be positive!");
+        build();
+    }
+
+    Color3f eval(const PFQueryRecord &bRec) const {
+        return Color3f(pdf(bRec));
+    }
+
+    float pdf(const PFQueryRecord &bRec) const {
+        Vector3f local = scatteringFrame(bRec.wi).toLocal(bRec.wo);
+        float theta = std::acos(clamp(local.z(), -1.f, 1.f));
+        int i = std::min((int) (theta * INV_PI * m_thetaRes), m_thetaRes - 1);
+        int j = 0;
+        if (m_phiRes > 1) {
+            float phi = std::atan2(local.y(), local.x());
+            if (phi < 0)
+                phi += 2 * M_PI;
+            j = std::min((int) (phi * INV_TWOPI * m_phiRes), m_phiRes - 1);
+        }
+        return m_pdf[i * m_phiRes + j];
+    }
+
+    Color3f sample(PFQueryRecord &bRec, const Point2f &sample) const {
+        float pdf;
+        Point2f uv = m_distribution->SampleContinuous2(sample, &pdf);
+
+        // Uniform in cos(theta) inside of the theta bin
+        float v = uv.y() * m_thetaRes;
+        int i = std::min((int) v, m_thetaRes - 1);
+        float cosTheta = m_cosTheta[i] + (v - i) * (m_cosTheta[i + 1] - m_cosTheta[i]);
+        float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+        float phi = 2 * M_PI * uv.x();
+
+        bRec.wo = scatteringFrame(bRec.wi).toWorld(Vector3f(sinTheta * std::cos(phi),
+            sinTheta * std::sin(phi), cosTheta));
+
+        // Sampled exactly, so eval() / pdf() is one
+        return Color3f(1.f);
+    }
+
+    float getMeanCosine() const {
+        return m_meanCosine;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "PF_Tabulated[\n"
+            "  resolution = %i x %i,\n"
+            "  g = %f\n"
+            "]",
+            m_thetaRes, m_phiRes, m_meanCosine);
+    }
+
+protected:
+    /**
+     * Frame around the forward direction -wi, with phi = 0 towards the
+     * local z axis (any perpendicular axis if they are parallel)
+     */
+    static Frame scatteringFrame(const Vector3f &wi) {
+        Vector3f n = -wi;
+        Vector3f s = Vector3f(0, 0, 1) - n * n.z();
+        if (s.squaredNorm() < 1e-6f)
+            return Frame(n);
+        s.normalize();
+        return Frame(s, n.cross(s), n);
+    }
+
+    void loadFile(const std::string &filename) {
+        std::ifstream is(filename);
+        if (is.fail())
+            throw NoriException("PF_Tabulated: unable to open \"%s\"!", filename);
+
+        std::vector<std::vector<float>> rows;
+        std::string line;
+        while (std::getline(is, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream iss(line);
+            std::vector<float> row;
+            float value;
+            while (iss >> value)
+                row.push_back(value);
+            if (row.empty())
+                continue;
+            if (row.size() != 2 && row.size() != 3)
+                throw NoriException("PF_Tabulated: \"%s\" has a line with %i columns!", filename, row.size());
+            if (!rows.empty() && row.size() != rows[0].size())
+                throw NoriException("PF_Tabulated: \"%s\" mixes 1D and 2D data!", filename);
+            rows.push_back(row);
+        }
+        if (rows.empty())
+            throw NoriException("PF_Tabulated: \"%s\" is empty!", filename);
+
+        bool is2D = rows[0].size() == 3;
+        for (const auto &row : rows) {
+            m_thetas.push_back(row[0] * M_PI / 180.f);
+            m_phis.push_back(is2D ? row[1] * M_PI / 180.f : 0.f);
+        }
+        // Grid coordinates
+        for (auto *axis : { &m_thetas, &m_phis }) {
+            std::sort(axis->begin(), axis->end());
+            axis->erase(std::unique(axis->begin(), axis->end()), axis->end());
+        }
+        if (m_thetas.size() * m_phis.size() != rows.size())
+            throw NoriException("PF_Tabulated: the 2D data in \"%s\" is not a full grid!", filename);
+
+        m_values.assign(rows.size(), 0.f);
+        for (const auto &row : rows) {
+            size_t i = std::lower_bound(m_thetas.begin(), m_thetas.end(), row[0] * (float) M_PI / 180.f) - m_thetas.begin();
+            size_t j = std::lower_bound(m_phis.begin(), m_phis.end(), is2D ? row[1] * (float) M_PI / 180.f : 0.f) - m_phis.begin();
+            m_values[i * m_phis.size() + j] = std::max(row.back(), 0.f);
+        }
+    }
+
+    void parseValues(const std::string &values) {
+        std::istringstream iss(values);
+        std::string token;
+        while (iss >> token) {
+            std::istringstream tokens(token);
+            std::string value;
+            while (std::getline(tokens, value, ','))
+                if (!value.empty())
+                    m_values.push_back(std::max(toFloat(value), 0.f));
+        }
+        if (m_values.size() < 2)
+            throw NoriException("PF_Tabulated: at least two values are required!");
+        for (size_t i = 0; i < m_values.size(); ++i)
+            m_thetas.push_back(M_PI * i / (m_values.size() - 1));
+        m_phis.push_back(0.f);
+    }
+
+    void tabulateHG(float g) {
+        const int count = 4 * m_thetaRes + 1;
+        for (int i = 0; i < count; ++i) {
+            float theta = M_PI * i / (count - 1);
+            float denom = 1 + g * g - 2 * g * std::cos(theta);
+            m_thetas.push_back(theta);
+            m_values.push_back(INV_FOURPI * (1 - g * g) / (denom * std::sqrt(denom)));
+        }
+        m_phis.push_back(0.f);
+    }
+
+    /// Linear interpolation of the data along one axis
+    static void bracket(const std::vector<float> &axis, float x, int &i0, int &i1, float &t) {
+        i1 = (int) (std::lower_bound(axis.begin(), axis.end(), x) - axis.begin());
+        i1 = std::min(std::max(i1, 1), (int) axis.size() - 1);
+        i0 = i1 - 1;
+        if (axis.size() == 1) {
+            i0 = i1 = 0;
+            t = 0.f;
+            return;
+        }
+        t = clamp((x - axis[i0]) / (axis[i1] - axis[i0]), 0.f, 1.f);
+    }
+
+    float lookup(float theta, float phi) const {
+        int t0, t1, p0, p1;
+        float ft, fp;
+        bracket(m_thetas, theta, t0, t1, ft);
+        bracket(m_phis, phi, p0, p1, fp);
+        size_t n = m_phis.size();
+        return (1 - ft) * ((1 - fp) * m_values[t0 * n + p0] + fp * m_values[t0 * n + p1])
+            + ft * ((1 - fp) * m_values[t1 * n + p0] + fp * m_values[t1 * n + p1]);
+    }
+
+    void build() {
+        m_cosTheta.resize(m_thetaRes + 1);
+        for (int i = 0; i <= m_thetaRes; ++i)
+            m_cosTheta[i] = std::cos(M_PI * i / m_thetaRes);
+        m_cosTheta[m_thetaRes] = -1.f;
+
+        /* Value at the center of every bin, and its weight (integral over the bin) */
+        std::vector<float> weight(m_thetaRes * m_phiRes);
+        m_pdf.resize(m_thetaRes * m_phiRes);
+        float dPhi = 2 * M_PI / m_phiRes, integral = 0.f;
+        for (int i = 0; i < m_thetaRes; ++i) {
+            float theta = M_PI * (i + 0.5f) / m_thetaRes;
+            float dCos = m_cosTheta[i] - m_cosTheta[i + 1];
+            for (int j = 0; j < m_phiRes; ++j) {
+                float value = lookup(theta, dPhi * (j + 0.5f));
+                m_pdf[i * m_phiRes + j] = value;
+                weight[i * m_phiRes + j] = value * dCos;
+                integral += value * dCos * dPhi;
+            }
+        }
+        if (!(integral > 0))
+            throw NoriException("PF_Tabulated: the phase function is zero everywhere!");
+
+        m_meanCosine = 0.f;
+        for (int i = 0; i < m_thetaRes; ++i) {
+            float moment = 0.5f * (m_cosTheta[i] * m_cosTheta[i] - m_cosTheta[i + 1] * m_cosTheta[i + 1]);
+            for (int j = 0; j < m_phiRes; ++j) {
+                m_pdf[i * m_phiRes + j] /= integral;
+                m_meanCosine += m_pdf[i * m_phiRes + j] * moment * dPhi;
+            }
+        }
+        m_distribution.reset(new Distribution2D(weight.data(), m_phiRes, m_thetaRes));
+
+        // The input data isn't needed anymore
+        m_thetas.clear();
+        m_phis.clear();
+        m_values.clear();
+    }
+
+    int m_thetaRes, m_phiRes;
+    /// Input data on a (theta, phi) grid
+    std::vector<float> m_thetas, m_phis, m_values;
+    /// cos(theta) at the bin boundaries
+    std::vector<float> m_cosTheta;
+    /// Normalized phase function of every bin
+    std::vector<float> m_pdf;
+    std::unique_ptr<Distribution2D> m_distribution;
+    float m_meanCosine;
+};
+
+NORI_REGISTER_CLASS(PF_Tabulated, "pf_tabulated");
+NORI_NAMESPACE_END
@@ -1,4 +1,5 @@
 #include <nori/emitter.h>
+#include <nori/warp.h>
 NORI_NAMESPACE_BEGIN
 class PointEmitter : public Emitter
 {
@@ -40,6 +41,24 @@ public:
 		// that visibility should be taken care of in the integrator.
 		return m_radiance / (lRec.dist * lRec.dist);
 	}
+	// Photons are emitted uniformly in all directions; m_radiance is
+	// the intensity of the light, so the power is 4 pi times larger
+	virtual Color3f samplePhoton(EmitterQueryRecord& lRec, Ray3f& ray,
+		const Point2f& positionSample, const Point2f& directionSample) const
+	{
+		lRec.emitter = this;
+		lRec.p = m_position;
+		lRec.n = Normal3f(0.f);
+		ray = Ray3f(m_position, Warp::squareToUniformSphere(directionSample));
+		return m_radiance * 4 * M_PI;
+	}
+
+	virtual void pdfPhoton(const EmitterQueryRecord& lRec, const Vector3f& d,
+		float& pdfPosition, float& pdfDirection) const
+	{
+		pdfPosition = 1.f;
+		pdfDirection = INV_FOURPI;
+	}
 	// Note that the pdf should be infinite, but for numerical reasons
 	// it is more convenient to just leave as 1
 	virtual float pdf(const EmitterQueryRecord& lRec) const
@@ -52,11 +52,37 @@ NORI_NAMESPACE_BEGIN
 DEFINE_PROPERTY_ACCESSOR(bool, Boolean, boolean)
 DEFINE_PROPERTY_ACCESSOR(int, Integer, integer)
 DEFINE_PROPERTY_ACCESSOR(float, Float, float)
-DEFINE_PROPERTY_ACCESSOR(Color3f, Color, color)
 DEFINE_PROPERTY_ACCESSOR(Point3f, Point, point)
 DEFINE_PROPERTY_ACCESSOR(Vector3f, Vector, vector)
 DEFINE_PROPERTY_ACCESSOR(std::string, String, string)
 DEFINE_PROPERTY_ACCESSOR(Transform, Transform, transform)
 
+/* Colors are written by hand, since a <float> is also accepted as a gray color */
+void PropertyList::setColor(const std::string &name, const Color3f &value) {
+    if (m_properties.find(name) != m_properties.end())
+        cerr << "Property \"" << name <<  "\" was specified multiple times!" << endl;
+    auto &prop = m_properties[name];
+    prop.value.color_value = value;
+    prop.type = Property::color_type;
+}
+
+Color3f PropertyList::getColor(const std::string &name) const {
+    auto it = m_properties.find(name);
+    if (it == m_properties.end())
+        throw NoriException("Property '%s' is missing!", name);
+    if (it->second.type == Property::float_type)
+        return Color3f(it->second.value.float_value);
+    if (it->second.type != Property::color_type)
+        throw NoriException("Property '%s' has the wrong type! "
+            "(expected <color>)!", name);
+    return it->second.value.color_value;
+}
+
+Color3f PropertyList::getColor(const std::string &name, const Color3f &defVal) const {
+    if (m_properties.find(name) == m_properties.end())
+        return defVal;
+    return getColor(name);
+}
+
 NORI_NAMESPACE_END
 
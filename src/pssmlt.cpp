@@ -0,0 +1,202 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/dpdf.h>
+#include <nori/mltsampler.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Primary sample space Metropolis light transport (Kelemen et al. 2002)
+ *
+ * Wraps another integrator (given as a nested <tt>\<integrator\></tt>) and
+ * drives its \ref Integrator::Li() with an \ref MLTSampler, so that paths
+ * are explored by a Markov chain over the random numbers instead of being
+ * sampled independently. The chain state includes the film position, hence
+ * contributions land on arbitrary pixels and are splatted into the output.
+ *
+ * The normalization of the chains (the mean luminance of the image) is
+ * estimated in \ref preprocess() from a set of independent bootstrap
+ * samples, which also serve as start states of the chains. Every image
+ * block of every pass runs its own chain with as many mutations as the
+ * block has pixel samples, so many independent chains run in parallel on
+ * the rendering threads and the progressive passes work as usual.
+ *
+ * Contributions that the inner integrator splats itself (e.g. the light
+ * tracing strategies of <tt>bdpt</tt>) are not part of \ref Li() and are
+ * lost.
+ *
+ * Parameters:
+ *  - \c bootstrapSamples: number of bootstrap samples (default 100000)
+ *  - \c sigma: standard deviation of the small step mutations (default 0.01)
+ *  - \c largeStepProbability: probability of a large step (default 0.3)
+ */
+class PSSMLTIntegrator : public Integrator
+{
+public:
+    PSSMLTIntegrator(const PropertyList& props)
+    {
+        m_bootstrapSamples = props.getInteger("bootstrapSamples", 100000);
+        m_sigma = props.getFloat("sigma", 0.01f);
+        m_largeStepProbability = props.getFloat("largeStepProbability", 0.3f);
+        if (m_bootstrapSamples < 1)
+            throw NoriException("PSSMLTIntegrator: bootstrapSamples must be positive!");
+        if (m_largeStepProbability < 0 || m_largeStepProbability > 1)
+            throw NoriException("PSSMLTIntegrator: largeStepProbability must be in [0, 1]!");
+    }
+
+    ~PSSMLTIntegrator()
+    {
+        delete m_integrator;
+    }
+
+    void addChild(NoriObject* obj, const std::string& name = "none")
+    {
+        switch (obj->getClassType()) {
+        case EIntegrator:
+            if (m_integrator)
+                throw NoriException("PSSMLTIntegrator: tried to specify multiple inner integrators!");
+            m_integrator = static_cast<Integrator*>(obj);
+            break;
+
+        default:
+            throw NoriException("PSSMLTIntegrator::addChild(<%s>) is not supported!",
+                classTypeName(obj->getClassType()));
+        }
+    }
+
+    void activate()
+    {
+        if (!m_integrator)
+            throw NoriException("PSSMLTIntegrator: no inner integrator was specified!");
+    }
+
+    void preprocess(const Scene* scene)
+    {
+        m_integrator->preprocess(scene);
+
+        /* Bootstrap: independent samples, each one reproducible from the
+           stream index of its sampler */
+        std::vector<float> luminance(m_bootstrapSamples);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, luminance.size()),
+            [&](const tbb::blocked_range<size_t>& range) {
+                for (size_t i = range.begin(); i < range.end(); ++i) {
+                    MLTSampler sampler(i, m_sigma, m_largeStepProbability);
+                    Point2f pixel;
+                    luminance[i] = std::max(0.f, evaluate(scene, sampler, pixel).getLuminance());
+                }
+            }
+        );
+
+        m_bootstrap.clear();
+        m_bootstrap.reserve(luminance.size());
+        for (float value : luminance)
+            m_bootstrap.append(value);
+        m_b = m_bootstrap.normalize() / luminance.size();
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        return m_integrator->Li(scene, sampler, ray);
+    }
+
+    void renderBlock(const Scene* scene, Sampler* sampler, ImageBlock& block,
+        uint32_t sampleCount, int stride) const
+    {
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        /* Zero-valued samples, these only provide the reconstruction filter
+           weights that the splats are normalized by */
+        size_t mutations = 0;
+        for (int y = 0; y < size.y(); y += stride) {
+            for (int x = 0; x < size.x(); x += stride) {
+                for (uint32_t i = 0; i < sampleCount; ++i)
+                    block.put(Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D(),
+                        Color3f(0.f));
+                mutations += sampleCount;
+            }
+        }
+        if (m_b <= 0)
+            return;
+
+        /* Start the chain at a bootstrap sample chosen proportionally to its
+           luminance, then continue on a stream of its own. PCG32 ignores the
+           top bit of the stream index, so the chains take the ones after the
+           bootstrap streams 0..bootstrapSamples-1 */
+        size_t index = m_bootstrap.sample(sampler->next1D());
+        MLTSampler chain(index, m_sigma, m_largeStepProbability);
+        Point2f currentPixel;
+        Color3f current = evaluate(scene, chain, currentPixel);
+        chain.seed((uint64_t) m_bootstrapSamples + (((uint64_t) sampler->getPass() << 32)
+            | (uint64_t) (offset.y() * scene->getCamera()->getOutputSize().x() + offset.x())));
+
+        for (size_t i = 0; i < mutations; ++i) {
+            chain.startIteration();
+            Point2f proposedPixel;
+            Color3f proposed = evaluate(scene, chain, proposedPixel);
+
+            float currentLuminance = std::max(0.f, current.getLuminance());
+            float proposedLuminance = std::max(0.f, proposed.getLuminance());
+            float accept = currentLuminance > 0
+                ? std::min(1.f, proposedLuminance / currentLuminance) : 1.f;
+
+            /* Expected values: both states contribute according to the
+               acceptance probability */
+            if (accept > 0 && proposedLuminance > 0)
+                splat(proposedPixel, proposed * (accept * m_b / proposedLuminance));
+            if (accept < 1)
+                splat(currentPixel, current * ((1 - accept) * m_b / currentLuminance));
+
+            if (sampler->next1D() < accept) {
+                currentPixel = proposedPixel;
+                current = proposed;
+                chain.accept();
+            } else {
+                chain.reject();
+            }
+        }
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PSSMLTIntegrator[\n"
+            "  bootstrapSamples = %i,\n"
+            "  sigma = %f,\n"
+            "  largeStepProbability = %f,\n"
+            "  integrator = %s\n"
+            "]",
+            m_bootstrapSamples,
+            m_sigma,
+            m_largeStepProbability,
+            indent(m_integrator ? m_integrator->toString() : std::string("null")));
+    }
+private:
+    /// Evaluate the path described by the current state of \c sampler
+    Color3f evaluate(const Scene* scene, MLTSampler& sampler, Point2f& pixel) const
+    {
+        const Camera* camera = scene->getCamera();
+        Vector2i outputSize = camera->getOutputSize();
+        Point2f sample = sampler.next2D();
+        pixel = Point2f(sample.x() * outputSize.x(), sample.y() * outputSize.y());
+        Point2f apertureSample = sampler.next2D();
+
+        Ray3f ray;
+        Color3f value = camera->sampleRay(ray, pixel, apertureSample);
+        return value * m_integrator->Li(scene, &sampler, ray);
+    }
+
+    Integrator* m_integrator = nullptr;
+    int m_bootstrapSamples;
+    float m_sigma;
+    float m_largeStepProbability;
+    DiscretePDF m_bootstrap;
+    /// Mean luminance of the image
+    float m_b = 0.f;
+};
+
+NORI_REGISTER_CLASS(PSSMLTIntegrator, "pssmlt");
+NORI_NAMESPACE_END
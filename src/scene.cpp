@@ -25,6 +25,7 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
+#include <nori/bsdf.h>
 //  Because we have a medium inside here
 #include <nori/medium.h>
 
@@ -42,7 +43,8 @@ Scene::~Scene() {
     delete m_sampler;
     delete m_camera;
     delete m_integrator;
-    delete m_medium;
+    for (auto medium : m_media)
+        delete medium;
 }
 
 void Scene::activate() {
@@ -52,12 +54,20 @@ void Scene::activate() {
     for(unsigned int i=0; i<m_meshes.size(); ++i )
         if (m_meshes[i]->isEmitter())
             m_emitters.push_back(m_meshes[i]->getEmitter());
+    // Same for emissive media
+    for (Medium *medium : m_media)
+        if (medium->isEmitter())
+            m_emitters.push_back(medium->getEmitter());
 
     m_accel->build();
-    std::cout << "Accel Medium adding the medium bounding box \n";
-    if (m_medium) {
-        if (m_medium->getBoundingBoxAsMesh()) {
-            m_accel_medium->addMesh(m_medium->getBoundingBoxAsMesh());
+    std::cout << "Accel Medium adding the media bounding boxes \n";
+    for (Medium *medium : m_media) {
+        if (medium->getBoundingBoxAsMesh()) {
+            m_accel_medium->addMesh(medium->getBoundingBoxAsMesh());
+            m_boundedMedia.push_back(medium);
+        }
+        else {
+            m_unboundedMedia.push_back(medium);
         }
     }
     m_accel_medium->build();
@@ -92,65 +102,106 @@ float Scene::pdfEmitter(const Emitter *em) const {
 }
 
 
-/*Calculates first and second intersection with a medium
-* We assume only 1 medium in scene and that the medium only has a ingoing and outgoing point
-* but camera can be inside medium.
-* 3 Possible outcomes: 
-* No medium -> No intersection in m_accel_medium
-* Camera inside medium -> 1 intersection in m_accel_medium
-* Camera ouside medium -> 2 intersections in m_accel_medium
-* We also assume medIts.p is infinite if there's no intersection (enviroment)
-*/
-bool Scene::rayIntersectMedium(const Ray3f& ray, MediumIntersection& medIts) const {
-    if (!m_medium) {
-        return false;
+/* The boundaries of every medium are closed meshes, so a ray alternately
+   enters and leaves a medium at the crossings of its mesh, and it starts
+   inside if there's an odd number of crossings ahead of it */
+bool Scene::rayIntersectMedia(const Ray3f& ray, std::vector<MediumInterval>& intervals) const {
+    intervals.clear();
+    for (const Medium *medium : m_unboundedMedia)
+        intervals.push_back({ medium, ray.mint, ray.maxt });
+
+    if (!m_boundedMedia.empty()) {
+        std::vector<std::pair<float, n_UINT>> hits;
+        m_accel_medium->rayIntersectAll(Ray3f(ray.o, ray.d, ray.mint, std::numeric_limits<float>::infinity()), hits);
+        std::sort(hits.begin(), hits.end());
+
+        /* Distance where the ray entered each medium (NaN while outside) */
+        const float outside = std::numeric_limits<float>::quiet_NaN();
+        std::vector<float> entry(m_boundedMedia.size(), outside);
+        for (const auto &hit : hits)
+            entry[hit.second] = std::isnan(entry[hit.second]) ? ray.mint : outside;
+
+        for (const auto &hit : hits) {
+            if (hit.first >= ray.maxt)
+                break;
+            float &start = entry[hit.second];
+            if (std::isnan(start)) {
+                start = hit.first;
+            }
+            else {
+                if (start < hit.first)
+                    intervals.push_back({ m_boundedMedia[hit.second], start, hit.first });
+                start = outside;
+            }
+        }
+        for (size_t i = 0; i < m_boundedMedia.size(); ++i)
+            if (entry[i] < ray.maxt)
+                intervals.push_back({ m_boundedMedia[i], entry[i], ray.maxt });
     }
-    medIts.medium = m_medium;
 
-    if (!m_medium->getBoundingBoxAsMesh()) {
-        // There's no BoundingBox for the medium -> x is camera, xz is the intersection with an object
-        medIts.x = medIts.o;
-        medIts.xz = medIts.p;
-        return true;
+    std::sort(intervals.begin(), intervals.end(),
+        [](const MediumInterval &a, const MediumInterval &b) { return a.mint < b.mint; });
+    return !intervals.empty();
+}
+
+bool Scene::rayIntersectMedia(const Ray3f& ray, std::vector<MediumIntersection>& media) const {
+    std::vector<MediumInterval> intervals;
+    rayIntersectMedia(ray, intervals);
+
+    auto point = [&](float t) { return std::isfinite(t) ? ray(t) : Point3f(FLT_MAX); };
+    media.resize(intervals.size());
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        MediumIntersection &medIts = media[i];
+        medIts = MediumIntersection();
+        medIts.medium = intervals[i].medium;
+        medIts.o = ray.o;
+        medIts.p = point(ray.maxt);
+        medIts.x = point(intervals[i].mint);
+        medIts.xz = point(intervals[i].maxt);
     }
+    return !media.empty();
+}
 
-    Intersection start_its;
-    bool mediumFound = m_accel_medium->rayIntersect(ray, start_its, false);
-    if (mediumFound) {
-        // If we now create a ray that starts a little bit after that intersection, 
-        // we can call another one to find the end:
-        Ray3f end_ray(ray);
-        // That 0.01 should be FLT_EPSILON
-        end_ray.o = start_its.p + 0.01 * ray.d;
-        Intersection end_its;
-        bool endMediumFound = m_accel_medium->rayIntersect(end_ray, end_its, false);
-        if (endMediumFound) {
-            // its has a .p that is the start of the medium:
-            medIts.x = start_its.p;
-            medIts.xz = end_its.p;
-
-            // Check we didn't cross any phisical object in between.
-            // If dist(xz,o)> dist(p,o) -> bb_medium goes beyond p, so -> xz = p
-
-            if ((medIts.xz - medIts.o).norm() > (medIts.p - medIts.o).norm()) {
-                medIts.xz = medIts.p;
-            }
-            // If dist(x,o)> dist(p,o) -> bb_medium goes after p, so -> no medium seen in this ray
-            if ((medIts.x - medIts.o).norm() > (medIts.p - medIts.o).norm()) {
-                return false;
-            }
 
-        }
-        else {
-            // If we don't find the second intersection it's because the camera is 
-            // inside the bounding box, so the first intersection is the end of the medium
-            medIts.x = medIts.o;
-            medIts.xz = start_its.p;
-        }
-    }
+Color3f Scene::transmittance(const Point3f& p, const Point3f& q, Sampler* sampler) const {
+    Vector3f d = q - p;
+    float dist = d.norm();
+    if (!(dist > Epsilon))
+        return Color3f(1.f);
+    return transmittance(Ray3f(p, d / dist, Epsilon, dist - Epsilon), sampler);
+}
 
+Color3f Scene::transmittance(const Ray3f& ray, Sampler* sampler) const {
+    // Parts of the ray inside of media
+    std::vector<MediumInterval> intervals;
+    rayIntersectMedia(ray, intervals);
+
+    Color3f T(1.f);
+    Ray3f segment(ray);
+    while (true) {
+        Intersection its;
+        bool hit = m_accel->rayIntersect(segment, its, false);
+        if (hit && !its.mesh->getBSDF()->isNull())
+            return Color3f(0.f);
+
+        // Media intervals on this piece of the segment
+        float pieceEnd = hit ? its.t : segment.maxt;
+        for (const MediumInterval &interval : intervals) {
+            float start = std::max(segment.mint, interval.mint);
+            float end = std::min(pieceEnd, interval.maxt);
+            if (start < end) {
+                if (!std::isfinite(end))
+                    return Color3f(0.f); // Infinitely long path inside of the medium
+                T *= interval.medium->evalTransmittance(ray(start), ray(end), sampler);
+            }
+        }
 
-    return mediumFound;
+        if (!hit || !(T.maxCoeff() > 0))
+            return T;
+        // Continue behind the null surface
+        segment.mint = its.t + Epsilon;
+        segment.maxt = ray.maxt;
+    }
 }
 
 
@@ -165,9 +216,7 @@ void Scene::addChild(NoriObject *obj, const std::string& name) {
         
         case EMedium: {
             std::cout << "Medium Aded as child to scene\n";
-            if (m_medium)
-                throw NoriException("There can only be one medium per scene!");
-            m_medium = static_cast<Medium*>(obj);
+            m_media.push_back(static_cast<Medium*>(obj));
             // We should add the mesh here to m_accel_medium, but instead 
             // I do it in the activate function of scene.cpp
         }
@@ -0,0 +1,290 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/sdtree.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Marks the absence of a node in DTree::refineNode() */
+static const uint32_t NoNode = (uint32_t) -1;
+
+DTree::DTree() : m_nodes(1) { }
+
+Point2f DTree::dirToCanonical(const Vector3f &d) {
+    float cosTheta = std::min(std::max(d.z(), -1.0f), 1.0f);
+    float phi = std::atan2(d.y(), d.x());
+    if (phi < 0)
+        phi += 2 * M_PI;
+
+    return Point2f(
+        std::min((cosTheta + 1) * 0.5f, 1.0f - Epsilon),
+        std::min(phi * INV_TWOPI, 1.0f - Epsilon));
+}
+
+Vector3f DTree::canonicalToDir(const Point2f &p) {
+    float cosTheta = 2 * p.x() - 1;
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    float phi = 2 * M_PI * p.y();
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+Vector3f DTree::sample(Point2f sample) const {
+    if (!(getFlux() > 0))
+        return canonicalToDir(sample);
+
+    Point2f origin(0.0f);
+    float size = 1.0f;
+    uint32_t node = 0;
+    while (true) {
+        const float *s = m_nodes[node].sum;
+        float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0))
+            break;
+
+        /* Pick a column, then a quadrant within it, and reuse the sample */
+        float left = (s[0] + s[2]) / total;
+        int col;
+        if (sample.x() < left) {
+            col = 0;
+            sample.x() /= left;
+        } else {
+            col = 1;
+            sample.x() = (sample.x() - left) / (1 - left);
+        }
+
+        float colSum = s[col] + s[col + 2];
+        float bottom = colSum > 0 ? s[col] / colSum : 0.5f;
+        int row;
+        if (sample.y() < bottom) {
+            row = 0;
+            sample.y() /= bottom;
+        } else {
+            row = 1;
+            sample.y() = (sample.y() - bottom) / (1 - bottom);
+        }
+        sample = sample.cwiseMin(Point2f(1.0f - Epsilon));
+
+        int q = col + 2 * row;
+        size *= 0.5f;
+        origin += Point2f(col * size, row * size);
+        if (m_nodes[node].child[q] == 0)
+            break;
+        node = m_nodes[node].child[q];
+    }
+
+    return canonicalToDir(origin + sample * size);
+}
+
+float DTree::pdf(const Vector3f &d) const {
+    if (!(getFlux() > 0))
+        return INV_FOURPI;
+
+    Point2f p = dirToCanonical(d);
+    float density = 1.0f;
+    uint32_t node = 0;
+    while (true) {
+        const float *s = m_nodes[node].sum;
+        float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0))
+            break;
+
+        int col = p.x() >= 0.5f ? 1 : 0, row = p.y() >= 0.5f ? 1 : 0;
+        int q = col + 2 * row;
+        density *= 4 * s[q] / total;
+        if (m_nodes[node].child[q] == 0)
+            break;
+        p = Point2f(p.x() * 2 - col, p.y() * 2 - row);
+        node = m_nodes[node].child[q];
+    }
+
+    /* The cylindrical mapping preserves area: the square covers 4 pi sr */
+    return density * INV_FOURPI;
+}
+
+uint32_t DTree::getSlot(const Vector3f &d) const {
+    Point2f p = dirToCanonical(d);
+    uint32_t node = 0;
+    while (true) {
+        int col = p.x() >= 0.5f ? 1 : 0, row = p.y() >= 0.5f ? 1 : 0;
+        int q = col + 2 * row;
+        if (m_nodes[node].child[q] == 0)
+            return node * 4 + q;
+        p = Point2f(p.x() * 2 - col, p.y() * 2 - row);
+        node = m_nodes[node].child[q];
+    }
+}
+
+void DTree::build() {
+    /* Children are always stored after their parents */
+    for (size_t i = m_nodes.size(); i-- > 0; ) {
+        Node &node = m_nodes[i];
+        for (int q = 0; q < 4; ++q) {
+            if (node.child[q] == 0)
+                continue;
+            const float *s = m_nodes[node.child[q]].sum;
+            node.sum[q] = s[0] + s[1] + s[2] + s[3];
+        }
+    }
+}
+
+DTree DTree::refined(float threshold, int maxDepth) const {
+    DTree result;
+    result.refineNode(*this, 0, m_nodes[0].sum, getFlux(), threshold, 1, maxDepth, 0);
+    return result;
+}
+
+void DTree::refineNode(const DTree &source, uint32_t sourceNode, const float *flux,
+        float total, float threshold, int depth, int maxDepth, uint32_t node) {
+    if (!(total > 0) || depth >= maxDepth)
+        return;
+
+    for (int q = 0; q < 4; ++q) {
+        if (!(flux[q] > threshold * total))
+            continue;
+
+        uint32_t child = (uint32_t) m_nodes.size();
+        m_nodes.push_back(Node());
+        m_nodes[node].child[q] = child;
+
+        /* Continue with the flux of the source tree where it is refined
+           further, otherwise spread the flux of the quadrant uniformly */
+        float childFlux[4];
+        uint32_t sourceChild = NoNode;
+        if (sourceNode != NoNode && source.m_nodes[sourceNode].child[q] != 0) {
+            sourceChild = source.m_nodes[sourceNode].child[q];
+            for (int i = 0; i < 4; ++i)
+                childFlux[i] = source.m_nodes[sourceChild].sum[i];
+        } else {
+            for (int i = 0; i < 4; ++i)
+                childFlux[i] = flux[q] * 0.25f;
+        }
+
+        refineNode(source, sourceChild, childFlux, total, threshold, depth + 1, maxDepth, child);
+    }
+}
+
+SDTree::SDTree(const BoundingBox3f &bbox) : m_nodes(1), m_leaves(1) {
+    /* Use a slightly enlarged cube, so that splits produce well-shaped cells */
+    Point3f center = bbox.getCenter();
+    float extent = std::max((bbox.max - bbox.min).maxCoeff() * 0.505f, Epsilon);
+    m_bbox = BoundingBox3f(center - Vector3f(extent), center + Vector3f(extent));
+    updateOffsets();
+}
+
+uint32_t SDTree::getLeaf(const Point3f &p) const {
+    Point3f min = m_bbox.min, max = m_bbox.max;
+    uint32_t node = 0;
+    while (m_nodes[node].child[0] != 0) {
+        int axis = m_nodes[node].axis;
+        float mid = 0.5f * (min[axis] + max[axis]);
+        if (p[axis] < mid) {
+            max[axis] = mid;
+            node = m_nodes[node].child[0];
+        } else {
+            min[axis] = mid;
+            node = m_nodes[node].child[1];
+        }
+    }
+    return m_nodes[node].leaf;
+}
+
+size_t SDTree::getDirectionalNodeCount() const {
+    size_t count = 0;
+    for (const Leaf &leaf : m_leaves)
+        count += leaf.sampling.getNodeCount();
+    return count;
+}
+
+void SDTree::resetRecorder(Recorder &recorder) const {
+    recorder.flux.assign(m_slotCount, 0.0f);
+    recorder.samples.assign(m_leaves.size(), 0);
+}
+
+void SDTree::record(Recorder &recorder, uint32_t leaf, const Vector3f &d, float flux) const {
+    recorder.flux[m_offsets[leaf] + m_leaves[leaf].building.getSlot(d)] += flux;
+    recorder.samples[leaf]++;
+}
+
+void SDTree::accumulate(const Recorder &recorder) {
+    if (recorder.flux.size() != m_slotCount || recorder.samples.size() != m_leaves.size())
+        return; /* Unused recorder, or sized for an older structure */
+
+    for (size_t i = 0; i < m_leaves.size(); ++i) {
+        Leaf &leaf = m_leaves[i];
+        size_t slots = leaf.building.getSlotCount();
+        for (size_t s = 0; s < slots; ++s)
+            leaf.building.addFlux((uint32_t) s, recorder.flux[m_offsets[i] + s]);
+        leaf.samples += recorder.samples[i];
+    }
+}
+
+void SDTree::refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth) {
+    for (Leaf &leaf : m_leaves) {
+        leaf.building.build();
+        leaf.sampling = leaf.building;
+    }
+
+    size_t nodeCount = m_nodes.size();
+    for (size_t i = 0; i < nodeCount; ++i) {
+        if (m_nodes[i].child[0] == 0)
+            split((uint32_t) i, spatialThreshold);
+    }
+
+    for (Leaf &leaf : m_leaves) {
+        leaf.building = leaf.sampling.refined(directionalThreshold, maxDepth);
+        leaf.samples = 0;
+    }
+    updateOffsets();
+}
+
+void SDTree::split(uint32_t index, uint32_t threshold) {
+    uint32_t leafIndex = m_nodes[index].leaf;
+    if (m_leaves[leafIndex].samples <= threshold)
+        return;
+
+    /* Assume that the samples were spread evenly over both halves */
+    m_leaves[leafIndex].samples /= 2;
+    Leaf copy = m_leaves[leafIndex];
+    uint32_t copyIndex = (uint32_t) m_leaves.size();
+    m_leaves.push_back(copy);
+
+    Node child;
+    child.axis = (m_nodes[index].axis + 1) % 3;
+    uint32_t first = (uint32_t) m_nodes.size();
+    child.leaf = leafIndex;
+    m_nodes.push_back(child);
+    child.leaf = copyIndex;
+    m_nodes.push_back(child);
+    m_nodes[index].child[0] = first;
+    m_nodes[index].child[1] = first + 1;
+
+    split(first, threshold);
+    split(first + 1, threshold);
+}
+
+void SDTree::updateOffsets() {
+    m_offsets.resize(m_leaves.size());
+    m_slotCount = 0;
+    for (size_t i = 0; i < m_leaves.size(); ++i) {
+        m_offsets[i] = m_slotCount;
+        m_slotCount += m_leaves[i].building.getSlotCount();
+    }
+}
+
+NORI_NAMESPACE_END
@@ -4,14 +4,42 @@
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
 #include <nori/pf.h>
+#include <nori/lightcache.h>
 
 NORI_NAMESPACE_BEGIN
+
+/**
+ * Single scattering in a participating medium.
+ *
+ * Parameters:
+ *  - \c lightCache: bake the transmittance towards the emitters into a
+ *    grid over the medium in preprocess() and use it for inscattering
+ *    instead of shadow rays (see VolumeLightCache, default false).
+ *    \c lightCacheResolution (default 32) and \c lightCacheSamples
+ *    (default 16) control the grid.
+ *  - \c equiangular: instead of choosing between the surface and a
+ *    transmittance-sampled scattering point, always add the (attenuated)
+ *    surface and estimate the inscattering with one transmittance sample
+ *    and one equiangular sample towards a point on an emitter, combined
+ *    with the balance heuristic (default false)
+ */
 class SingleScat : public Integrator
 {
 public:
     SingleScat(const PropertyList& props)
     {
+        m_equiangular = props.getBoolean("equiangular", false);
+        m_lightCache = props.getBoolean("lightCache", false);
+        m_lightCacheResolution = props.getInteger("lightCacheResolution", 32);
+        m_lightCacheSamples = props.getInteger("lightCacheSamples", 16);
+        if (m_lightCacheResolution < 2 || m_lightCacheSamples < 1)
+            throw NoriException("SingleScat: invalid light cache resolution or sample count!");
+    }
 
+    void preprocess(const Scene* scene)
+    {
+        if (m_lightCache)
+            m_volumeLightCache.build(scene, m_lightCacheResolution, m_lightCacheSamples);
     }
     Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
     {
@@ -32,35 +60,56 @@ public:
         }
 
         Vector3f w = ray.d;
-        MediumIntersection medIts;
-        medIts.o = ray.o;
-        medIts.p = its.p;
-        bool mediumFound = scene->rayIntersectMedium(ray, medIts);
+        // Every medium between the camera and the surface, in order
+        std::vector<MediumIntersection> media;
+        Ray3f segment(ray);
+        segment.maxt = its.t;
+        bool mediumFound = scene->rayIntersectMedia(segment, media);
         if (!mediumFound) {
-            Ld = DirectLight(scene, sampler, its, medIts, ray);
+            Ld = DirectLight(scene, sampler, its, MediumIntersection(), ray);
             Lo = Le + Ld; // Ls is 0 (No medium -> no inscattering and transmittance = 1)
             return Lo;
         }
 
-        // Now medIts has .medium and information about intersection
-        scene->getMedium()->sampleBetween(sampler->next1D(), medIts);
-        bool sampledInsideMedium = false;
-        float t = medIts.distT; //(medIts.xt - medIts.x).norm();
-        float z = medIts.distZ;//(medIts.xt - medIts.xz).norm();
-        // Sampling outside of the medium->inside a mesh which means doing DirectLight
-        //std::cout << " z: " << z << " t" << t<<"\n";
-        sampledInsideMedium = ((t-z) < FLT_EPSILON); 
-
-        if (sampledInsideMedium) {
-            // Inscattering
-            Ls = medIts.medium->Transmittance(medIts.x, medIts.xt) * Inscattering(scene, sampler, medIts, ray) / medIts.prob;
+        // Transmittance up to the surface, and the emission of the media on the way
+        Color3f Tz(1.f), Lv(0.f);
+        for (const MediumIntersection& medIts : media) {
+            Lv += Tz * medIts.medium->evalEmission(medIts.x, medIts.xz);
+            Tz *= medIts.medium->Transmittance(medIts.x, medIts.xz);
+        }
+
+        if (m_equiangular) {
+            // Inscattering of every medium, attenuated by the media in front of it
+            Color3f T(1.f);
+            for (const MediumIntersection& medIts : media) {
+                Ls += T * InscatteringMIS(scene, sampler, medIts, ray);
+                T *= medIts.medium->Transmittance(medIts.x, medIts.xz);
+            }
+            Ld = Tz * DirectLight(scene, sampler, its, media.back(), ray);
+            return Ls + Ld + Le * Tz + Lv;
         }
-        else {
-            Ld = medIts.medium->Transmittance(medIts.x, medIts.xz) *  DirectLight(scene, sampler, its, medIts, ray)/medIts.prob;
+
+        // Sample a distance in each medium (in order) until one of them scatters
+        Color3f fr(1.f);
+        for (MediumIntersection& medIts : media) {
+            medIts.medium->sampleBetween(sampler->next1D(), medIts);
+            float t = medIts.distT; //(medIts.xt - medIts.x).norm();
+            float z = medIts.distZ;//(medIts.xt - medIts.xz).norm();
+            // Sampling outside of the medium->inside a mesh which means doing DirectLight
+            //std::cout << " z: " << z << " t" << t<<"\n";
+            bool sampledInsideMedium = ((t-z) < FLT_EPSILON);
+
+            if (sampledInsideMedium) {
+                // Inscattering
+                Ls = fr * medIts.medium->Transmittance(medIts.x, medIts.xt) * Inscattering(scene, sampler, medIts, ray) / medIts.prob;
+                return Ls + Le * Tz + Lv;
+            }
+            fr *= medIts.medium->Transmittance(medIts.x, medIts.xz) / medIts.prob;
         }
+        Ld = fr * DirectLight(scene, sampler, its, media.back(), ray);
 
         // We sum everything (emitter and Direct light are affected by same transmittance)
-        Lo = Ls + Ld + Le * medIts.medium->Transmittance(medIts.x, medIts.xz);
+        Lo = Ls + Ld + Le * Tz + Lv;
 
         return Lo;
     }
@@ -87,18 +136,12 @@ public:
         Color3f Le = light->sample(emitterRecordEms, sampler->next2D(), 0.);
 
         float pdf_light_point = light->pdf(emitterRecordEms);
-        Point3f xe = emitterRecordEms.p;
         
         //if (scene.isVisible(xe, xz))
-        Ray3f sray(xz, emitterRecordEms.wi);
-        Intersection it_shadow;
-        bool Visibility = true;
-        if (scene->rayIntersect(sray, it_shadow)) {
-            if (it_shadow.t < (emitterRecordEms.dist - 1.e-5)) {
-                //Then there's no visibility
-                Visibility = false;
-            }
-        }
+        // One traversal gives the visibility and the transmittance of the medium in between
+        Ray3f sray(xz, emitterRecordEms.wi, Epsilon, emitterRecordEms.dist - 1.e-5f);
+        Color3f Transmittance_em = scene->transmittance(sray, sampler);
+        bool Visibility = Transmittance_em.maxCoeff() > 0;
         
         BSDFQueryRecord bsdfRecordEms(its.toLocal(-ray.d),
             its.toLocal(emitterRecordEms.wi), its.uv, ESolidAngle);
@@ -110,18 +153,6 @@ public:
             p_mat_wem = its.mesh->getBSDF()->pdf(bsdfRecordEms);
 
             //Lems = Le * Transmittance(xz, xe) * xz.BRDF.eval(w, (xe - xz)) * cos(xe - xz, xz.n);
-            // But wait! We are not sure that the light is also in the medium or even that p is in the medium!
-            // So we can create a mediumIntersection to handle that:
-            MediumIntersection medIts_em;
-            medIts_em.o = xz; // Point in the intersection
-            medIts_em.p = xe; // Point in emitter
-            bool mediumFound_em = scene->rayIntersectMedium(sray, medIts_em);
-            // Now we have if there's a medium we put the correct Transmittance:
-            float Transmittance_em = 1;
-            if (mediumFound_em) {
-                Transmittance_em = medIts_em.medium->Transmittance(medIts_em.x, medIts_em.xz);
-            }
-
             Lems = Le * Transmittance_em * its.mesh->getBSDF()->eval(bsdfRecordEms) *
                 its.shFrame.n.dot(emitterRecordEms.wi) / p_em_wem;
         }
@@ -140,7 +171,6 @@ public:
         if (scene->rayIntersect(next_ray, it_next)) {
             if (it_next.mesh->isEmitter()) {
                 //xem = scene.intersect(Ray(xz,wo));
-                Point3f xem = it_next.p;
                 EmitterQueryRecord emitterRecordMat(it_next.mesh->getEmitter(), its.p, it_next.p, it_next.shFrame.n, it_next.uv);
                 
                 // Get p_em_wmat
@@ -149,15 +179,14 @@ public:
                 p_mat_wmat = its.mesh->getBSDF()->pdf(bsdfRecordMat);
 
 
-                MediumIntersection medIts_mats;
-                medIts_mats.o = xz; // Point in the intersection
-                medIts_mats.p = xem; // Point in emitter
-                bool mediumFound_mats = scene->rayIntersectMedium(next_ray, medIts_mats);
-                // Now we have if there's a medium we put the correct Transmittance:
-                float Transmittance_mats = 1;
-                if (mediumFound_mats) {
-                    Transmittance_mats = medIts_mats.medium->Transmittance(medIts_mats.x, medIts_mats.xz);
-                }
+                // Transmittance of the media between xz and the emitter
+                Color3f Transmittance_mats(1.f);
+                std::vector<MediumIntersection> media_mats;
+                Ray3f segment_mats(next_ray);
+                segment_mats.maxt = it_next.t;
+                scene->rayIntersectMedia(segment_mats, media_mats);
+                for (const MediumIntersection& medIts_mats : media_mats)
+                    Transmittance_mats *= medIts_mats.medium->Transmittance(medIts_mats.x, medIts_mats.xz);
 
                 // Lmat = xem.emit(xz) * Transmittance(xz, xem) * fs;
                 Lmat = it_next.mesh->getEmitter()->eval(emitterRecordMat) * Transmittance_mats * fs;
@@ -172,7 +201,11 @@ public:
         //Compute the weights
         float w_em = 0;
         float w_mat = 0;
-        if ((p_em_wem + p_mat_wem) > FLT_EPSILON) {
+        // Delta lights can't be hit by the sampled direction, so the emitter sample takes all
+        if (light->isDelta()) {
+            w_em = 1;
+        }
+        else if ((p_em_wem + p_mat_wem) > FLT_EPSILON) {
             w_em = p_em_wem / (p_em_wem + p_mat_wem);
             // Lems was divided by p_em_wem before, so now it multiplies
         }
@@ -203,18 +236,16 @@ public:
         EmitterQueryRecord emitterRecordEms(xt);
         Color3f Le = light->sample(emitterRecordEms, sampler->next2D(), 0.);
         float pdf_light_point = light->pdf(emitterRecordEms);
-        Point3f xe = emitterRecordEms.p;
+
+        // The light cache replaces the shadow ray and the transmittance
+        Color3f cachedTransmittance;
+        bool cached = m_lightCache && m_volumeLightCache.lookup(xt, light, cachedTransmittance);
 
         //if (scene.isVisible(xe, xt))
-        Ray3f sray(xt, emitterRecordEms.wi);
-        Intersection it_shadow;
-        bool Visibility = true;
-        if (scene->rayIntersect(sray, it_shadow)) {
-            if (it_shadow.t < (emitterRecordEms.dist - 1.e-5)) {
-                //Then there's no visibility
-                Visibility = false;
-            }
-        }
+        // One traversal gives the visibility and the transmittance of the medium in between
+        Color3f Transmittance_em = cached ? cachedTransmittance
+            : scene->transmittance(Ray3f(xt, emitterRecordEms.wi, Epsilon, emitterRecordEms.dist - 1.e-5f), sampler);
+        bool Visibility = Transmittance_em.maxCoeff() > 0;
         //PFQueryRecord phaseRecordEms(its.toLocal(-ray.d), its.toLocal(emitterRecordEms.wi), its.uv, ESolidAngle); //
         PFQueryRecord phaseRecordEms(medIts.toLocal(-ray.d), medIts.toLocal(emitterRecordEms.wi));
 
@@ -228,25 +259,15 @@ public:
             // WARNING: GetPhaseFuntion will ned a phaseRecordEms that is correctly defined
             p_mat_wem = medIts.medium->getPhaseFunction()->pdf(phaseRecordEms);
 
-            MediumIntersection medIts_em;
-            medIts_em.o = xt; // Point in the intersection
-            medIts_em.p = xe; // Point in emitter
-            bool mediumFound_em = scene->rayIntersectMedium(sray, medIts_em);
-            // Now we have if there's a medium we put the correct Transmittance:
-            float Transmittance_em = 1;
-            if (mediumFound_em) {
-                Transmittance_em = medIts_em.medium->Transmittance(medIts_em.x, medIts_em.xz);
-            }
-
             //Lems = Le * Transmittance(xt, xe) * xt.PF.eval(w, (xe - xt)) * mu_s;
             // We only check for medium in Transmittance cause in xt we assured before there's a medium
             // That's also why there we use medIts. The phase function and scattering coeficient are important for
-            Lems = Le * Transmittance_em * medIts.medium->getPhaseFunction()->eval(phaseRecordEms) * medIts.medium->getScatteringCoeficient() / p_em_wem;
+            Lems = Le * Transmittance_em * medIts.medium->getPhaseFunction()->eval(phaseRecordEms) * medIts.medium->getScatteringCoeficient(medIts.xt) / p_em_wem;
 
             if (isnan(Lems[0]) || isnan(Lems[1]) || isnan(Lems[2])) {
                 std::cout << "Lems is nan \n";
                 std::cout << "Le " << Le.toString() << " ; pf_eval " << medIts.medium->getPhaseFunction()->eval(phaseRecordEms).toString();
-                std::cout << " ; mu_s " << medIts.medium->getScatteringCoeficient() << " ; p_em_wem " << p_em_wem;
+                std::cout << " ; mu_s " << medIts.medium->getScatteringCoeficient(medIts.xt) << " ; p_em_wem " << p_em_wem;
                 std::cout << "pdf_light " << pdf_light << " ; pdf_light_point "<< pdf_light_point<<"\n";
             }
         }
@@ -268,7 +289,6 @@ public:
         if (scene->rayIntersect(next_ray, it_next)) {
             if (it_next.mesh->isEmitter()) {
                 //xem = scene.intersect(Ray(xz,wo));
-                Point3f xem = it_next.p;
                 //Lmat = xem.emit(xt) * Transmittance(xt, xem) * fs * mu_s;
                 EmitterQueryRecord emitterRecordMat(it_next.mesh->getEmitter(), medIts.xt, it_next.p, it_next.shFrame.n, it_next.uv);
 
@@ -277,17 +297,16 @@ public:
                 //Compute the p_mat(sample mats)
                 p_mat_wmat = medIts.medium->getPhaseFunction()->pdf(phaseRecordMats);
 
-                MediumIntersection medIts_mats;
-                medIts_mats.o = xt; // Point in the intersection
-                medIts_mats.p = xem; // Point in emitter
-                bool mediumFound_mats = scene->rayIntersectMedium(next_ray, medIts_mats);
-                // Now we have if there's a medium we put the correct Transmittance:
-                float Transmittance_mats = 1;
-                if (mediumFound_mats) {
-                    Transmittance_mats = medIts_mats.medium->Transmittance(medIts_mats.x, medIts_mats.xz);
-                }
-
-                Lmat = it_next.mesh->getEmitter()->eval(emitterRecordMat) * fs * Transmittance_mats * medIts.medium->getScatteringCoeficient();
+                // Transmittance of the media between xt and the emitter
+                Color3f Transmittance_mats(1.f);
+                std::vector<MediumIntersection> media_mats;
+                Ray3f segment_mats(next_ray);
+                segment_mats.maxt = it_next.t;
+                scene->rayIntersectMedia(segment_mats, media_mats);
+                for (const MediumIntersection& medIts_mats : media_mats)
+                    Transmittance_mats *= medIts_mats.medium->Transmittance(medIts_mats.x, medIts_mats.xz);
+
+                Lmat = it_next.mesh->getEmitter()->eval(emitterRecordMat) * fs * Transmittance_mats * medIts.medium->getScatteringCoeficient(medIts.xt);
             }
         }
 
@@ -299,7 +318,11 @@ public:
         //Compute the weights
         float w_em = 0;
         float w_mat = 0;
-        if ((p_em_wem + p_mat_wem) > FLT_EPSILON) {
+        // Delta lights can't be hit by the sampled direction, so the emitter sample takes all
+        if (light->isDelta()) {
+            w_em = 1;
+        }
+        else if ((p_em_wem + p_mat_wem) > FLT_EPSILON) {
             w_em = p_em_wem / (p_em_wem + p_mat_wem);
             // Lems was divided by p_em_wem before, so now it multiplies
         }
@@ -316,11 +339,60 @@ public:
         return Lems * w_em + Lmat * w_mat;
     }
 
+    /*
+    * Inscattering along the medium segment of medIts. One scattering point is sampled
+    * proportionally to the transmittance, another one by equiangular sampling around
+    * a point on an emitter; both are weighted with the balance heuristic.
+    */
+    Color3f InscatteringMIS(const Scene* scene, Sampler* sampler, const MediumIntersection& medIts, const Ray3f& ray) const {
+        const Medium* medium = medIts.medium;
+        Color3f Ls(0.);
+
+        // Center of the equiangular sampling (emitters at infinity have none)
+        float pdf_light;
+        const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_light);
+        EmitterQueryRecord anchorRecord(medIts.x);
+        light->sample(anchorRecord, sampler->next2D(), 0.);
+        bool hasAnchor = std::isfinite(anchorRecord.dist);
+
+        // Transmittance sampling
+        MediumIntersection medIts_t = medIts;
+        medium->sampleBetween(sampler->next1D(), medIts_t);
+        if (medIts_t.distT < medIts_t.distZ) {
+            float p_eq = hasAnchor ? Medium::pdfEquiangular(anchorRecord.p, medIts_t, medIts_t.distT) : 0.f;
+            Ls += medium->Transmittance(medIts_t.x, medIts_t.xt) * Inscattering(scene, sampler, medIts_t, ray) / (medIts_t.prob + p_eq);
+        }
+
+        // Equiangular sampling (the frame is the one of the medium)
+        if (hasAnchor) {
+            MediumIntersection medIts_eq = medIts_t;
+            Medium::sampleEquiangular(sampler->next1D(), anchorRecord.p, medIts_eq);
+            if (medIts_eq.prob > 0) {
+                float p_t = medium->pdfBetween(medIts_eq, medIts_eq.distT);
+                Ls += medium->Transmittance(medIts_eq.x, medIts_eq.xt) * Inscattering(scene, sampler, medIts_eq, ray) / (medIts_eq.prob + p_t);
+            }
+        }
+        return Ls;
+    }
+
     std::string toString() const
     {
-        return "Single Scattering Integrator []";
+        return tfm::format(
+            "SingleScat[\n"
+            "  equiangular = %s,\n"
+            "  lightCache = %s\n"
+            "]",
+            m_equiangular ? "true" : "false",
+            m_lightCache ? "true" : "false");
     }
 
+private:
+    bool m_equiangular;
+    bool m_lightCache;
+    int m_lightCacheResolution;
+    int m_lightCacheSamples;
+    VolumeLightCache m_volumeLightCache;
+
 };
 NORI_REGISTER_CLASS(SingleScat,"single_scat");
 NORI_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,512 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <atomic>
+#include <memory>
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Stochastic progressive photon mapping (Hachisuka and Jensen 2009)
+ *
+ * \ref preprocess() runs a number of iterations, each of which
+ *  1. traces one camera path per pixel through specular (zero roughness)
+ *     bounces and keeps its first glossy or diffuse vertex (visible point),
+ *  2. inserts all visible points into a spatial hash grid (built in
+ *     parallel with a counting sort),
+ *  3. traces \c photonsPerIteration photons from \ref Emitter::samplePhoton()
+ *     in parallel, adding their flux to the visible points around every
+ *     hit (photons are never stored, so the memory use does not depend on
+ *     the photon count),
+ *  4. shrinks the gather radius of every pixel by the factor \c alpha.
+ *
+ * Photons only account for indirect illumination. Emission that reaches the
+ * camera along the specular chain and direct illumination of the visible
+ * point are computed by \ref Li() while rendering, so that they are
+ * anti-aliased with the regular sample count. The photon estimate of the
+ * pixel is added to every sample.
+ *
+ * Environment emitters can't emit photons, they only contribute direct
+ * illumination.
+ *
+ * Parameters:
+ *  - \c iterations: number of photon passes (default 64)
+ *  - \c photonsPerIteration: photons per pass (default 250000)
+ *  - \c initialRadius: gather radius of the first pass (default 0.5% of the
+ *    scene diagonal)
+ *  - \c alpha: fraction of the new photons that is kept per pass (default 2/3)
+ *  - \c maxDepth: maximum number of bounces of camera paths and photons
+ *    (default 16)
+ */
+class SPPMIntegrator : public Integrator
+{
+public:
+    SPPMIntegrator(const PropertyList& props)
+    {
+        m_iterations = props.getInteger("iterations", 64);
+        m_photonsPerIteration = props.getInteger("photonsPerIteration", 250000);
+        m_initialRadius = props.getFloat("initialRadius", 0.f);
+        m_alpha = props.getFloat("alpha", 2.f / 3.f);
+        m_maxDepth = props.getInteger("maxDepth", 16);
+        if (m_iterations < 0 || m_photonsPerIteration < 1)
+            throw NoriException("SPPMIntegrator: invalid iteration or photon count!");
+        if (m_alpha <= 0 || m_alpha > 1)
+            throw NoriException("SPPMIntegrator: alpha must be in (0, 1]!");
+    }
+
+    void preprocess(const Scene* scene)
+    {
+        const Camera* camera = scene->getCamera();
+        m_outputSize = camera->getOutputSize();
+        size_t pixelCount = (size_t) m_outputSize.x() * m_outputSize.y();
+        m_photonRadiance.assign(pixelCount, Color3f(0.f));
+        if (scene->getLights().empty() || m_iterations == 0)
+            return;
+
+        float radius = m_initialRadius > 0 ? m_initialRadius
+            : 0.005f * scene->getBoundingBox().getExtents().norm();
+        std::vector<Pixel> pixels(pixelCount);
+        for (Pixel& pixel : pixels)
+            pixel.radius = radius;
+
+        BlockGenerator blockGenerator(m_outputSize, NORI_BLOCK_SIZE);
+        VisiblePointGrid grid;
+        double photonCount = 0;
+
+        for (int iteration = 0; iteration < m_iterations; ++iteration) {
+            traceVisiblePoints(scene, blockGenerator, pixels, iteration);
+            grid.build(pixels);
+            tracePhotons(scene, grid, pixels, iteration);
+            photonCount += m_photonsPerIteration;
+
+            /* Progressive radius reduction */
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, pixelCount),
+                [&](const tbb::blocked_range<size_t>& range) {
+                    for (size_t i = range.begin(); i < range.end(); ++i) {
+                        Pixel& pixel = pixels[i];
+                        int M = pixel.M.exchange(0);
+                        Color3f phi(pixel.phi[0].exchange(0.f), pixel.phi[1].exchange(0.f), pixel.phi[2].exchange(0.f));
+                        if (M == 0)
+                            continue;
+
+                        float N = pixel.N + m_alpha * M;
+                        float radius = pixel.radius * std::sqrt(N / (pixel.N + M));
+                        float shrink = (radius * radius) / (pixel.radius * pixel.radius);
+                        pixel.tau = (pixel.tau + pixel.vp.beta * phi) * shrink;
+                        pixel.N = N;
+                        pixel.radius = radius;
+                    }
+                }
+            );
+        }
+
+        for (size_t i = 0; i < pixelCount; ++i) {
+            const Pixel& pixel = pixels[i];
+            m_photonRadiance[i] = pixel.tau / (float) (photonCount * M_PI * pixel.radius * pixel.radius);
+        }
+
+        cout << tfm::format("Photon mapping: %i iterations, %.0f photons", m_iterations, photonCount) << endl;
+    }
+
+    /// Emission along the specular chain plus direct illumination at the visible point
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const
+    {
+        Color3f Lo(0.);
+        Color3f fr(1.f);
+        Ray3f next_ray = ray;
+
+        for (int depth = 0; depth < m_maxDepth && fr.maxCoeff() > 0; ++depth) {
+            Intersection its;
+            if (!scene->rayIntersect(next_ray, its)) {
+                Lo += fr * scene->getBackground(next_ray);
+                break;
+            }
+
+            if (its.mesh->isEmitter()) {
+                const Emitter* emitter = its.mesh->getEmitter();
+                Lo += fr * emitter->eval(EmitterQueryRecord(emitter, next_ray.o, its.p, its.shFrame.n, its.uv));
+                break;
+            }
+
+            const BSDF* bsdf = getBSDF(its);
+            Vector3f wi = its.toLocal(-next_ray.d);
+
+            if (bsdf->getRoughness(its.uv) > 0) {
+                float pdf_select;
+                const Emitter* light = scene->sampleEmitter(sampler->next1D(), pdf_select);
+                EmitterQueryRecord lRec(its.p);
+                Color3f Le = light->sample(lRec, sampler->next2D(), 0.);
+                float p_em = pdf_select * light->pdf(lRec);
+                if (p_em > 0 && Le.maxCoeff() > 0
+                    && !scene->rayIntersect(Ray3f(its.p, lRec.wi, Epsilon, lRec.dist - Epsilon))) {
+                    BSDFQueryRecord bRec(wi, its.toLocal(lRec.wi), its.uv, ESolidAngle);
+                    Color3f f = Color3f(bsdf->eval(bRec) * its.shFrame.n.dot(lRec.wi)).clamp();
+                    Lo += fr * Le * f / p_em;
+                }
+                break;
+            }
+
+            BSDFQueryRecord bRec(wi, its.uv);
+            fr *= bsdf->sample(bRec, sampler->next2D());
+            next_ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return Lo;
+    }
+
+    void renderBlock(const Scene* scene, Sampler* sampler, ImageBlock& block,
+        uint32_t sampleCount, int stride) const
+    {
+        const Camera* camera = scene->getCamera();
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        for (int y = 0; y < size.y(); y += stride) {
+            for (int x = 0; x < size.x(); x += stride) {
+                Color3f photons(0.f);
+                if (!m_photonRadiance.empty())
+                    photons = m_photonRadiance[(size_t) (y + offset.y()) * m_outputSize.x() + x + offset.x()];
+
+                for (uint32_t i = 0; i < sampleCount; ++i) {
+                    Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                    Point2f apertureSample = sampler->next2D();
+
+                    Ray3f ray;
+                    Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                    value *= Li(scene, sampler, ray);
+                    block.put(pixelSample, value + photons);
+                }
+            }
+        }
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "SPPMIntegrator[\n"
+            "  iterations = %i,\n"
+            "  photonsPerIteration = %i,\n"
+            "  initialRadius = %f,\n"
+            "  alpha = %f,\n"
+            "  maxDepth = %i\n"
+            "]",
+            m_iterations,
+            m_photonsPerIteration,
+            m_initialRadius,
+            m_alpha,
+            m_maxDepth);
+    }
+
+protected:
+    /// Number of photons traced by one task of the photon pass
+    static const int PhotonChunkSize = 4096;
+
+    /// First glossy or diffuse vertex of a camera path
+    struct VisiblePoint {
+        Point3f p;
+        /// Local direction towards the camera
+        Vector3f wi;
+        Frame frame;
+        Point2f uv;
+        /// nullptr if the camera path didn't find a vertex
+        const BSDF* bsdf = nullptr;
+        /// Throughput of the camera path
+        Color3f beta;
+    };
+
+    /// Per-pixel photon mapping statistics
+    struct Pixel {
+        float radius = 0;
+        /// Accumulated flux (already scaled to the current radius)
+        Color3f tau = Color3f(0.f);
+        /// Accumulated photon count
+        float N = 0;
+        VisiblePoint vp;
+        /// Flux and photon count of the current iteration
+        std::atomic<float> phi[3];
+        std::atomic<int> M;
+
+        Pixel() : M(0)
+        {
+            for (int i = 0; i < 3; ++i)
+                phi[i] = 0.f;
+        }
+    };
+
+    /**
+     * \brief Spatial hash grid of visible points
+     *
+     * Every visible point is inserted into all cells that its gather sphere
+     * overlaps. Buckets are stored contiguously: one task counts the entries
+     * of every bucket, a prefix sum yields the bucket offsets, and a second
+     * task writes the entries.
+     */
+    class VisiblePointGrid {
+    public:
+        void build(const std::vector<Pixel>& pixels)
+        {
+            m_bounds.reset();
+            float maxRadius = 0;
+            for (const Pixel& pixel : pixels) {
+                if (!pixel.vp.bsdf)
+                    continue;
+                m_bounds.expandBy(pixel.vp.p - Vector3f(pixel.radius));
+                m_bounds.expandBy(pixel.vp.p + Vector3f(pixel.radius));
+                maxRadius = std::max(maxRadius, pixel.radius);
+            }
+
+            size_t bucketCount = std::max((size_t) 1, pixels.size());
+            m_offsets.assign(bucketCount + 1, 0);
+            m_entries.clear();
+            if (!m_bounds.isValid() || !(maxRadius > 0))
+                return;
+
+            /* Cells are at least as large as the largest gather sphere's
+               radius, so a sphere never spans more than 3 cells per axis */
+            Vector3f extents = m_bounds.getExtents();
+            for (int i = 0; i < 3; ++i)
+                m_resolution[i] = std::max(1, std::min(1 << 20, (int) std::floor(extents[i] / maxRadius)));
+
+            std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[bucketCount]);
+            for (size_t i = 0; i < bucketCount; ++i)
+                counts[i] = 0;
+
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, pixels.size()),
+                [&](const tbb::blocked_range<size_t>& range) {
+                    for (size_t i = range.begin(); i < range.end(); ++i)
+                        forEachBucket(pixels[i], [&](uint32_t bucket) { counts[bucket]++; });
+                }
+            );
+
+            for (size_t i = 0; i < bucketCount; ++i) {
+                m_offsets[i + 1] = m_offsets[i] + counts[i];
+                counts[i] = m_offsets[i];
+            }
+            m_entries.resize(m_offsets[bucketCount]);
+
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, pixels.size()),
+                [&](const tbb::blocked_range<size_t>& range) {
+                    for (size_t i = range.begin(); i < range.end(); ++i)
+                        forEachBucket(pixels[i], [&](uint32_t bucket) { m_entries[counts[bucket]++] = (uint32_t) i; });
+                }
+            );
+        }
+
+        /// Return the range of pixel indices that may contain visible points around \c p
+        bool lookup(const Point3f& p, const uint32_t*& begin, const uint32_t*& end) const
+        {
+            if (m_entries.empty() || !m_bounds.contains(p))
+                return false;
+            uint32_t bucket = hash(cell(p));
+            begin = m_entries.data() + m_offsets[bucket];
+            end = m_entries.data() + m_offsets[bucket + 1];
+            return begin != end;
+        }
+
+    private:
+        Vector3i cell(const Point3f& p) const
+        {
+            Vector3f rel = (p - m_bounds.min).cwiseQuotient(m_bounds.getExtents());
+            Vector3i result;
+            for (int i = 0; i < 3; ++i)
+                result[i] = std::min(m_resolution[i] - 1, std::max(0, (int) (rel[i] * m_resolution[i])));
+            return result;
+        }
+
+        uint32_t hash(const Vector3i& c) const
+        {
+            uint32_t h = ((uint32_t) c.x() * 73856093u) ^ ((uint32_t) c.y() * 19349663u) ^ ((uint32_t) c.z() * 83492791u);
+            return h % (uint32_t) (m_offsets.size() - 1);
+        }
+
+        /// Call \c f once for every bucket that the gather sphere of \c pixel overlaps
+        template <typename Functor>
+        void forEachBucket(const Pixel& pixel, const Functor& f) const
+        {
+            if (!pixel.vp.bsdf)
+                return;
+            Vector3i lo = cell(pixel.vp.p - Vector3f(pixel.radius));
+            Vector3i hi = cell(pixel.vp.p + Vector3f(pixel.radius));
+
+            /* Cells are at least maxRadius wide, so a sphere overlaps at most
+               3x3x3 of them; skip cells that land in a bucket twice, otherwise
+               photons would be counted twice */
+            uint32_t buckets[27];
+            int count = 0;
+            for (int z = lo.z(); z <= hi.z(); ++z)
+                for (int y = lo.y(); y <= hi.y(); ++y)
+                    for (int x = lo.x(); x <= hi.x(); ++x) {
+                        uint32_t bucket = hash(Vector3i(x, y, z));
+                        if (std::find(buckets, buckets + count, bucket) != buckets + count)
+                            continue;
+                        if (count < 27)
+                            buckets[count++] = bucket;
+                        f(bucket);
+                    }
+        }
+
+        BoundingBox3f m_bounds;
+        Vector3i m_resolution = Vector3i(1, 1, 1);
+        std::vector<size_t> m_offsets;
+        std::vector<uint32_t> m_entries;
+    };
+
+    /// BSDF of the intersected mesh, with the shading frame perturbed by its normal map
+    static const BSDF* getBSDF(Intersection& its)
+    {
+        const BSDF* bsdf = its.mesh->getBSDF();
+        if (bsdf->hasDisplacementMap()) {
+            its.shading.n = its.shFrame.n + bsdf->displacement(its.uv);
+            its.shFrame = Frame(its.shading.n);
+        }
+        return bsdf;
+    }
+
+    /// Find the visible point of every pixel
+    void traceVisiblePoints(const Scene* scene, const BlockGenerator& blockGenerator,
+        std::vector<Pixel>& pixels, int iteration) const
+    {
+        const Camera* camera = scene->getCamera();
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+            [&](const tbb::blocked_range<int>& range) {
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+                sampler->setPass(std::numeric_limits<uint32_t>::max() - 1 - (uint32_t) iteration);
+
+                for (int i = range.begin(); i < range.end(); ++i) {
+                    Point2i offset;
+                    Vector2i size;
+                    blockGenerator.getBlock(i, offset, size);
+                    block.setOffset(offset);
+                    block.setSize(size);
+                    sampler->prepare(block);
+
+                    for (int y = 0; y < size.y(); ++y) {
+                        for (int x = 0; x < size.x(); ++x) {
+                            Pixel& pixel = pixels[(size_t) (y + offset.y()) * m_outputSize.x() + x + offset.x()];
+                            pixel.vp.bsdf = nullptr;
+
+                            Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                            Point2f apertureSample = sampler->next2D();
+                            Ray3f ray;
+                            Color3f beta = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                            for (int depth = 0; depth < m_maxDepth && beta.maxCoeff() > 0; ++depth) {
+                                Intersection its;
+                                if (!scene->rayIntersect(ray, its) || its.mesh->isEmitter())
+                                    break;
+
+                                const BSDF* bsdf = getBSDF(its);
+                                Vector3f wi = its.toLocal(-ray.d);
+                                if (bsdf->getRoughness(its.uv) > 0) {
+                                    pixel.vp.p = its.p;
+                                    pixel.vp.wi = wi;
+                                    pixel.vp.frame = its.shFrame;
+                                    pixel.vp.uv = its.uv;
+                                    pixel.vp.bsdf = bsdf;
+                                    pixel.vp.beta = beta;
+                                    break;
+                                }
+
+                                BSDFQueryRecord bRec(wi, its.uv);
+                                beta *= bsdf->sample(bRec, sampler->next2D());
+                                ray = Ray3f(its.p, its.toWorld(bRec.wo));
+                            }
+                        }
+                    }
+                }
+            }
+        );
+    }
+
+    /// Trace the photons of one iteration and splat them into the visible points
+    void tracePhotons(const Scene* scene, const VisiblePointGrid& grid,
+        std::vector<Pixel>& pixels, int iteration) const
+    {
+        int chunkCount = (m_photonsPerIteration + PhotonChunkSize - 1) / PhotonChunkSize;
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, chunkCount),
+            [&](const tbb::blocked_range<int>& range) {
+                for (int chunk = range.begin(); chunk < range.end(); ++chunk) {
+                    pcg32 rng((uint64_t) iteration, (uint64_t) chunk);
+                    int photons = std::min(PhotonChunkSize, m_photonsPerIteration - chunk * PhotonChunkSize);
+
+                    for (int i = 0; i < photons; ++i) {
+                        float pdf_select;
+                        const Emitter* emitter = scene->sampleEmitter(rng.nextFloat(), pdf_select);
+                        EmitterQueryRecord lRec;
+                        Ray3f ray;
+                        Point2f positionSample(rng.nextFloat(), rng.nextFloat());
+                        Point2f directionSample(rng.nextFloat(), rng.nextFloat());
+                        Color3f beta = emitter->samplePhoton(lRec, ray, positionSample, directionSample);
+                        if (!(beta.maxCoeff() > 0) || !(pdf_select > 0))
+                            continue;
+                        beta /= pdf_select;
+
+                        for (int depth = 0; depth < m_maxDepth; ++depth) {
+                            Intersection its;
+                            if (!scene->rayIntersect(ray, its) || its.mesh->isEmitter())
+                                break;
+
+                            const BSDF* bsdf = getBSDF(its);
+
+                            /* Direct illumination is computed by Li() */
+                            const uint32_t *begin, *end;
+                            if (depth > 0 && grid.lookup(its.p, begin, end)) {
+                                for (const uint32_t* entry = begin; entry != end; ++entry) {
+                                    Pixel& pixel = pixels[*entry];
+                                    if ((pixel.vp.p - its.p).squaredNorm() > pixel.radius * pixel.radius)
+                                        continue;
+
+                                    const VisiblePoint& vp = pixel.vp;
+                                    BSDFQueryRecord bRec(vp.wi, vp.frame.toLocal(-ray.d), vp.uv, ESolidAngle);
+                                    Color3f phi = beta * vp.bsdf->eval(bRec);
+                                    for (int c = 0; c < 3; ++c)
+                                        atomicAdd(pixel.phi[c], phi[c]);
+                                    pixel.M++;
+                                }
+                            }
+
+                            BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
+                            Color3f betaNew = beta * bsdf->sample(bRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+
+                            /* Russian roulette keeps the photon power roughly constant */
+                            float q = std::min(1.f, betaNew.getLuminance() / beta.getLuminance());
+                            if (!(rng.nextFloat() < q))
+                                break;
+                            beta = betaNew / q;
+                            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+                        }
+                    }
+                }
+            }
+        );
+    }
+
+    static void atomicAdd(std::atomic<float>& target, float value)
+    {
+        float current = target.load();
+        while (!target.compare_exchange_weak(current, current + value))
+            ;
+    }
+
+    int m_iterations;
+    int m_photonsPerIteration;
+    float m_initialRadius;
+    float m_alpha;
+    int m_maxDepth;
+
+    Vector2i m_outputSize;
+    /// Photon estimate of every pixel (computed by preprocess())
+    std::vector<Color3f> m_photonRadiance;
+};
+
+NORI_REGISTER_CLASS(SPPMIntegrator, "sppm");
+NORI_NAMESPACE_END
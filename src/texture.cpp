@@ -70,6 +70,16 @@ public:
 		return m_bitmap->eval(uv) * m_color;
 	}
 
+	virtual void evalBatch(const Point2f* uv, Color3f* result, size_t count) const {
+		if (!m_bitmap) {
+			std::fill(result, result + count, m_color);
+			return;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			result[i] = m_bitmap->eval(uv[i]) * m_color;
+	}
+
 protected:
 	Color3f m_color;
 	LDRBitmap* m_bitmap;
@@ -0,0 +1,202 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/common.h>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+/*
+ * volconvert: turns dense grids into Mitsuba .vol (version 3) files that
+ * the "gridvolume" data source can memory map. The input is a headerless
+ * file with float32 or uint8 voxels, interleaved channels, and either x
+ * (e.g. raw exports) or z (OpenVDB's default Dense layout, as written by
+ * copyToDense) running fastest. With --quantize, voxels are stored as
+ * uint8 with a scale per brick and channel (type 5, see gridvolume.cpp),
+ * which takes a quarter of the memory of float32 and keeps the precision
+ * of every brick relative to its own maximum. Float32 grids get their
+ * largest value appended, so that loading them doesn't need to read the
+ * voxels.
+ */
+
+using namespace nori;
+
+static void usage() {
+    cerr << "Syntax: volconvert [options] <input> <output.vol>" << endl
+         << "Options:" << endl
+         << "  --res X Y Z          Resolution of the grid (required)" << endl
+         << "  --channels N         Channels per voxel, 1 or 3 (default 1)" << endl
+         << "  --input float32|uint8" << endl
+         << "                       Type of the input values (default float32)" << endl
+         << "  --layout xyz|zyx     Axis that runs fastest in the input: x (default)," << endl
+         << "                       or z for OpenVDB Dense grids" << endl
+         << "  --bbox x0 y0 z0 x1 y1 z1" << endl
+         << "                       Bounds of the grid (default unit cube)" << endl
+         << "  --quantize           Store uint8 values with a per-brick scale" << endl
+         << "  --brick N            Brick size for --quantize, a power of two (default 8)" << endl;
+}
+
+template <typename T> static void write(std::ofstream &os, const T &value) {
+    os.write((const char *) &value, sizeof(T));
+}
+
+int main(int argc, char **argv) {
+    int res[3] = { 0, 0, 0 }, channels = 1, brickSize = 8;
+    bool inputFloat = true, zFastest = false, quantize = false;
+    float bbox[6] = { 0, 0, 0, 1, 1, 1 };
+    std::vector<std::string> files;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto next = [&]() -> std::string {
+                if (++i >= argc)
+                    throw NoriException("Missing value for \"%s\"", arg);
+                return argv[i];
+            };
+            if (arg == "--res") {
+                for (int j = 0; j < 3; ++j)
+                    res[j] = std::stoi(next());
+            } else if (arg == "--channels") {
+                channels = std::stoi(next());
+            } else if (arg == "--input") {
+                std::string type = next();
+                if (type != "float32" && type != "uint8")
+                    throw NoriException("Unknown input type \"%s\"", type);
+                inputFloat = type == "float32";
+            } else if (arg == "--layout") {
+                std::string layout = next();
+                if (layout != "xyz" && layout != "zyx")
+                    throw NoriException("Unknown layout \"%s\"", layout);
+                zFastest = layout == "zyx";
+            } else if (arg == "--bbox") {
+                for (int j = 0; j < 6; ++j)
+                    bbox[j] = std::stof(next());
+            } else if (arg == "--quantize") {
+                quantize = true;
+            } else if (arg == "--brick") {
+                brickSize = std::stoi(next());
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                throw NoriException("Unknown option \"%s\"", arg);
+            } else {
+                files.push_back(arg);
+            }
+        }
+
+        if (files.size() != 2 || res[0] <= 1 || res[1] <= 1 || res[2] <= 1) {
+            usage();
+            return -1;
+        }
+        if (channels != 1 && channels != 3)
+            throw NoriException("Only 1 and 3 channels are supported");
+        if (brickSize <= 0 || (brickSize & (brickSize - 1)))
+            throw NoriException("The brick size must be a power of two");
+
+        /* Read the input and reorder it into x-fastest order */
+        size_t voxels = (size_t) res[0] * res[1] * res[2];
+        size_t count = voxels * channels;
+        std::ifstream is(files[0], std::ios::binary);
+        if (!is)
+            throw NoriException("Could not open \"%s\"", files[0]);
+        std::vector<char> raw(count * (inputFloat ? 4 : 1));
+        if (!is.read(raw.data(), raw.size()))
+            throw NoriException("\"%s\" is smaller than the grid (%i bytes expected)", files[0], raw.size());
+
+        std::vector<float> data(count);
+        for (int z = 0; z < res[2]; ++z) {
+            for (int y = 0; y < res[1]; ++y) {
+                for (int x = 0; x < res[0]; ++x) {
+                    size_t src = zFastest ? ((size_t) x * res[1] + y) * res[2] + z
+                        : ((size_t) z * res[1] + y) * res[0] + x;
+                    size_t dst = ((size_t) z * res[1] + y) * res[0] + x;
+                    for (int c = 0; c < channels; ++c) {
+                        size_t i = src * channels + c;
+                        float value;
+                        if (inputFloat)
+                            memcpy(&value, &raw[4 * i], 4);
+                        else
+                            value = (uint8_t) raw[i] / 255.f;
+                        data[dst * channels + c] = value;
+                    }
+                }
+            }
+        }
+
+        std::ofstream os(files[1], std::ios::binary);
+        if (!os)
+            throw NoriException("Could not create \"%s\"", files[1]);
+        os.write("VOL", 3);
+        write(os, (uint8_t) 3);
+        write(os, (int32_t) (quantize ? 5 : 1));
+        for (int j = 0; j < 3; ++j)
+            write(os, (int32_t) res[j]);
+        write(os, (int32_t) channels);
+        for (int j = 0; j < 6; ++j)
+            write(os, bbox[j]);
+
+        if (!quantize) {
+            os.write((const char *) data.data(), count * sizeof(float));
+            float maxValue = 0.f;
+            for (size_t i = 0; i < count; ++i)
+                maxValue = std::max(maxValue, data[i]);
+            write(os, maxValue);
+        } else {
+            int bricks[3];
+            for (int j = 0; j < 3; ++j)
+                bricks[j] = (res[j] + brickSize - 1) / brickSize;
+            size_t brickCount = (size_t) bricks[0] * bricks[1] * bricks[2];
+
+            /* Largest value of every brick and channel (negative values are clamped) */
+            std::vector<float> scale(brickCount * channels, 0.f);
+            auto brickOf = [&](int x, int y, int z) {
+                return ((size_t) (z / brickSize) * bricks[1] + y / brickSize) * bricks[0] + x / brickSize;
+            };
+            for (int z = 0; z < res[2]; ++z)
+                for (int y = 0; y < res[1]; ++y)
+                    for (int x = 0; x < res[0]; ++x)
+                        for (int c = 0; c < channels; ++c) {
+                            float &s = scale[brickOf(x, y, z) * channels + c];
+                            s = std::max(s, data[(((size_t) z * res[1] + y) * res[0] + x) * channels + c]);
+                        }
+
+            std::vector<uint8_t> quantized(count);
+            for (int z = 0; z < res[2]; ++z)
+                for (int y = 0; y < res[1]; ++y)
+                    for (int x = 0; x < res[0]; ++x)
+                        for (int c = 0; c < channels; ++c) {
+                            size_t i = (((size_t) z * res[1] + y) * res[0] + x) * channels + c;
+                            float s = scale[brickOf(x, y, z) * channels + c];
+                            float v = s > 0 ? std::max(data[i], 0.f) / s : 0.f;
+                            quantized[i] = (uint8_t) std::min(255.f, std::round(v * 255.f));
+                        }
+
+            write(os, (int32_t) brickSize);
+            os.write((const char *) scale.data(), scale.size() * sizeof(float));
+            os.write((const char *) quantized.data(), quantized.size());
+        }
+        if (!os)
+            throw NoriException("Error while writing \"%s\"", files[1]);
+
+        cout << "Wrote " << files[1] << ": " << res[0] << "x" << res[1] << "x" << res[2]
+             << " (" << channels << " channels, " << (quantize ? "bricked uint8" : "float32") << ")" << endl;
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
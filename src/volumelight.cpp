@@ -0,0 +1,107 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/emitter.h>
+#include <nori/medium.h>
+#include <nori/warp.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Light source that samples the emission of a medium
+ *
+ * Points are chosen inside of the medium proportionally to the emitted
+ * power (see Medium::sampleEmission()), so next event estimation from
+ * surfaces and other media targets the bright voxels. Emissive media
+ * create one on their own; it can also be given explicitly:
+ *
+ *   <medium type="heterogeneous">
+ *       <emitter type="volumelight"/>
+ *       ...
+ *   </medium>
+ */
+class VolumeEmitter : public Emitter {
+public:
+	VolumeEmitter(const PropertyList &props) {
+		m_type = EmitterType::EMITTER_VOLUME;
+	}
+
+	virtual std::string toString() const {
+		return "VolumeLight[]";
+	}
+
+	// Radiance emitted per unit length; divided by the solid angle density of pdf()
+	// this is the contribution of the emission in the medium along the direction to p
+	virtual Color3f eval(const EmitterQueryRecord & lRec) const {
+		if (!m_medium)
+			throw NoriException("There is no medium attached to this volume light!");
+		return m_medium->getEmission(lRec.p);
+	}
+
+	virtual Color3f sample(EmitterQueryRecord & lRec, const Point2f & sample, float optional_u) const {
+		if (!m_medium)
+			throw NoriException("There is no medium attached to this volume light!");
+		if (!(m_medium->sampleEmission(sample, lRec.p) > 0))
+			return Color3f(0.f);
+		lRec.n = Normal3f(0.f);
+		lRec.dist = (lRec.p - lRec.ref).norm();
+		lRec.wi = (lRec.p - lRec.ref) / lRec.dist;
+		lRec.pdf = this->pdf(lRec);
+		return eval(lRec);
+	}
+
+	// Photons leave the sampled point uniformly in all directions
+	virtual Color3f samplePhoton(EmitterQueryRecord & lRec, Ray3f & ray, const Point2f & positionSample, const Point2f & directionSample) const {
+		if (!m_medium)
+			throw NoriException("There is no medium attached to this volume light!");
+		lRec.emitter = this;
+		float pdf_pos = m_medium->sampleEmission(positionSample, lRec.p);
+		if (!(pdf_pos > 0))
+			return Color3f(0.f);
+		lRec.n = Normal3f(0.f);
+		ray = Ray3f(lRec.p, Warp::squareToUniformSphere(directionSample));
+		return m_medium->getEmission(lRec.p) * 4 * M_PI / pdf_pos;
+	}
+
+	virtual void pdfPhoton(const EmitterQueryRecord & lRec, const Vector3f & d, float & pdfPosition, float & pdfDirection) const {
+		if (!m_medium)
+			throw NoriException("There is no medium attached to this volume light!");
+		pdfPosition = m_medium->pdfEmission(lRec.p);
+		pdfDirection = INV_FOURPI;
+	}
+
+	// Solid angle density: the volume density times the squared distance (there's no cosine)
+	virtual float pdf(const EmitterQueryRecord &lRec) const {
+		if (!m_medium)
+			throw NoriException("There is no medium attached to this volume light!");
+		return m_medium->pdfEmission(lRec.p) * lRec.dist * lRec.dist;
+	}
+
+	// Get the parent medium
+	void setParent(NoriObject *parent) {
+		if (parent->getClassType() == EMedium)
+			m_medium = static_cast<Medium*>(parent);
+	}
+
+protected:
+	const Medium* m_medium = nullptr;
+};
+
+NORI_REGISTER_CLASS(VolumeEmitter, "volumelight")
+NORI_NAMESPACE_END